@@ -0,0 +1,178 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+#ifndef HIJACK_ARBITER_H
+#define HIJACK_ARBITER_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+/**
+ * Socket of the node arbiter, overridable from the environment
+ */
+#define ARBITER_SOCKET_PATH "/var/run/anylearn/arbiter.sock"
+#define ARBITER_SOCKET_PATH_ENV "ANYCUDA_ARBITER_SOCKET"
+
+/**
+ * Default milliseconds a pod holds a device once granted while others wait
+ */
+#define ARBITER_SLICE_MS (20)
+
+/**
+ * Devices, pods and processes one arbiter schedules
+ */
+#define ARBITER_MAX_DEVICES (16)
+#define ARBITER_MAX_PODS (64)
+#define ARBITER_MAX_CLIENTS (256)
+
+/**
+ * Length of pod names and device UUIDs on the wire
+ */
+#define ARBITER_NAME_LEN (48)
+
+/**
+ * Virtual time a pod of weight 1 is charged per millisecond it holds a
+ * device
+ */
+#define ARBITER_WEIGHT_SCALE (1000)
+
+  typedef enum
+  {
+    ARBITER_HELLO = 1,   /**< client -> arbiter: pod and weight */
+    ARBITER_ACQUIRE = 2, /**< client -> arbiter: wants the device */
+    ARBITER_RELEASE = 3, /**< client -> arbiter: its work on the device
+                            drained */
+    ARBITER_GRANT = 4,   /**< arbiter -> client: the device is its own */
+    ARBITER_REVOKE = 5,  /**< arbiter -> client: the slice is over, release
+                            once drained */
+  } arbiter_msg_type_t;
+
+  /**
+   * Message of the arbiter protocol, one per datagram of a SOCK_SEQPACKET
+   * socket
+   */
+  typedef struct
+  {
+    uint32_t type;
+    uint32_t weight;   /**< ARBITER_HELLO */
+    uint32_t slice_ms; /**< ARBITER_GRANT */
+    char name[ARBITER_NAME_LEN]; /**< pod name for ARBITER_HELLO, device
+                                    UUID otherwise */
+  } __attribute__((packed, aligned(8))) arbiter_msg_t;
+
+  /**
+   * How the scheduler tells clients about its decisions, the daemon sends
+   * messages while tests record them
+   */
+  typedef struct
+  {
+    void *opaque;
+    void (*grant)(void *opaque, int client, const char *uuid,
+                  uint32_t slice_ms);
+    void (*revoke)(void *opaque, int client, const char *uuid);
+  } arbiter_ops_t;
+
+  typedef struct
+  {
+    char name[ARBITER_NAME_LEN];
+    uint32_t weight;
+    int clients; /**< connected clients, 0 when the slot is free */
+    uint64_t vtime[ARBITER_MAX_DEVICES]; /**< virtual time used on each
+                                            device */
+  } arbiter_pod_t;
+
+  typedef struct
+  {
+    int pod; /**< -1 when the slot is free */
+    uint64_t waiting[ARBITER_MAX_DEVICES]; /**< order of the request, 0 when
+                                              not waiting */
+  } arbiter_client_t;
+
+  typedef struct
+  {
+    char uuid[ARBITER_NAME_LEN]; /**< empty when the slot is free */
+    int holder;                  /**< client holding it, -1 when none */
+    int revoking;                /**< the holder was told to release */
+    uint64_t granted_at;
+    uint64_t vclock; /**< virtual time of the last grant */
+  } arbiter_device_t;
+
+  /**
+   * Weighted fair queuing of devices between pods: the waiting pod which
+   * used a device the least for its weight gets it next, for a slice
+   */
+  typedef struct
+  {
+    arbiter_ops_t ops;
+    uint32_t slice_ms;
+    uint64_t seq;
+    arbiter_pod_t pods[ARBITER_MAX_PODS];
+    arbiter_client_t clients[ARBITER_MAX_CLIENTS];
+    arbiter_device_t devices[ARBITER_MAX_DEVICES];
+  } arbiter_t;
+
+  /**
+   * Reset arb to schedule slices of slice_ms
+   */
+  void arbiter_init(arbiter_t *arb, const arbiter_ops_t *ops,
+                    uint32_t slice_ms);
+
+  /**
+   * Register client as a process of pod, weight 0 counts as 1
+   *
+   * @return 0 -> registered, 1 -> no room or bad client
+   */
+  int arbiter_hello(arbiter_t *arb, int client, const char *pod,
+                    uint32_t weight);
+
+  /**
+   * Queue client for device uuid, it's granted at once when the device is
+   * free
+   *
+   * @return 0 -> queued or granted, 1 -> no room or bad client
+   */
+  int arbiter_acquire(arbiter_t *arb, int client, const char *uuid,
+                      uint64_t now);
+
+  /**
+   * Give back device uuid held by client, or stop waiting for it
+   */
+  void arbiter_release(arbiter_t *arb, int client, const char *uuid,
+                       uint64_t now);
+
+  /**
+   * Forget client and everything it held or waited for
+   */
+  void arbiter_disconnect(arbiter_t *arb, int client, uint64_t now);
+
+  /**
+   * Revoke the slices which are over while other pods wait
+   *
+   * @return milliseconds until the next slice ends, -1 when none has to
+   */
+  int64_t arbiter_tick(arbiter_t *arb, uint64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -66,6 +66,33 @@ extern "C"
     CU_MEM_ATTACH_SINGLE = 0x4  /**< Memory can only be accessed by a single stream on the associated device */
   } CUmemAttach_flags;
 
+/**
+ * CUDA cuMemHostAlloc flags
+ */
+#define CU_MEMHOSTALLOC_PORTABLE 0x01
+#define CU_MEMHOSTALLOC_DEVICEMAP 0x02
+#define CU_MEMHOSTALLOC_WRITECOMBINED 0x04
+
+/**
+ * CUDA cuMemHostRegister flags
+ */
+#define CU_MEMHOSTREGISTER_PORTABLE 0x01
+#define CU_MEMHOSTREGISTER_DEVICEMAP 0x02
+#define CU_MEMHOSTREGISTER_IOMEMORY 0x04
+#define CU_MEMHOSTREGISTER_READ_ONLY 0x08
+
+/**
+ * Device identifier of the host for managed memory advice and prefetch
+ */
+#define CU_DEVICE_CPU ((CUdevice)-1)
+
+/**
+ * CUDA cuLaunchKernel extra markers
+ */
+#define CU_LAUNCH_PARAM_END ((void *)0x00)
+#define CU_LAUNCH_PARAM_BUFFER_POINTER ((void *)0x01)
+#define CU_LAUNCH_PARAM_BUFFER_SIZE ((void *)0x02)
+
   /**
    * CUDA library enumerator entry
    */
@@ -1114,6 +1141,7 @@ extern "C"
     CUDA_ENTRY_ENUM(cuUserObjectCreate),
     CUDA_ENTRY_ENUM(cuUserObjectRelease),
     CUDA_ENTRY_ENUM(cuUserObjectRetain),
+    CUDA_ENTRY_ENUM(cuFuncGetParamInfo),
     CUDA_ENTRY_END
   } cuda_entry_enum_t;
 
@@ -1171,7 +1171,75 @@ extern "C"
     CU_AD_FORMAT_SIGNED_INT16 = 0x09,   /**< Signed 16-bit integers */
     CU_AD_FORMAT_SIGNED_INT32 = 0x0a,   /**< Signed 32-bit integers */
     CU_AD_FORMAT_HALF = 0x10,           /**< 16-bit floating point */
-    CU_AD_FORMAT_FLOAT = 0x20           /**< 32-bit floating point */
+    CU_AD_FORMAT_FLOAT = 0x20,          /**< 32-bit floating point */
+    CU_AD_FORMAT_NV12 = 0xb0,           /**< 8-bit YUV planar format, with 4:2:0
+                                           sampling */
+    CU_AD_FORMAT_UNORM_INT8X1 = 0xc0,   /**< 1 channel unsigned 8-bit normalized
+                                           integer */
+    CU_AD_FORMAT_UNORM_INT8X2 = 0xc1,   /**< 2 channel unsigned 8-bit normalized
+                                           integer */
+    CU_AD_FORMAT_UNORM_INT8X4 = 0xc2,   /**< 4 channel unsigned 8-bit normalized
+                                           integer */
+    CU_AD_FORMAT_UNORM_INT16X1 = 0xc3,  /**< 1 channel unsigned 16-bit
+                                           normalized integer */
+    CU_AD_FORMAT_UNORM_INT16X2 = 0xc4,  /**< 2 channel unsigned 16-bit
+                                           normalized integer */
+    CU_AD_FORMAT_UNORM_INT16X4 = 0xc5,  /**< 4 channel unsigned 16-bit
+                                           normalized integer */
+    CU_AD_FORMAT_SNORM_INT8X1 = 0xc6,   /**< 1 channel signed 8-bit normalized
+                                           integer */
+    CU_AD_FORMAT_SNORM_INT8X2 = 0xc7,   /**< 2 channel signed 8-bit normalized
+                                           integer */
+    CU_AD_FORMAT_SNORM_INT8X4 = 0xc8,   /**< 4 channel signed 8-bit normalized
+                                           integer */
+    CU_AD_FORMAT_SNORM_INT16X1 = 0xc9,  /**< 1 channel signed 16-bit
+                                           normalized integer */
+    CU_AD_FORMAT_SNORM_INT16X2 = 0xca,  /**< 2 channel signed 16-bit
+                                           normalized integer */
+    CU_AD_FORMAT_SNORM_INT16X4 = 0xcb,  /**< 4 channel signed 16-bit
+                                           normalized integer */
+    CU_AD_FORMAT_BC1_UNORM = 0x91,      /**< 4 channel unsigned normalized
+                                           block-compressed (BC1 compression)
+                                           format */
+    CU_AD_FORMAT_BC1_UNORM_SRGB = 0x92, /**< 4 channel unsigned normalized
+                                           block-compressed (BC1 compression)
+                                           format with sRGB encoding */
+    CU_AD_FORMAT_BC2_UNORM = 0x93,      /**< 4 channel unsigned normalized
+                                           block-compressed (BC2 compression)
+                                           format */
+    CU_AD_FORMAT_BC2_UNORM_SRGB = 0x94, /**< 4 channel unsigned normalized
+                                           block-compressed (BC2 compression)
+                                           format with sRGB encoding */
+    CU_AD_FORMAT_BC3_UNORM = 0x95,      /**< 4 channel unsigned normalized
+                                           block-compressed (BC3 compression)
+                                           format */
+    CU_AD_FORMAT_BC3_UNORM_SRGB = 0x96, /**< 4 channel unsigned normalized
+                                           block-compressed (BC3 compression)
+                                           format with sRGB encoding */
+    CU_AD_FORMAT_BC4_UNORM = 0x97,      /**< 1 channel unsigned normalized
+                                           block-compressed (BC4 compression)
+                                           format */
+    CU_AD_FORMAT_BC4_SNORM = 0x98,      /**< 1 channel signed normalized
+                                           block-compressed (BC4 compression)
+                                           format */
+    CU_AD_FORMAT_BC5_UNORM = 0x99,      /**< 2 channel unsigned normalized
+                                           block-compressed (BC5 compression)
+                                           format */
+    CU_AD_FORMAT_BC5_SNORM = 0x9a,      /**< 2 channel signed normalized
+                                           block-compressed (BC5 compression)
+                                           format */
+    CU_AD_FORMAT_BC6H_UF16 = 0x9b,      /**< 3 channel unsigned half-float
+                                           block-compressed (BC6H compression)
+                                           format */
+    CU_AD_FORMAT_BC6H_SF16 = 0x9c,      /**< 3 channel signed half-float
+                                           block-compressed (BC6H compression)
+                                           format */
+    CU_AD_FORMAT_BC7_UNORM = 0x9d,      /**< 4 channel unsigned normalized
+                                           block-compressed (BC7 compression)
+                                           format */
+    CU_AD_FORMAT_BC7_UNORM_SRGB = 0x9e  /**< 4 channel unsigned normalized
+                                           block-compressed (BC7 compression)
+                                           format with sRGB encoding */
   } CUarray_format;
 
   /**
@@ -1200,6 +1268,56 @@ extern "C"
     unsigned int Flags;       /**< Flags */
   } CUDA_ARRAY3D_DESCRIPTOR;
 
+/**
+ * If set, the CUDA array is a collection of layers, where each layer is
+ * either a 1D or a 2D array and the Depth member of CUDA_ARRAY3D_DESCRIPTOR
+ * specifies the number of layers, not the depth of a 3D array.
+ */
+#define CUDA_ARRAY3D_LAYERED 0x01
+
+/**
+ * This flag must be set in order to bind a surface reference to the CUDA
+ * array
+ */
+#define CUDA_ARRAY3D_SURFACE_LDST 0x02
+
+/**
+ * If set, the CUDA array is a collection of six 2D arrays, representing faces
+ * of a cube. The width of such a CUDA array must be equal to its height, and
+ * Depth must be six. If ::CUDA_ARRAY3D_LAYERED flag is also set, then the
+ * CUDA array is a collection of cubemaps and Depth must be a multiple of six.
+ */
+#define CUDA_ARRAY3D_CUBEMAP 0x04
+
+/**
+ * This flag must be set in order to perform texture gather operations on a
+ * CUDA array.
+ */
+#define CUDA_ARRAY3D_TEXTURE_GATHER 0x08
+
+/**
+ * This flag if set indicates that the CUDA array is a DEPTH_TEXTURE.
+ */
+#define CUDA_ARRAY3D_DEPTH_TEXTURE 0x10
+
+/**
+ * This flag indicates that the CUDA array may be bound as a color target in
+ * an external graphics API
+ */
+#define CUDA_ARRAY3D_COLOR_ATTACHMENT 0x20
+
+/**
+ * This flag if set indicates that the CUDA array or CUDA mipmapped array is a
+ * sparse CUDA array or CUDA mipmapped array respectively
+ */
+#define CUDA_ARRAY3D_SPARSE 0x40
+
+/**
+ * This flag if set indicates that the CUDA array or CUDA mipmapped array will
+ * allow deferred memory mapping
+ */
+#define CUDA_ARRAY3D_DEFERRED_MAPPING 0x80
+
   /**
    * Texture reference addressing modes
    */
@@ -1962,6 +2080,31 @@ extern "C"
                      has been invalidated, but not terminated */
   } CUstreamCaptureStatus;
 
+  /**
+   * Flags to specify search options for ::cuGetProcAddress
+   */
+  typedef enum CUdriverProcAddress_flags_enum
+  {
+    CU_GET_PROC_ADDRESS_DEFAULT = 0, /**< Default search mode for driver
+                                        symbols. */
+    CU_GET_PROC_ADDRESS_LEGACY_STREAM =
+        1 << 0, /**< Search for legacy versions of driver symbols. */
+    CU_GET_PROC_ADDRESS_PER_THREAD_DEFAULT_STREAM =
+        1 << 1 /**< Search for per-thread versions of driver symbols. */
+  } CUdriverProcAddress_flags;
+
+  /**
+   * Event creation flags
+   */
+  typedef enum CUevent_flags_enum
+  {
+    CU_EVENT_DEFAULT = 0x0,        /**< Default event flag */
+    CU_EVENT_BLOCKING_SYNC = 0x1,  /**< Event uses blocking synchronization */
+    CU_EVENT_DISABLE_TIMING = 0x2, /**< Event will not record timing data */
+    CU_EVENT_INTERPROCESS = 0x4    /**< Event is suitable for interprocess use.
+                                      CU_EVENT_DISABLE_TIMING must be set */
+  } CUevent_flags;
+
   /**
    * External semaphore wait parameters
    */
@@ -2361,7 +2504,11 @@ extern "C"
     CU_MEMPOOL_ATTR_REUSE_FOLLOW_EVENT_DEPENDENCIES = 1,
     CU_MEMPOOL_ATTR_REUSE_ALLOW_OPPORTUNISTIC,
     CU_MEMPOOL_ATTR_REUSE_ALLOW_INTERNAL_DEPENDENCIES,
-    CU_MEMPOOL_ATTR_RELEASE_THRESHOLD
+    CU_MEMPOOL_ATTR_RELEASE_THRESHOLD,
+    CU_MEMPOOL_ATTR_RESERVED_MEM_CURRENT,
+    CU_MEMPOOL_ATTR_RESERVED_MEM_HIGH,
+    CU_MEMPOOL_ATTR_USED_MEM_CURRENT,
+    CU_MEMPOOL_ATTR_USED_MEM_HIGH
   } CUmemPool_attribute;
 
   /**
@@ -26,10 +26,12 @@ extern "C"
 
 #include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "nvml-subset.h"
 #include "cuda-subset.h"
@@ -49,6 +51,19 @@ extern "C"
  */
 #define PIDS_CONFIG_PATH (ANYCUDA_CONFIG_PATH "/" PIDS_CONFIG_NAME)
 
+/**
+ * Proc trees of the host and of the pod, overridable from the environment
+ */
+#define HOST_PROC_PATH "/host_proc"
+#define HOST_PROC_PATH_ENV "ANYCUDA_HOST_PROC"
+#define PROC_PATH "/proc"
+#define PROC_PATH_ENV "ANYCUDA_PROC"
+
+/**
+ * Cached cgroup membership entries, must be a power of 2
+ */
+#define CGROUP_CACHE_SIZE (4096)
+
 /**
  * Default prefix for cgroup path
  */
@@ -69,6 +84,125 @@ extern "C"
  */
 #define MAX_PIDS (1024)
 
+/**
+ * Max device count
+ */
+#define MAX_DEVICES (16)
+
+/**
+ * Allocation ledger hash buckets and lock stripes
+ */
+#define LEDGER_BUCKETS (4096)
+#define LEDGER_LOCKS (64)
+
+/**
+ * Default milliseconds between two NVML samples of pod usage
+ */
+#define DEFAULT_SAMPLE_INTERVAL (1000)
+
+/**
+ * Default milliseconds an allocation waits for quota under the wait policy
+ */
+#define DEFAULT_OVER_LIMIT_TIMEOUT (10000)
+
+/**
+ * Shared memory segment of pod usage, the pod name is appended
+ */
+#define POD_SHM_PREFIX "/anycuda."
+#define POD_SHM_MAGIC (0x41435544)
+#define POD_SHM_VERSION (9)
+
+/**
+ * Max processes of one pod sharing the usage segment
+ */
+#define POD_SHM_MAX_PROCS (256)
+
+/**
+ * Max allocations the processes of a pod export to each other through IPC
+ */
+#define POD_SHM_MAX_IPC (1024)
+
+/**
+ * Small allocation cache: size classes from 256 B to 256 KiB carved out of
+ * 2 MiB device chunks, chunks idle for SLAB_IDLE_TRIM seconds are released
+ */
+#define SLAB_CHUNK_SIZE (2UL << 20)
+#define SLAB_MIN_SHIFT (8)
+#define SLAB_MAX_SHIFT (18)
+#define SLAB_CLASSES (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SLAB_MAX_SIZE (1UL << SLAB_MAX_SHIFT)
+#define SLAB_IDLE_TRIM (10)
+
+/**
+ * Granularity of the device head of a split allocation, the large page size
+ * of unified memory
+ */
+#define SPLIT_ALIGN (2UL << 20)
+
+/**
+ * Granularity the stream ordered allocator grows its pools by
+ */
+#define POOL_ALIGN (2UL << 20)
+
+/**
+ * Row alignment of pitched allocations, also used for rows placed over the
+ * limit, and the tile arrays are laid out in: rows of ARRAY_TILE_WIDTH bytes
+ * by ARRAY_TILE_HEIGHT, each slice rounded to ARRAY_TILE_SIZE
+ */
+#define PITCH_ALIGN (512)
+#define ARRAY_TILE_WIDTH (64)
+#define ARRAY_TILE_HEIGHT (8)
+#define ARRAY_TILE_SIZE (512)
+
+/**
+ * Launched functions remembered so local memory is estimated once per
+ * function, must be a power of 2
+ */
+#define IMPLICIT_FUNC_CACHE (1024)
+
+/**
+ * Kernel cost model: one launch in KERNEL_COST_SAMPLE is timed, averages
+ * are kept for KERNEL_COST_CACHE shapes, must be a power of 2, a new time
+ * weighs 1 / KERNEL_COST_WEIGHT, and at most KERNEL_COST_EVENTS pairs of
+ * events exist at once
+ */
+#define KERNEL_COST_SAMPLE (16)
+#define KERNEL_COST_CACHE (4096)
+#define KERNEL_COST_WEIGHT (8)
+#define KERNEL_COST_EVENTS (64)
+
+/**
+ * Queue depth limiter: a thread marks its launches on a stream by an event
+ * every QUEUE_MARKER_BATCH kernels, keeps batches open for
+ * QUEUE_BATCH_STREAMS streams, must be a power of 2, and at most
+ * QUEUE_MARKER_EVENTS events exist at once
+ */
+#define QUEUE_MARKER_BATCH (8)
+#define QUEUE_BATCH_STREAMS (16)
+#define QUEUE_MARKER_EVENTS (256)
+
+/**
+ * Host memory given out over the limit is backed by huge pages from this
+ * size, and NUMA nodes a node mask can name
+ */
+#define HOST_HUGE_PAGE_SIZE (2UL << 20)
+#define HOST_NUMA_NODES (256)
+
+/**
+ * Kernels whose parameters are cached for launch time prefetch, must be a
+ * power of 2, and parameters scanned per launch
+ */
+#define RESIDENCY_FUNC_CACHE (1024)
+#define RESIDENCY_MAX_PARAMS (64)
+
+/**
+ * Launches reading a range without a write in between before it is advised
+ * read mostly, and turns between writes and reads before it is advised
+ * accessed by its device
+ */
+#define ADVISE_READ_MOSTLY_READS (8)
+#define ADVISE_ACCESSED_BY_FLIPS (4)
+
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
@@ -108,6 +242,32 @@ extern "C"
     int limit;
   } __attribute__((packed, aligned(8))) deviceLimit;
 
+  /**
+   * Placement of an allocation which doesn't fit in the pod limit
+   */
+  typedef enum
+  {
+    OVER_LIMIT_OOM = 0,        /**< fail with CUDA_ERROR_OUT_OF_MEMORY */
+    OVER_LIMIT_MANAGED = 1,    /**< managed memory attached globally */
+    OVER_LIMIT_HOSTMAPPED = 2, /**< zero copy mapped pinned host memory */
+    OVER_LIMIT_WAIT = 3,       /**< wait for quota, then the fallback */
+    OVER_LIMIT_PEER = 4,       /**< spilled to a peer device, tried before
+                                  any policy and not selectable */
+    OVER_LIMIT_POLICIES,
+  } over_limit_policy_t;
+
+  /**
+   * Huge pages backing host memory given out over the limit
+   */
+  typedef enum
+  {
+    HOST_HUGE_PAGES_NONE = 0,        /**< regular pages */
+    HOST_HUGE_PAGES_TRANSPARENT = 1, /**< madvise transparent huge pages */
+    HOST_HUGE_PAGES_EXPLICIT = 2,    /**< hugetlbfs pages, transparent ones
+                                        when none is reserved */
+    HOST_HUGE_PAGES_MODES,
+  } host_huge_pages_t;
+
   /**
    * Podconf data format
    */
@@ -122,6 +282,25 @@ extern "C"
     int gpu_mem_limit_valid;
     size_t gpu_mem_limit[16];
 
+    int sample_interval;
+    int small_alloc_cache;
+    int split_residency;
+    int peer_spill;
+    int host_huge_pages;
+
+    size_t pinned_limit;
+    int pinned_fallback;
+
+    int utilization;
+    int utilization_limit;
+
+    int max_inflight_kernels;
+    int max_inflight_ms;
+
+    int over_limit_policy;
+    int over_limit_fallback;
+    int over_limit_timeout;
+
     int valid;
   } __attribute__((packed, aligned(8))) resource_data_t;
 
@@ -131,6 +310,158 @@ extern "C"
     CUuuid uuid;
   } __attribute__((packed, aligned(8))) device_info;
 
+  /**
+   * Free device memory seen before the driver creates an object with an
+   * implicit footprint
+   */
+  typedef struct
+  {
+    int device; /**< -1 when it couldn't be measured */
+    int by_context; /**< 1 -> from cuMemGetInfo, 0 -> from NVML */
+    size_t free;
+    size_t charged;
+  } implicit_probe_t;
+
+  /**
+   * A launch being timed by a pair of events
+   */
+  typedef struct kernel_sample_st kernel_sample_t;
+
+  /**
+   * Launches of a thread on a stream not marked by an event yet
+   */
+  typedef struct queue_batch_st queue_batch_t;
+
+  /**
+   * Kind of memory recorded in the allocation ledger
+   */
+  typedef enum
+  {
+    LEDGER_DEVICE = 0,     /**< device memory, charged to the device */
+    LEDGER_MANAGED = 1,    /**< managed memory, not charged to the device */
+    LEDGER_HOSTMAPPED = 2, /**< mapped host memory, tag is the host pointer */
+    LEDGER_SPLIT = 3,      /**< managed memory with a head of size bytes on
+                              the device, tag is the full size */
+    LEDGER_HANDLE = 4,     /**< physical memory of the VMM API, charged to
+                              the device, tag counts the handle and its
+                              mappings */
+    LEDGER_IMPLICIT = 5,   /**< memory the driver takes for a context,
+                              module or limit, charged to the device */
+    LEDGER_ARRAY = 6,      /**< CUDA array or mipmapped array keyed by
+                              handle, charged to the device */
+    LEDGER_IPC = 7,        /**< memory of another process opened through
+                              IPC, not charged, tag is its pod IPC entry */
+    LEDGER_PINNED = 8,     /**< page locked host memory, charged to the
+                              pinned quota */
+    LEDGER_PAGEABLE = 9,   /**< pageable host memory given out for page
+                              locked memory over the pinned quota */
+  } ledger_kind_t;
+
+  typedef struct ledger_entry_st
+  {
+    uint64_t key;
+    uint64_t tag;
+    size_t size;
+    int device;
+    int kind;
+    struct ledger_entry_st *next;
+  } ledger_entry_t;
+
+  /**
+   * Lock striped hash map keyed by a driver handle or device pointer
+   */
+  typedef struct
+  {
+    ledger_entry_t *buckets[LEDGER_BUCKETS];
+    pthread_mutex_t locks[LEDGER_LOCKS];
+  } ledger_table_t;
+
+  /**
+   * Usage of one process in the pod segment, pid is 0 when the slot is free.
+   * The process holds a record lock on byte i of the segment file for slot
+   * i while it lives
+   */
+  typedef struct
+  {
+    volatile int pid;
+    size_t used[MAX_DEVICES];
+    size_t reserved[MAX_DEVICES];
+    size_t pinned;
+    int inflight_kernels[MAX_DEVICES];
+    int64_t inflight_ns[MAX_DEVICES];
+  } pod_proc_slot_t;
+
+  /**
+   * Usage of one device by the pod, total is used plus reserved in one word
+   * for reservations to check against. free_seq is a futex word bumped
+   * whenever quota is given back and waiters counts the threads sleeping on
+   * it. The
+   * kernels the pod queued and their predicted GPU time are in flight until
+   * the queue depth limiter sees them complete
+   */
+  typedef struct
+  {
+    size_t used;
+    size_t reserved;
+    size_t total;
+    volatile uint32_t free_seq;
+    volatile uint32_t waiters;
+    volatile int inflight_kernels;
+    volatile int64_t inflight_ns;
+  } pod_device_usage_t;
+
+  /**
+   * What the pod paid for allocations over its limit under one policy
+   */
+  typedef struct
+  {
+    uint64_t count;   /**< allocations placed by the policy */
+    uint64_t bytes;   /**< bytes placed by the policy */
+    uint64_t failed;  /**< allocations the policy couldn't place */
+    uint64_t wait_ms; /**< milliseconds spent waiting for quota */
+  } pod_policy_stat_t;
+
+  /**
+   * Allocation a process of the pod exported through IPC. The exporter pays
+   * for it, once it lets go while other processes still map it the entry
+   * holds the charge until the last of them closes it
+   */
+  typedef struct
+  {
+    int exporter; /**< slot of the exporter, -1 when it let go, 0 when the
+                     entry is free so slots are stored plus one */
+    int device;
+    uint64_t dptr; /**< address in the exporter */
+    size_t size;
+    size_t charged; /**< bytes the entry holds itself */
+    uint64_t importers[POD_SHM_MAX_PROCS / 64]; /**< bit per slot mapping
+                                                   it */
+    char handle[CU_IPC_HANDLE_SIZE];
+  } pod_ipc_entry_t;
+
+  /**
+   * Pod usage segment, shared by every process of the pod loading the
+   * library. All counters are updated with atomic builtins, the IPC entries
+   * under ipc_lock, which holds the slot of its owner plus 1
+   */
+  typedef struct
+  {
+    uint32_t magic;
+    uint32_t version;
+    pod_device_usage_t devices[MAX_DEVICES];
+    pod_policy_stat_t policies[OVER_LIMIT_POLICIES];
+    pod_proc_slot_t procs[POD_SHM_MAX_PROCS];
+    size_t pinned; /**< page locked host memory of the pod */
+    volatile int ipc_lock;
+    pod_ipc_entry_t ipc[POD_SHM_MAX_IPC];
+  } pod_shm_t;
+
+#define LEDGER_TABLE_INITIALIZER                                     \
+  {                                                                  \
+    .buckets = {NULL},                                               \
+    .locks = {[0 ... LEDGER_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER}, \
+  }
+
   typedef enum
   {
     FATAL = 0,
@@ -160,6 +491,15 @@ extern "C"
     }                                                           \
   })
 
+  static inline uint64_t monotonic_ms()
+  {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / MILLISEC;
+  }
+
   /**
    * Read controller configuration from POD_CONF
    *
@@ -172,6 +512,705 @@ extern "C"
    */
   void load_necessary_data();
 
+  /**
+   * Host proc tree, HOST_PROC_PATH unless overridden by ANYCUDA_HOST_PROC
+   */
+  const char *host_proc_path();
+
+  /**
+   * Proc tree of the pod, PROC_PATH unless overridden by ANYCUDA_PROC
+   */
+  const char *proc_path();
+
+  /**
+   * Check whether the host proc tree is visible
+   *
+   * @return 0 -> running in a pod with the host proc tree mounted
+   */
+  int check_in_pod();
+
+  /**
+   * Check whether a host pid belongs to the pod, the answer is cached until
+   * the pid is reused by another process
+   *
+   * @return 0 -> pid belongs to the pod
+   */
+  int check_pod_pid(unsigned int pid);
+
+  /**
+   * Insert an entry into a ledger table
+   *
+   * @return 0 -> success
+   */
+  int ledger_table_insert(ledger_table_t *table, uint64_t key, uint64_t tag,
+                          size_t size, int device, int kind);
+
+  /**
+   * Remove an entry from a ledger table, the removed entry is copied to
+   * entry if it is not NULL
+   *
+   * @return 0 -> found
+   */
+  int ledger_table_remove(ledger_table_t *table, uint64_t key,
+                          ledger_entry_t *entry);
+
+  /**
+   * Look up an entry of a ledger table
+   *
+   * @return 0 -> found
+   */
+  int ledger_table_lookup(ledger_table_t *table, uint64_t key,
+                          ledger_entry_t *entry);
+
+  /**
+   * Record an allocation made by this process
+   */
+  void ledger_add(uint64_t dptr, size_t size, int device, int kind);
+
+  /**
+   * Record memory of another process this one opened through IPC, entry is
+   * its pod IPC entry
+   */
+  void ledger_add_ipc(uint64_t dptr, int entry, size_t size, int device);
+
+  /**
+   * Record mapped pinned host memory, host is the pointer to give back to
+   * cuMemFreeHost
+   */
+  void ledger_add_mapped(uint64_t dptr, uint64_t host, size_t size,
+                         int device);
+
+  /**
+   * Look up an allocation made by this process
+   *
+   * @return 0 -> found
+   */
+  int ledger_find(uint64_t dptr, ledger_entry_t *entry);
+
+  /**
+   * Forget an allocation made by this process
+   *
+   * @return 0 -> the allocation was recorded
+   */
+  int ledger_del(uint64_t dptr, ledger_entry_t *entry);
+
+  /**
+   * Bytes of device memory charged by this process on device
+   */
+  size_t ledger_charged(int device);
+
+  /**
+   * Pod usage on device: charged and reserved bytes plus the offset of last
+   * reconciliation
+   */
+  size_t ledger_used(int device);
+
+  /**
+   * Align the ledger of device with a pod usage measured by NVML, usage
+   * NVML doesn't see is added but what the ledger charged is never forgiven
+   */
+  void ledger_reconcile(int device, size_t measured);
+
+  /**
+   * Reserve bytes of device before calling the driver, lock free. A
+   * reservation is either committed with ledger_commit or given back with
+   * ledger_unreserve
+   *
+   * @return 0 -> reserved, 1 -> the pod would exceed limit
+   */
+  int ledger_reserve(int device, size_t bytes, size_t limit);
+
+  /**
+   * Reserve like ledger_reserve, trimming the idle slab chunks and pool
+   * memory of device to make room when the pod is full
+   *
+   * @return 0 -> reserved, 1 -> the pod would still exceed limit
+   */
+  int ledger_reserve_or_trim(int device, size_t bytes, size_t limit);
+
+  /**
+   * Give back a reservation which was not used
+   */
+  void ledger_unreserve(int device, size_t bytes);
+
+  /**
+   * Turn a reservation into a device allocation recorded in the ledger
+   */
+  void ledger_commit(uint64_t dptr, size_t size, int device);
+
+  /**
+   * Turn a reservation of head bytes into a split allocation of size bytes
+   * whose head is on the device, only the head is charged
+   */
+  void ledger_commit_split(uint64_t dptr, size_t head, size_t size,
+                           int device);
+
+  /**
+   * Turn a reservation of reserved bytes into an allocation of kind whose
+   * real size, size bytes, is only known once the driver made it
+   */
+  void ledger_settle(uint64_t key, size_t size, size_t reserved, int device,
+                     int kind);
+
+  /**
+   * Charge (positive) or uncharge (negative) bytes of device which belong to
+   * no single allocation, like the memory a pool keeps, then give back
+   * reserved bytes of a reservation
+   */
+  void ledger_adjust(int device, int64_t bytes, size_t reserved);
+
+  /**
+   * Turn a reservation into physical memory created through the VMM API,
+   * charged until the handle is released and its last mapping is gone
+   */
+  void ledger_commit_handle(uint64_t handle, size_t size, int device);
+
+  /**
+   * Take another reference to a handle, released by a cuMemRelease of its own
+   */
+  void ledger_get_handle(uint64_t handle);
+
+  /**
+   * Drop a reference to a handle, the last one uncharges its memory
+   */
+  void ledger_put_handle(uint64_t handle);
+
+  /**
+   * Record a mapping of handle at dptr, which keeps the handle charged
+   *
+   * @return 0 -> the handle was created by this process
+   */
+  int ledger_map_handle(uint64_t dptr, uint64_t handle, size_t size);
+
+  /**
+   * Forget the mappings in [dptr, dptr + size)
+   */
+  void ledger_unmap(uint64_t dptr, size_t size);
+
+  /**
+   * Charge size bytes the driver took implicitly for the object of key,
+   * replacing what was charged for it before, size 0 forgets it
+   */
+  void ledger_set_implicit(uint64_t key, uint64_t tag, size_t size,
+                           int device);
+
+  /**
+   * Look up the implicit footprint of key
+   *
+   * @return 0 -> found
+   */
+  int ledger_find_implicit(uint64_t key, ledger_entry_t *entry);
+
+  /**
+   * Uncharge and forget the implicit footprint of key
+   */
+  void ledger_del_implicit(uint64_t key);
+
+  /**
+   * Sequence of quota releases on device, read it before checking the quota
+   * and pass it to ledger_wait
+   */
+  uint32_t ledger_free_seq(int device);
+
+  /**
+   * Sleep until quota of device is given back by any process of the pod
+   * after seq was read, or timeout_ms elapses
+   */
+  void ledger_wait(int device, uint32_t seq, uint64_t timeout_ms);
+
+  /**
+   * Wake the threads waiting for quota of device
+   */
+  void ledger_wake(int device);
+
+  /**
+   * Allocate a small buffer from the chunks cached for the current context
+   *
+   * @return CUDA_SUCCESS or CUDA_ERROR_OUT_OF_MEMORY when no chunk is usable
+   */
+  CUresult slab_alloc(CUdeviceptr *dptr, size_t bytesize, CUdevice device);
+
+  /**
+   * Give a buffer back to its chunk
+   *
+   * @return 0 -> dptr was allocated from a chunk
+   */
+  int slab_free(CUdeviceptr dptr);
+
+  /**
+   * Slot of a chunk dptr was allocated from, the allocation as far as the
+   * application can tell
+   *
+   * @return 0 -> dptr is in a used slot
+   */
+  int slab_range(CUdeviceptr dptr, CUdeviceptr *base, size_t *size);
+
+  /**
+   * Release empty chunks of device, or of every device when it's -1, to the
+   * driver, only the ones idle for SLAB_IDLE_TRIM seconds unless force is
+   * set
+   *
+   * @return bytes released
+   */
+  size_t slab_trim(int device, int force);
+
+  /**
+   * Drop the chunks of ctx, whose memory the driver frees with it
+   */
+  void slab_forget_context(CUcontext ctx);
+
+  /**
+   * Remember a managed range given out because the pod was over its limit
+   */
+  void residency_track(CUdeviceptr base, size_t size, int device);
+
+  /**
+   * Forget a range, nothing happens if base isn't tracked
+   */
+  void residency_untrack(CUdeviceptr base);
+
+  /**
+   * Mark the tracked range holding addr as used now by a copy or memset,
+   * write is set when the range is the destination
+   */
+  void residency_touch(CUdeviceptr addr, int write);
+
+  /**
+   * Promote the tracked ranges referenced by the arguments of a launch to
+   * their device on hStream, the coldest ranges are demoted to the host to
+   * keep the pod within its limit. per_thread selects the per-thread stream
+   * API
+   */
+  void residency_prefetch(CUfunction func, void **kernelParams, void **extra,
+                          CUstream hStream, int per_thread);
+
+  /**
+   * Demote the coldest ranges of devices where the pod went over its limit
+   */
+  void residency_enforce();
+
+  /**
+   * Allocate on the peer of device ordinal with the best link and enough
+   * pod quota, the peer is charged and its memory mapped into the current
+   * context
+   *
+   * @return CUDA_SUCCESS or CUDA_ERROR_OUT_OF_MEMORY when no peer has room
+   */
+  CUresult peer_spill_alloc(CUdeviceptr *dptr, size_t request_size,
+                            CUdevice ordinal, int *peer);
+
+  /**
+   * Measure free memory of device before the driver creates an object with
+   * an implicit footprint
+   */
+  void implicit_begin(implicit_probe_t *probe, int device);
+
+  /**
+   * Charge to key what the driver took since implicit_begin, on top of what
+   * key was charged before. Allocations this process recorded meanwhile are
+   * not counted
+   */
+  void implicit_end(implicit_probe_t *probe, uint64_t key);
+
+  /**
+   * Uncharge a context and the limits and local memory it was charged for
+   */
+  void implicit_forget_context(CUcontext ctx);
+
+  /**
+   * Count a retain of the primary context of device
+   *
+   * @return 1 -> it's the first one, which creates the context
+   */
+  int implicit_primary_retain(int device);
+
+  /**
+   * Remember the primary context of device once it's retained, or undo the
+   * count of a retain which failed when ctx is NULL
+   */
+  void implicit_primary_retained(int device, CUcontext ctx);
+
+  /**
+   * Count a release of the primary context of device, the last one
+   * uncharges it
+   *
+   * @return the context the last release destroyed, NULL otherwise
+   */
+  CUcontext implicit_primary_release(int device);
+
+  /**
+   * Primary context of device, NULL when it's not retained
+   */
+  CUcontext implicit_primary_context(int device);
+
+  /**
+   * Measure what a new value of limit takes in the current context
+   */
+  CUresult implicit_set_limit(CUlimit limit, size_t value);
+
+  /**
+   * Estimate the local memory the driver grows for a launch of f, the first
+   * time f is launched
+   */
+  void implicit_launch(CUfunction f);
+
+  /**
+   * Remember a pool created on device
+   */
+  void mem_pool_register(CUmemoryPool pool, int device);
+
+  /**
+   * Uncharge and forget a pool before it's destroyed
+   */
+  void mem_pool_forget(CUmemoryPool pool);
+
+  /**
+   * Make room for bytesize bytes from pool, device is used when the pool was
+   * not created through the hooks. Nothing is reserved when the pool keeps
+   * enough idle memory, otherwise pools of the device are trimmed when the
+   * pod is tight
+   *
+   * @return 0 -> fits, reservation holds the bytes to give to
+   * mem_pool_commit
+   */
+  int mem_pool_reserve(CUmemoryPool pool, int device, size_t bytesize,
+                       size_t *reservation);
+
+  /**
+   * Charge the memory pool keeps after an allocation from it and give back
+   * the reservation
+   */
+  void mem_pool_commit(CUmemoryPool pool, int device, size_t reservation);
+
+  /**
+   * Make room for graph memory of bytesize bytes on device, graph memory is
+   * charged when the driver reserves it
+   *
+   * @return 0 -> fits, reservation holds the bytes to give to
+   * mem_pool_commit with a NULL pool
+   */
+  int mem_pool_graph_reserve(int device, size_t bytesize,
+                             size_t *reservation);
+
+  /**
+   * Device of a pool created through the hooks
+   *
+   * @return device, or -1 when the pool is unknown
+   */
+  int mem_pool_device(CUmemoryPool pool);
+
+  /**
+   * Trim the pools and the graph memory of device to what is in use, one
+   * after the other until bytes more fit in the pod limit
+   *
+   * @return bytes given back
+   */
+  size_t mem_pool_trim(int device, size_t bytes);
+
+  /**
+   * Align the charges of all pools with the memory they keep
+   */
+  void mem_pool_sync();
+
+  /**
+   * NUMA node closest to device ordinal
+   *
+   * @return node, or -1 when it's unknown
+   */
+  int host_numa_node(CUdevice ordinal);
+
+  /**
+   * Prefer the NUMA node of device ordinal for the host pages of the managed
+   * range at base
+   */
+  void host_numa_bind(CUdeviceptr base, size_t size, CUdevice ordinal);
+
+  /**
+   * Map size bytes of host memory on the NUMA node of device ordinal, huge
+   * page backed as hostHugePages of the podconf says, and register it for
+   * device access
+   *
+   * @return CUDA_SUCCESS or the error of the registration
+   */
+  CUresult host_spill_alloc(void **host, size_t size, CUdevice ordinal);
+
+  /**
+   * Unregister and unmap memory from host_spill_alloc
+   */
+  CUresult host_spill_free(void *host, size_t size);
+
+  /**
+   * Bytes the driver needs for an array described by desc with levels mip
+   * levels, 0 for sparse arrays and arrays mapped later
+   */
+  size_t array_size(const CUDA_ARRAY3D_DESCRIPTOR *desc, unsigned int levels);
+
+  /**
+   * Bytes array takes from the descriptor the driver keeps for it, estimate
+   * when it can't be read
+   */
+  size_t array_measure(CUarray array, size_t estimate);
+
+  /**
+   * Bytes the levels of mipmap take, desc is the one it was created with
+   */
+  size_t mipmap_measure(CUmipmappedArray mipmap,
+                        const CUDA_ARRAY3D_DESCRIPTOR *desc,
+                        unsigned int levels, size_t estimate);
+
+  /**
+   * Charge bytes of page locked host memory to the pinned quota of the pod,
+   * or of this process when usage is not shared
+   *
+   * @return 0 -> charged, 1 -> over the quota
+   */
+  int pinned_charge(size_t bytes);
+
+  /**
+   * Give back bytes charged by pinned_charge
+   */
+  void pinned_uncharge(size_t bytes);
+
+  /**
+   * Record host memory at p given out or registered as page locked, kind is
+   * LEDGER_PINNED or LEDGER_PAGEABLE
+   *
+   * @return 0 -> recorded
+   */
+  int pinned_record(void *p, size_t size, int kind);
+
+  /**
+   * Wait until the bucket of the current device has tokens, then spend what
+   * a launch of f with blocks blocks of threads threads is predicted to
+   * take. per_thread selects the per-thread stream API
+   *
+   * @return a sample to give to kernel_cost_start right before the launch,
+   * or NULL
+   */
+  kernel_sample_t *sm_limiter_launch(CUfunction f, unsigned int blocks,
+                                     unsigned int threads, CUstream hStream,
+                                     int per_thread);
+
+  /**
+   * Remember the threads per block of f for cuLaunch and cuLaunchGrid
+   */
+  void sm_limiter_set_shape(CUfunction f, int threads);
+
+  /**
+   * Threads per block of f set by sm_limiter_set_shape, 1 when unknown
+   */
+  int sm_limiter_shape(CUfunction f);
+
+  /**
+   * Start the thread which refills the buckets and keeps the pod at the
+   * utilization of the podconf
+   */
+  void sm_limiter_start();
+
+  /**
+   * Connect to the node arbiter, when there is one, and start the thread
+   * which follows its grants and revocations
+   */
+  void arbiter_connect();
+
+  /**
+   * Wait until this process holds the slice of the current device, then
+   * count the caller as submitting work until arbiter_leave
+   *
+   * @return the device to give to arbiter_leave, -1 when not sliced
+   */
+  int arbiter_enter();
+
+  /**
+   * Count the work of arbiter_enter as submitted
+   */
+  void arbiter_leave(int device);
+
+  /**
+   * Average GPU time in ns of f launched with blocks blocks of threads
+   * threads
+   *
+   * @return 0 when the shape was never timed
+   */
+  int64_t kernel_cost_predict(CUfunction f, unsigned int blocks,
+                              unsigned int threads);
+
+  /**
+   * Pick a launch on hStream for sampling, it's timed from kernel_cost_start
+   *
+   * @return the sample, or NULL when the launch is not timed
+   */
+  kernel_sample_t *kernel_cost_begin(CUfunction f, unsigned int blocks,
+                                     unsigned int threads, CUstream hStream,
+                                     int per_thread);
+
+  /**
+   * Record the start event of sample right before the launch, so waits of
+   * the hook in between don't count as kernel time
+   *
+   * @return the sample, or NULL when it's not timed after all
+   */
+  kernel_sample_t *kernel_cost_start(kernel_sample_t *sample);
+
+  /**
+   * Record the end event of a sampled launch, launched is what the driver
+   * returned for it
+   */
+  void kernel_cost_end(kernel_sample_t *sample, CUresult launched);
+
+  /**
+   * Fold the times of the samples which completed into the averages, never
+   * waits for a pending one
+   */
+  void kernel_cost_harvest();
+
+  /**
+   * Destroy the events of ctx before it's destroyed
+   */
+  void kernel_cost_forget_context(CUcontext ctx);
+
+  /**
+   * Wait until the work in flight on the current device leaves room for a
+   * launch of f with blocks blocks of threads threads on hStream. f is NULL
+   * when its time can't be predicted
+   *
+   * @return the batch to give to queue_depth_leave, or NULL when not limited
+   */
+  queue_batch_t *queue_depth_enter(CUfunction f, unsigned int blocks,
+                                   unsigned int threads, CUstream hStream,
+                                   int per_thread);
+
+  /**
+   * Count a launch of queue_depth_enter in its batch, launched is what the
+   * driver returned for it
+   */
+  void queue_depth_leave(queue_batch_t *batch, CUresult launched);
+
+  /**
+   * Destroy the markers of ctx before it's destroyed
+   */
+  void queue_depth_forget_context(CUcontext ctx);
+
+  /**
+   * Forget host memory recorded at p
+   *
+   * @return 0 -> found
+   */
+  int pinned_forget(void *p, ledger_entry_t *entry);
+
+  /**
+   * Attach to the usage segment of the pod
+   *
+   * @return 0 -> success
+   */
+  int pod_shm_attach(const char *pod_name);
+
+  /**
+   * Charge (positive) or uncharge (negative) bytes of device to this process
+   */
+  void pod_shm_charge(int device, int64_t bytes);
+
+  /**
+   * Read the pod usage of device, reservations included
+   *
+   * @return 0 -> the segment is attached
+   */
+  int pod_shm_used(int device, size_t *used);
+
+  /**
+   * Reserve bytes of device if the pod usage stays within headroom
+   *
+   * @return 0 -> reserved, 1 -> no room, -1 -> the segment is not attached
+   */
+  int pod_shm_reserve(int device, size_t bytes, int64_t headroom);
+
+  /**
+   * Give back bytes reserved by pod_shm_reserve
+   *
+   * @return 0 -> success, -1 -> the segment is not attached
+   */
+  int pod_shm_unreserve(int device, size_t bytes);
+
+  /**
+   * Futex words of device in the pod segment
+   *
+   * @return 0 -> the segment is attached
+   */
+  int pod_shm_wait_words(int device, volatile uint32_t **seq,
+                         volatile uint32_t **waiters);
+
+  /**
+   * Give back the usage of dead processes
+   */
+  void pod_shm_reap();
+
+  /**
+   * Account an allocation over the limit to policy, failed is set when the
+   * policy couldn't place it
+   */
+  void pod_shm_account_policy(int policy, size_t bytes, uint64_t wait_ms,
+                              int failed);
+
+  /**
+   * Charge bytes of page locked host memory to this process if the pod
+   * stays within limit
+   *
+   * @return 0 -> charged, 1 -> no room, -1 -> the segment is not attached
+   */
+  int pod_shm_pin(size_t bytes, size_t limit);
+
+  /**
+   * Uncharge bytes charged by pod_shm_pin
+   *
+   * @return 0 -> success, -1 -> the segment is not attached
+   */
+  int pod_shm_unpin(size_t bytes);
+
+  /**
+   * Add (positive) or take off (negative) kernels queued on device by this
+   * process and their predicted ns
+   *
+   * @return 0 -> success, -1 -> the segment is not attached
+   */
+  int pod_shm_inflight(int device, int kernels, int64_t ns);
+
+  /**
+   * Read the kernels the pod has in flight on device and their ns
+   *
+   * @return 0 -> the segment is attached
+   */
+  int pod_shm_inflight_read(int device, int *kernels, int64_t *ns);
+
+  /**
+   * Record that this process exported the allocation at dptr as handle
+   */
+  void pod_shm_ipc_export(const CUipcMemHandle *handle, uint64_t dptr,
+                          size_t size, int device);
+
+  /**
+   * Note that this process let go of the allocation at dptr, its charge
+   * moves to the pod while other processes still map it
+   */
+  void pod_shm_ipc_unexport(uint64_t dptr);
+
+  /**
+   * Note that this process mapped handle
+   *
+   * @return entry of handle, -1 when no process of the pod exported it
+   */
+  int pod_shm_ipc_open(const CUipcMemHandle *handle);
+
+  /**
+   * Note that this process closed its mapping of entry
+   */
+  void pod_shm_ipc_close(int entry);
+
+  /**
+   * Bytes of device other processes of the pod map from an exporter, which
+   * NVML may count again for each of them
+   */
+  size_t pod_shm_ipc_shared(int device);
+
 #ifdef __cplusplus
 }
 #endif
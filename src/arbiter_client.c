@@ -0,0 +1,278 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Client of the node arbiter: work is only submitted to a device while the
+// process holds its slice. When the arbiter revokes it, new submissions
+// wait, the ones in the driver and the work they queued drain, then the
+// slice is given back. Without an arbiter on the node nothing waits
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "include/arbiter.h"
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+
+extern entry_t cuda_library_entry[];
+extern resource_data_t g_anycuda_config;
+extern device_info g_devices_info[16];
+
+void get_uuid_str(char *dest, CUuuid *src);
+
+/**
+ * Slice of a device as this process sees it
+ */
+typedef struct
+{
+  int held;
+  int requested; /**< ARBITER_ACQUIRE sent, no grant yet */
+  int draining;  /**< revoked, waiting for the work in flight */
+  int inflight;  /**< threads submitting work in the driver */
+  CUcontext ctx; /**< context work was last submitted from */
+  char uuid[ARBITER_NAME_LEN];
+} arbiter_slice_t;
+
+static arbiter_slice_t g_slices[MAX_DEVICES];
+
+static int g_arbiter_fd = -1;
+
+static pthread_mutex_t g_slice_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_slice_cond = PTHREAD_COND_INITIALIZER;
+
+static void *arbiter_reader(void *arg);
+
+/**
+ * Send a message, with g_slice_lock held once the reader runs
+ */
+static int arbiter_send(uint32_t type, uint32_t weight, const char *name)
+{
+  arbiter_msg_t msg = {.type = type, .weight = weight};
+
+  strncpy(msg.name, name, ARBITER_NAME_LEN - 1);
+
+  return send(g_arbiter_fd, &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg);
+}
+
+void arbiter_connect()
+{
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  const char *path = getenv(ARBITER_SOCKET_PATH_ENV);
+  char pod[ARBITER_NAME_LEN];
+  uint32_t weight;
+  pthread_t tid;
+
+  path = path ? path : ARBITER_SOCKET_PATH;
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    return;
+  }
+  strcpy(addr.sun_path, path);
+
+  g_arbiter_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (g_arbiter_fd == -1)
+  {
+    return;
+  }
+  if (connect(g_arbiter_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+  {
+    LOGGER(VERBOSE, "no arbiter on %s, error %s", path, strerror(errno));
+    close(g_arbiter_fd);
+    g_arbiter_fd = -1;
+    return;
+  }
+
+  // the guaranteed utilization of the pod is its weight among the others
+  weight = g_anycuda_config.valid ? g_anycuda_config.utilization
+                                  : MAX_UTILIZATION;
+  if (g_anycuda_config.pod_name[0])
+  {
+    snprintf(pod, sizeof(pod), "%s", g_anycuda_config.pod_name);
+  }
+  else
+  {
+    snprintf(pod, sizeof(pod), "pid-%d", getpid());
+  }
+  if (arbiter_send(ARBITER_HELLO, weight, pod))
+  {
+    LOGGER(WARNING, "can't register to the arbiter, error %s",
+           strerror(errno));
+    close(g_arbiter_fd);
+    g_arbiter_fd = -1;
+    return;
+  }
+  LOGGER(INFO, "time sliced by the arbiter on %s, weight %u", path, weight);
+
+  pthread_create(&tid, NULL, arbiter_reader, NULL);
+  pthread_setname_np(tid, "arbiter_reader");
+}
+
+int arbiter_enter()
+{
+  arbiter_slice_t *s;
+  CUcontext ctx = NULL;
+  CUdevice device;
+
+  if (g_arbiter_fd < 0 ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device) !=
+          CUDA_SUCCESS ||
+      device < 0 || device >= MAX_DEVICES)
+  {
+    return -1;
+  }
+  CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetCurrent, &ctx);
+  s = &g_slices[device];
+
+  pthread_mutex_lock(&g_slice_lock);
+  if (s->uuid[0] == '\0')
+  {
+    get_uuid_str(s->uuid, &g_devices_info[device].uuid);
+  }
+  while (!s->held || s->draining)
+  {
+    // the arbiter went away, nothing is sliced anymore
+    if (g_arbiter_fd < 0)
+    {
+      pthread_mutex_unlock(&g_slice_lock);
+      return -1;
+    }
+    if (!s->held && !s->requested)
+    {
+      s->requested = arbiter_send(ARBITER_ACQUIRE, 0, s->uuid) == 0;
+    }
+    pthread_cond_wait(&g_slice_cond, &g_slice_lock);
+  }
+  s->inflight++;
+  s->ctx = ctx;
+  pthread_mutex_unlock(&g_slice_lock);
+
+  return device;
+}
+
+void arbiter_leave(int device)
+{
+  if (device < 0)
+  {
+    return;
+  }
+  pthread_mutex_lock(&g_slice_lock);
+  if (--g_slices[device].inflight == 0)
+  {
+    pthread_cond_broadcast(&g_slice_cond);
+  }
+  pthread_mutex_unlock(&g_slice_lock);
+}
+
+static arbiter_slice_t *slice_find(const char *uuid)
+{
+  int i;
+
+  for (i = 0; i < MAX_DEVICES; i++)
+  {
+    if (strncmp(g_slices[i].uuid, uuid, ARBITER_NAME_LEN) == 0)
+    {
+      return &g_slices[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Give back the slice of s once the work submitted under it completed
+ */
+static void slice_drain(arbiter_slice_t *s)
+{
+  CUcontext ctx, popped;
+
+  pthread_mutex_lock(&g_slice_lock);
+  if (!s->held)
+  {
+    pthread_mutex_unlock(&g_slice_lock);
+    return;
+  }
+  s->draining = 1;
+  while (s->inflight > 0)
+  {
+    pthread_cond_wait(&g_slice_cond, &g_slice_lock);
+  }
+  ctx = s->ctx;
+  pthread_mutex_unlock(&g_slice_lock);
+
+  if (ctx &&
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPushCurrent_v2, ctx) ==
+          CUDA_SUCCESS)
+  {
+    CUDA_ENTRY_CALL(cuda_library_entry, cuCtxSynchronize);
+    CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPopCurrent_v2, &popped);
+  }
+
+  pthread_mutex_lock(&g_slice_lock);
+  s->held = 0;
+  s->draining = 0;
+  arbiter_send(ARBITER_RELEASE, 0, s->uuid);
+  // threads which waited meanwhile ask for the next slice
+  pthread_cond_broadcast(&g_slice_cond);
+  pthread_mutex_unlock(&g_slice_lock);
+}
+
+static void *arbiter_reader(void *arg UNUSED)
+{
+  arbiter_slice_t *s;
+  arbiter_msg_t msg;
+
+  LOGGER(5, "start %s", __FUNCTION__);
+  while (recv(g_arbiter_fd, &msg, sizeof(msg), 0) == sizeof(msg))
+  {
+    msg.name[ARBITER_NAME_LEN - 1] = '\0';
+    s = slice_find(msg.name);
+    if (s == NULL)
+    {
+      continue;
+    }
+    switch (msg.type)
+    {
+    case ARBITER_GRANT:
+      pthread_mutex_lock(&g_slice_lock);
+      s->held = 1;
+      s->requested = 0;
+      pthread_cond_broadcast(&g_slice_cond);
+      pthread_mutex_unlock(&g_slice_lock);
+      break;
+    case ARBITER_REVOKE:
+      slice_drain(s);
+      break;
+    default:
+      break;
+    }
+  }
+
+  LOGGER(WARNING, "lost the arbiter, devices are not sliced anymore");
+  pthread_mutex_lock(&g_slice_lock);
+  close(g_arbiter_fd);
+  g_arbiter_fd = -1;
+  pthread_cond_broadcast(&g_slice_cond);
+  pthread_mutex_unlock(&g_slice_lock);
+
+  return NULL;
+}
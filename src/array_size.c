@@ -0,0 +1,194 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Size model of CUDA arrays: bytes per element of every format, layers,
+// cube faces and mip chains, laid out in the tiles of the driver
+//
+
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+
+extern entry_t cuda_library_entry[];
+
+/**
+ * Texels a compressed block covers on each side
+ */
+#define BLOCK_TEXELS (4)
+
+/**
+ * Bytes of an element of format, or of a block of texels when block is set.
+ * Formats this header doesn't know are taken as 64-bit channels, the widest
+ * there is, so they are never under charged
+ */
+static size_t format_bytes(int format, unsigned int channels, int *block)
+{
+  *block = 0;
+  switch (format)
+  {
+  case CU_AD_FORMAT_UNSIGNED_INT8:
+  case CU_AD_FORMAT_SIGNED_INT8:
+  case CU_AD_FORMAT_NV12:
+    return channels;
+  case CU_AD_FORMAT_UNSIGNED_INT16:
+  case CU_AD_FORMAT_SIGNED_INT16:
+  case CU_AD_FORMAT_HALF:
+    return 2 * channels;
+  case CU_AD_FORMAT_UNSIGNED_INT32:
+  case CU_AD_FORMAT_SIGNED_INT32:
+  case CU_AD_FORMAT_FLOAT:
+    return 4 * channels;
+  case CU_AD_FORMAT_UNORM_INT8X1:
+  case CU_AD_FORMAT_SNORM_INT8X1:
+    return 1;
+  case CU_AD_FORMAT_UNORM_INT8X2:
+  case CU_AD_FORMAT_SNORM_INT8X2:
+  case CU_AD_FORMAT_UNORM_INT16X1:
+  case CU_AD_FORMAT_SNORM_INT16X1:
+    return 2;
+  case CU_AD_FORMAT_UNORM_INT8X4:
+  case CU_AD_FORMAT_SNORM_INT8X4:
+  case CU_AD_FORMAT_UNORM_INT16X2:
+  case CU_AD_FORMAT_SNORM_INT16X2:
+    return 4;
+  case CU_AD_FORMAT_UNORM_INT16X4:
+  case CU_AD_FORMAT_SNORM_INT16X4:
+    return 8;
+  case CU_AD_FORMAT_BC1_UNORM:
+  case CU_AD_FORMAT_BC1_UNORM_SRGB:
+  case CU_AD_FORMAT_BC4_UNORM:
+  case CU_AD_FORMAT_BC4_SNORM:
+    *block = 1;
+    return 8;
+  case CU_AD_FORMAT_BC2_UNORM:
+  case CU_AD_FORMAT_BC2_UNORM_SRGB:
+  case CU_AD_FORMAT_BC3_UNORM:
+  case CU_AD_FORMAT_BC3_UNORM_SRGB:
+  case CU_AD_FORMAT_BC5_UNORM:
+  case CU_AD_FORMAT_BC5_SNORM:
+  case CU_AD_FORMAT_BC6H_UF16:
+  case CU_AD_FORMAT_BC6H_SF16:
+  case CU_AD_FORMAT_BC7_UNORM:
+  case CU_AD_FORMAT_BC7_UNORM_SRGB:
+    *block = 1;
+    return 16;
+  default:
+    return 8 * channels;
+  }
+}
+
+/**
+ * Bytes of one level of width x height x depth elements, rows and slices
+ * rounded to the tiles the driver lays arrays out in
+ */
+static size_t level_size(size_t width, size_t height, size_t depth,
+                         size_t element)
+{
+  size_t pitch = ROUND_UP(width * element, ARRAY_TILE_WIDTH);
+  size_t rows = height > 1 ? ROUND_UP(height, ARRAY_TILE_HEIGHT) : 1;
+
+  return ROUND_UP(pitch * rows, ARRAY_TILE_SIZE) * depth;
+}
+
+size_t array_size(const CUDA_ARRAY3D_DESCRIPTOR *desc, unsigned int levels)
+{
+  size_t width = desc->Width ? desc->Width : 1;
+  size_t height = desc->Height ? desc->Height : 1;
+  size_t depth = desc->Depth ? desc->Depth : 1;
+  size_t layers = 1, element, size = 0;
+  unsigned int i;
+  int block;
+
+  // backed by memory mapped later, which is charged when it's created
+  if (desc->Flags & (CUDA_ARRAY3D_SPARSE | CUDA_ARRAY3D_DEFERRED_MAPPING))
+  {
+    return 0;
+  }
+  element = format_bytes(desc->Format, desc->NumChannels, &block);
+  // layers and cube faces are 2D images, they keep their count down the
+  // mip chain while a volume halves its depth
+  if (desc->Flags & (CUDA_ARRAY3D_LAYERED | CUDA_ARRAY3D_CUBEMAP))
+  {
+    layers = depth;
+    depth = 1;
+  }
+
+  for (i = 0; i < (levels ? levels : 1); i++)
+  {
+    if (block)
+    {
+      size += level_size(ROUND_UP(width, BLOCK_TEXELS) / BLOCK_TEXELS,
+                         ROUND_UP(height, BLOCK_TEXELS) / BLOCK_TEXELS, depth,
+                         element) *
+              layers;
+    }
+    else
+    {
+      size += level_size(width, height, depth, element) * layers;
+    }
+    // the driver stops the chain at 1x1x1 whatever was asked
+    if (width == 1 && height == 1 && depth == 1)
+    {
+      break;
+    }
+    width = width > 1 ? width >> 1 : 1;
+    height = height > 1 ? height >> 1 : 1;
+    depth = depth > 1 ? depth >> 1 : 1;
+  }
+
+  // the chroma plane of 4:2:0 formats is half the luma plane
+  if (desc->Format == CU_AD_FORMAT_NV12)
+  {
+    size += size / 2;
+  }
+
+  return size;
+}
+
+size_t array_measure(CUarray array, size_t estimate)
+{
+  CUDA_ARRAY3D_DESCRIPTOR desc;
+
+  if (CUDA_ENTRY_CALL(cuda_library_entry, cuArray3DGetDescriptor_v2, &desc,
+                      array) != CUDA_SUCCESS)
+  {
+    return estimate;
+  }
+
+  return array_size(&desc, 1);
+}
+
+size_t mipmap_measure(CUmipmappedArray mipmap,
+                      const CUDA_ARRAY3D_DESCRIPTOR *desc, unsigned int levels,
+                      size_t estimate)
+{
+  CUDA_ARRAY3D_DESCRIPTOR level_desc;
+  CUarray level;
+
+  if (CUDA_ENTRY_CALL(cuda_library_entry, cuMipmappedArrayGetLevel, &level,
+                      mipmap, 0) != CUDA_SUCCESS ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuArray3DGetDescriptor_v2,
+                      &level_desc, level) != CUDA_SUCCESS)
+  {
+    return estimate;
+  }
+  // levels don't always report how the chain was created
+  level_desc.Flags |= desc->Flags;
+
+  return array_size(&level_desc, levels);
+}
@@ -0,0 +1,272 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/hijack.h"
+
+typedef struct
+{
+  unsigned int pid;
+  uint64_t start_time;
+  int in_pod;
+} cgroup_pid_entry_t;
+
+static pthread_once_t g_pod_cgroup_set = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_cgroup_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** cgroup path of the pod, empty when it can't be resolved */
+static char g_pod_cgroup[FILENAME_MAX] = "";
+/** 0 -> host proc tree is mounted, 1 -> not mounted */
+static int g_in_pod = 1;
+
+static cgroup_pid_entry_t g_cgroup_cache[CGROUP_CACHE_SIZE];
+static int g_cgroup_cache_count = 0;
+
+const char *host_proc_path()
+{
+  char *path = getenv(HOST_PROC_PATH_ENV);
+
+  return path ? path : HOST_PROC_PATH;
+}
+
+const char *proc_path()
+{
+  char *path = getenv(PROC_PATH_ENV);
+
+  return path ? path : PROC_PATH;
+}
+
+/**
+ * Read the memory cgroup path from a cgroup file, the unified hierarchy
+ * entry "0::<path>" is used when there is no memory controller
+ *
+ * @return 0 -> success
+ */
+static int read_cgroup_path(const char *cgroup_file, char *cgroup_path,
+                            size_t len)
+{
+  char buff[FILENAME_MAX];
+  char unified[FILENAME_MAX] = "";
+  char *controllers, *path, *ctrl, *saveptr;
+  FILE *f = fopen(cgroup_file, "r");
+
+  if (f == NULL)
+  {
+    LOGGER(VERBOSE, "read file %s failed", cgroup_file);
+    return 1;
+  }
+
+  while (fgets(buff, sizeof(buff), f))
+  {
+    buff[strcspn(buff, "\n")] = '\0';
+    controllers = strchr(buff, ':');
+    if (controllers == NULL)
+    {
+      continue;
+    }
+    controllers++;
+    path = strchr(controllers, ':');
+    if (path == NULL)
+    {
+      continue;
+    }
+    *path++ = '\0';
+
+    if (strlen(controllers) == 0)
+    {
+      strncpy(unified, path, sizeof(unified) - 1);
+      continue;
+    }
+    for (ctrl = strtok_r(controllers, ",", &saveptr); ctrl;
+         ctrl = strtok_r(NULL, ",", &saveptr))
+    {
+      if (strcmp(ctrl, "memory") == 0)
+      {
+        strncpy(cgroup_path, path, len - 1);
+        cgroup_path[len - 1] = '\0';
+        fclose(f);
+        return 0;
+      }
+    }
+  }
+  fclose(f);
+
+  if (strlen(unified) == 0)
+  {
+    return 1;
+  }
+  strncpy(cgroup_path, unified, len - 1);
+  cgroup_path[len - 1] = '\0';
+
+  return 0;
+}
+
+static void load_pod_cgroup()
+{
+  char cgroup_file[FILENAME_MAX];
+  DIR *proc_dir = opendir(host_proc_path());
+
+  if (proc_dir)
+  {
+    closedir(proc_dir);
+    g_in_pod = 0;
+  }
+
+  snprintf(cgroup_file, sizeof(cgroup_file), "%s/1/cgroup", proc_path());
+  if (read_cgroup_path(cgroup_file, g_pod_cgroup, sizeof(g_pod_cgroup)))
+  {
+    g_pod_cgroup[0] = '\0';
+  }
+  LOGGER(VERBOSE, "pod cgroup: %s", g_pod_cgroup);
+}
+
+/**
+ * A process belongs to the pod when its cgroup lies under the pod cgroup.
+ * Paths of processes outside our cgroup namespace start with "/.."
+ */
+static int match_pod_cgroup(const char *process_cg)
+{
+  if (strlen(g_pod_cgroup) == 0 || strstr(process_cg, "/..") != NULL)
+  {
+    return 1;
+  }
+  if (strcmp(g_pod_cgroup, "/") == 0)
+  {
+    return 0;
+  }
+
+  return strstr(process_cg, g_pod_cgroup) != NULL ? 0 : 1;
+}
+
+static uint64_t read_pid_start_time(unsigned int pid)
+{
+  char stat_file[FILENAME_MAX];
+  char buff[1024];
+  char *p;
+  int field;
+  FILE *f;
+
+  snprintf(stat_file, sizeof(stat_file), "%s/%u/stat", host_proc_path(), pid);
+  f = fopen(stat_file, "r");
+  if (f == NULL)
+  {
+    return 0;
+  }
+  p = fgets(buff, sizeof(buff), f);
+  fclose(f);
+  if (p == NULL || (p = strrchr(buff, ')')) == NULL)
+  {
+    return 0;
+  }
+  for (field = 2; p && field < 22; field++)
+  {
+    p = strchr(p + 1, ' ');
+  }
+
+  return p ? strtoull(p + 1, NULL, 10) : 0;
+}
+
+static cgroup_pid_entry_t *cache_slot(unsigned int pid)
+{
+  unsigned int i, idx;
+
+  for (i = 0; i < CGROUP_CACHE_SIZE; i++)
+  {
+    idx = (pid + i) & (CGROUP_CACHE_SIZE - 1);
+    if (g_cgroup_cache[idx].pid == pid || g_cgroup_cache[idx].pid == 0)
+    {
+      return &g_cgroup_cache[idx];
+    }
+  }
+
+  return NULL;
+}
+
+int check_in_pod()
+{
+  pthread_once(&g_pod_cgroup_set, load_pod_cgroup);
+
+  return g_in_pod;
+}
+
+int check_pod_pid(unsigned int pid)
+{
+  char cgroup_file[FILENAME_MAX];
+  char process_cg[FILENAME_MAX];
+  cgroup_pid_entry_t *entry;
+  uint64_t start_time;
+  int in_pod = 1;
+
+  if (pid == 0)
+    return 1;
+
+  pthread_once(&g_pod_cgroup_set, load_pod_cgroup);
+  start_time = read_pid_start_time(pid);
+
+  pthread_mutex_lock(&g_cgroup_cache_lock);
+  entry = cache_slot(pid);
+  if (entry && entry->pid == pid && entry->start_time == start_time)
+  {
+    in_pod = entry->in_pod;
+    pthread_mutex_unlock(&g_cgroup_cache_lock);
+    return in_pod;
+  }
+  pthread_mutex_unlock(&g_cgroup_cache_lock);
+
+  snprintf(cgroup_file, sizeof(cgroup_file), "%s/%u/cgroup", host_proc_path(),
+           pid);
+  if (read_cgroup_path(cgroup_file, process_cg, sizeof(process_cg)) == 0)
+  {
+    in_pod = match_pod_cgroup(process_cg);
+    LOGGER(VERBOSE, "pid %u cg %s %s", pid, process_cg,
+           in_pod == 0 ? "match" : "mismatch");
+  }
+  // a process which is gone or unreadable is not cached
+  if (start_time == 0)
+  {
+    return in_pod;
+  }
+
+  pthread_mutex_lock(&g_cgroup_cache_lock);
+  entry = cache_slot(pid);
+  if (entry && entry->pid == 0 &&
+      g_cgroup_cache_count >= CGROUP_CACHE_SIZE / 2)
+  {
+    // keep probe chains short, forget everything and start over
+    memset(g_cgroup_cache, 0, sizeof(g_cgroup_cache));
+    g_cgroup_cache_count = 0;
+    entry = cache_slot(pid);
+  }
+  if (entry)
+  {
+    if (entry->pid == 0)
+    {
+      g_cgroup_cache_count++;
+    }
+    entry->pid = pid;
+    entry->start_time = start_time;
+    entry->in_pod = in_pod;
+  }
+  pthread_mutex_unlock(&g_cgroup_cache_lock);
+
+  return in_pod;
+}
@@ -60,17 +60,6 @@ CUresult cuDeviceGetPCIBusId(char *pciBusId, int len, CUdevice dev)
                          dev);
 }
 
-CUresult cuDevicePrimaryCtxRetain(CUcontext *pctx, CUdevice dev)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxRetain, pctx,
-                         dev);
-}
-
-CUresult cuDevicePrimaryCtxRelease(CUdevice dev)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxRelease, dev);
-}
-
 CUresult cuDevicePrimaryCtxSetFlags(CUdevice dev, unsigned int flags)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxSetFlags, dev,
@@ -84,26 +73,6 @@ CUresult cuDevicePrimaryCtxGetState(CUdevice dev, unsigned int *flags,
                          flags, active);
 }
 
-CUresult cuDevicePrimaryCtxReset(CUdevice dev)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxReset, dev);
-}
-
-CUresult cuCtxCreate_v3(CUcontext *pctx, unsigned int flags, CUdevice dev)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxCreate_v3, pctx, flags, dev);
-}
-
-CUresult cuCtxCreate_v2(CUcontext *pctx, unsigned int flags, CUdevice dev)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxCreate_v2, pctx, flags, dev);
-}
-
-CUresult cuCtxCreate(CUcontext *pctx, unsigned int flags, CUdevice dev)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxCreate, pctx, flags, dev);
-}
-
 CUresult cuCtxGetFlags(unsigned int *flags)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetFlags, flags);
@@ -171,11 +140,6 @@ CUresult cuCtxSynchronize(void)
   return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxSynchronize);
 }
 
-CUresult cuModuleUnload(CUmodule hmod)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuModuleUnload, hmod);
-}
-
 CUresult cuModuleGetFunction(CUfunction *hfunc, CUmodule hmod,
                              const char *name)
 {
@@ -268,23 +232,6 @@ CUresult cuLinkDestroy(CUlinkState state)
   return CUDA_ENTRY_CALL(cuda_library_entry, cuLinkDestroy, state);
 }
 
-CUresult cuMemFree_v2(CUdeviceptr dptr)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemFree_v2, dptr);
-}
-
-CUresult cuMemFree(CUdeviceptr dptr)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemFree, dptr);
-}
-
-CUresult cuMemGetAddressRange_v2(CUdeviceptr *pbase, size_t *psize,
-                                 CUdeviceptr dptr)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetAddressRange_v2, pbase,
-                         psize, dptr);
-}
-
 CUresult cuMemGetAddressRange(CUdeviceptr *pbase, size_t *psize,
                               CUdeviceptr dptr)
 {
@@ -292,17 +239,6 @@ CUresult cuMemGetAddressRange(CUdeviceptr *pbase, size_t *psize,
                          dptr);
 }
 
-CUresult cuMemFreeHost(void *p)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemFreeHost, p);
-}
-
-CUresult cuMemHostAlloc(void **pp, size_t bytesize, unsigned int Flags)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostAlloc, pp, bytesize,
-                         Flags);
-}
-
 CUresult cuMemHostGetDevicePointer_v2(CUdeviceptr *pdptr, void *p,
                                       unsigned int Flags)
 {
@@ -322,23 +258,6 @@ CUresult cuMemHostGetFlags(unsigned int *pFlags, void *p)
   return CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostGetFlags, pFlags, p);
 }
 
-CUresult cuMemHostRegister_v2(void *p, size_t bytesize, unsigned int Flags)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostRegister_v2, p, bytesize,
-                         Flags);
-}
-
-CUresult cuMemHostRegister(void *p, size_t bytesize, unsigned int Flags)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostRegister, p, bytesize,
-                         Flags);
-}
-
-CUresult cuMemHostUnregister(void *p)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostUnregister, p);
-}
-
 CUresult cuPointerGetAttribute(void *data, CUpointer_attribute attribute,
                                CUdeviceptr ptr)
 {
@@ -354,31 +273,6 @@ CUresult cuPointerGetAttributes(unsigned int numAttributes,
                          numAttributes, attributes, data, ptr);
 }
 
-CUresult cuMemcpy_ptds(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpy_ptds, dst, src,
-                         ByteCount);
-}
-
-CUresult cuMemcpy(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpy, dst, src, ByteCount);
-}
-
-CUresult cuMemcpyAsync_ptsz(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount,
-                            CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyAsync_ptsz, dst, src,
-                         ByteCount, hStream);
-}
-
-CUresult cuMemcpyAsync(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount,
-                       CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyAsync, dst, src, ByteCount,
-                         hStream);
-}
-
 CUresult cuMemcpyPeer_ptds(CUdeviceptr dstDevice, CUcontext dstContext,
                            CUdeviceptr srcDevice, CUcontext srcContext,
                            size_t ByteCount)
@@ -411,20 +305,6 @@ CUresult cuMemcpyPeerAsync(CUdeviceptr dstDevice, CUcontext dstContext,
                          dstContext, srcDevice, srcContext, ByteCount, hStream);
 }
 
-CUresult cuMemcpyHtoD_v2_ptds(CUdeviceptr dstDevice, const void *srcHost,
-                              size_t ByteCount)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyHtoD_v2_ptds, dstDevice,
-                         srcHost, ByteCount);
-}
-
-CUresult cuMemcpyHtoD_v2(CUdeviceptr dstDevice, const void *srcHost,
-                         size_t ByteCount)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyHtoD_v2, dstDevice,
-                         srcHost, ByteCount);
-}
-
 CUresult cuMemcpyHtoD(CUdeviceptr dstDevice, const void *srcHost,
                       size_t ByteCount)
 {
@@ -432,20 +312,6 @@ CUresult cuMemcpyHtoD(CUdeviceptr dstDevice, const void *srcHost,
                          ByteCount);
 }
 
-CUresult cuMemcpyHtoDAsync_v2_ptsz(CUdeviceptr dstDevice, const void *srcHost,
-                                   size_t ByteCount, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyHtoDAsync_v2_ptsz,
-                         dstDevice, srcHost, ByteCount, hStream);
-}
-
-CUresult cuMemcpyHtoDAsync_v2(CUdeviceptr dstDevice, const void *srcHost,
-                              size_t ByteCount, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyHtoDAsync_v2, dstDevice,
-                         srcHost, ByteCount, hStream);
-}
-
 CUresult cuMemcpyHtoDAsync(CUdeviceptr dstDevice, const void *srcHost,
                            size_t ByteCount, CUstream hStream)
 {
@@ -453,40 +319,12 @@ CUresult cuMemcpyHtoDAsync(CUdeviceptr dstDevice, const void *srcHost,
                          srcHost, ByteCount, hStream);
 }
 
-CUresult cuMemcpyDtoH_v2_ptds(void *dstHost, CUdeviceptr srcDevice,
-                              size_t ByteCount)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoH_v2_ptds, dstHost,
-                         srcDevice, ByteCount);
-}
-
-CUresult cuMemcpyDtoH_v2(void *dstHost, CUdeviceptr srcDevice,
-                         size_t ByteCount)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoH_v2, dstHost,
-                         srcDevice, ByteCount);
-}
-
 CUresult cuMemcpyDtoH(void *dstHost, CUdeviceptr srcDevice, size_t ByteCount)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoH, dstHost, srcDevice,
                          ByteCount);
 }
 
-CUresult cuMemcpyDtoHAsync_v2_ptsz(void *dstHost, CUdeviceptr srcDevice,
-                                   size_t ByteCount, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoHAsync_v2_ptsz, dstHost,
-                         srcDevice, ByteCount, hStream);
-}
-
-CUresult cuMemcpyDtoHAsync_v2(void *dstHost, CUdeviceptr srcDevice,
-                              size_t ByteCount, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoHAsync_v2, dstHost,
-                         srcDevice, ByteCount, hStream);
-}
-
 CUresult cuMemcpyDtoHAsync(void *dstHost, CUdeviceptr srcDevice,
                            size_t ByteCount, CUstream hStream)
 {
@@ -494,20 +332,6 @@ CUresult cuMemcpyDtoHAsync(void *dstHost, CUdeviceptr srcDevice,
                          srcDevice, ByteCount, hStream);
 }
 
-CUresult cuMemcpyDtoD_v2_ptds(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
-                              size_t ByteCount)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoD_v2_ptds, dstDevice,
-                         srcDevice, ByteCount);
-}
-
-CUresult cuMemcpyDtoD_v2(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
-                         size_t ByteCount)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoD_v2, dstDevice,
-                         srcDevice, ByteCount);
-}
-
 CUresult cuMemcpyDtoD(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
                       size_t ByteCount)
 {
@@ -515,20 +339,6 @@ CUresult cuMemcpyDtoD(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
                          ByteCount);
 }
 
-CUresult cuMemcpyDtoDAsync_v2_ptsz(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
-                                   size_t ByteCount, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoDAsync_v2_ptsz,
-                         dstDevice, srcDevice, ByteCount, hStream);
-}
-
-CUresult cuMemcpyDtoDAsync_v2(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
-                              size_t ByteCount, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoDAsync_v2, dstDevice,
-                         srcDevice, ByteCount, hStream);
-}
-
 CUresult cuMemcpyDtoDAsync(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
                            size_t ByteCount, CUstream hStream)
 {
@@ -625,50 +435,11 @@ CUresult cuMemcpy3DPeerAsync(const CUDA_MEMCPY3D_PEER *pCopy,
                          hStream);
 }
 
-CUresult cuMemsetD8_v2_ptds(CUdeviceptr dstDevice, unsigned char uc, size_t N)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD8_v2_ptds, dstDevice, uc,
-                         N);
-}
-
-CUresult cuMemsetD8_v2(CUdeviceptr dstDevice, unsigned char uc, size_t N)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD8_v2, dstDevice, uc, N);
-}
-
 CUresult cuMemsetD8(CUdeviceptr dstDevice, unsigned char uc, size_t N)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD8, dstDevice, uc, N);
 }
 
-CUresult cuMemsetD8Async_ptsz(CUdeviceptr dstDevice, unsigned char uc, size_t N,
-                              CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD8Async_ptsz, dstDevice,
-                         uc, N, hStream);
-}
-
-CUresult cuMemsetD8Async(CUdeviceptr dstDevice, unsigned char uc, size_t N,
-                         CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD8Async, dstDevice, uc, N,
-                         hStream);
-}
-
-CUresult cuMemsetD2D8_v2_ptds(CUdeviceptr dstDevice, size_t dstPitch,
-                              unsigned char uc, size_t Width, size_t Height)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D8_v2_ptds, dstDevice,
-                         dstPitch, uc, Width, Height);
-}
-
-CUresult cuMemsetD2D8_v2(CUdeviceptr dstDevice, size_t dstPitch,
-                         unsigned char uc, size_t Width, size_t Height)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D8_v2, dstDevice,
-                         dstPitch, uc, Width, Height);
-}
-
 CUresult cuMemsetD2D8(CUdeviceptr dstDevice, size_t dstPitch, unsigned char uc,
                       size_t Width, size_t Height)
 {
@@ -676,22 +447,6 @@ CUresult cuMemsetD2D8(CUdeviceptr dstDevice, size_t dstPitch, unsigned char uc,
                          uc, Width, Height);
 }
 
-CUresult cuMemsetD2D8Async_ptsz(CUdeviceptr dstDevice, size_t dstPitch,
-                                unsigned char uc, size_t Width, size_t Height,
-                                CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D8Async_ptsz, dstDevice,
-                         dstPitch, uc, Width, Height, hStream);
-}
-
-CUresult cuMemsetD2D8Async(CUdeviceptr dstDevice, size_t dstPitch,
-                           unsigned char uc, size_t Width, size_t Height,
-                           CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D8Async, dstDevice,
-                         dstPitch, uc, Width, Height, hStream);
-}
-
 CUresult cuFuncSetCacheConfig(CUfunction hfunc, CUfunc_cache config)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuFuncSetCacheConfig, hfunc,
@@ -739,11 +494,6 @@ CUresult cuArray3DGetDescriptor(CUDA_ARRAY3D_DESCRIPTOR *pArrayDescriptor,
                          pArrayDescriptor, hArray);
 }
 
-CUresult cuArrayDestroy(CUarray hArray)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuArrayDestroy, hArray);
-}
-
 CUresult cuMipmappedArrayGetLevel(CUarray *pLevelArray,
                                   CUmipmappedArray hMipmappedArray,
                                   unsigned int level)
@@ -752,12 +502,6 @@ CUresult cuMipmappedArrayGetLevel(CUarray *pLevelArray,
                          pLevelArray, hMipmappedArray, level);
 }
 
-CUresult cuMipmappedArrayDestroy(CUmipmappedArray hMipmappedArray)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMipmappedArrayDestroy,
-                         hMipmappedArray);
-}
-
 CUresult cuTexRefCreate(CUtexref *pTexRef)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuTexRefCreate, pTexRef);
@@ -1162,23 +906,6 @@ CUresult cuIpcOpenEventHandle(CUevent *phEvent, CUipcEventHandle handle)
                          handle);
 }
 
-CUresult cuIpcGetMemHandle(CUipcMemHandle *pHandle, CUdeviceptr dptr)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuIpcGetMemHandle, pHandle, dptr);
-}
-
-CUresult cuIpcOpenMemHandle(CUdeviceptr *pdptr, CUipcMemHandle handle,
-                            unsigned int Flags)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuIpcOpenMemHandle, pdptr, handle,
-                         Flags);
-}
-
-CUresult cuIpcCloseMemHandle(CUdeviceptr dptr)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuIpcCloseMemHandle, dptr);
-}
-
 CUresult cuGLCtxCreate_v2(CUcontext *pCtx, unsigned int Flags,
                           CUdevice device)
 {
@@ -1484,27 +1211,6 @@ CUresult cuMemRangeGetAttributes(void **data, size_t *dataSizes,
                          dataSizes, attributes, numAttributes, devPtr, count);
 }
 
-CUresult cuCtxSetLimit(CUlimit limit, size_t value)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxSetLimit, limit, value);
-}
-
-CUresult cuModuleLoad(CUmodule *module, const char *fname)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuModuleLoad, module, fname);
-}
-
-CUresult cuModuleLoadData(CUmodule *module, const void *image)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuModuleLoadData, module, image);
-}
-
-CUresult cuModuleLoadFatBinary(CUmodule *module, const void *fatCubin)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuModuleLoadFatBinary, module,
-                         fatCubin);
-}
-
 CUresult cuGetErrorString(CUresult error, const char **pStr)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuGetErrorString, error, pStr);
@@ -1520,16 +1226,6 @@ CUresult cuCtxAttach(CUcontext *pctx, unsigned int flags)
   return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxAttach, pctx, flags);
 }
 
-CUresult cuCtxDestroy_v2(CUcontext ctx)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxDestroy_v2, ctx);
-}
-
-CUresult cuCtxDestroy(CUcontext ctx)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxDestroy, ctx);
-}
-
 CUresult cuCtxPopCurrent_v2(CUcontext *pctx)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPopCurrent_v2, pctx);
@@ -1745,16 +1441,6 @@ cuLaunchCooperativeKernelMultiDevice(CUDA_LAUNCH_PARAMS *launchParamsList,
                          numDevices, flags);
 }
 
-CUresult cuMemAllocHost_v2(void **pp, size_t bytesize)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocHost_v2, pp, bytesize);
-}
-
-CUresult cuMemAllocHost(void **pp, size_t bytesize)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocHost, pp, bytesize);
-}
-
 CUresult cuMemcpy2D_v2(const CUDA_MEMCPY2D *pCopy)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpy2D_v2, pCopy);
@@ -1917,51 +1603,11 @@ CUresult cuMemcpyHtoAAsync(CUarray dstArray, size_t dstOffset,
                          dstOffset, srcHost, ByteCount, hStream);
 }
 
-CUresult cuMemsetD16_v2_ptds(CUdeviceptr dstDevice, unsigned short us,
-                             size_t N)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD16_v2_ptds, dstDevice, us,
-                         N);
-}
-
-CUresult cuMemsetD16_v2(CUdeviceptr dstDevice, unsigned short us, size_t N)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD16_v2, dstDevice, us, N);
-}
-
 CUresult cuMemsetD16(CUdeviceptr dstDevice, unsigned short us, size_t N)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD16, dstDevice, us, N);
 }
 
-CUresult cuMemsetD16Async_ptsz(CUdeviceptr dstDevice, unsigned short us,
-                               size_t N, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD16Async_ptsz, dstDevice,
-                         us, N, hStream);
-}
-
-CUresult cuMemsetD16Async(CUdeviceptr dstDevice, unsigned short us, size_t N,
-                          CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD16Async, dstDevice, us, N,
-                         hStream);
-}
-
-CUresult cuMemsetD2D16_v2_ptds(CUdeviceptr dstDevice, size_t dstPitch,
-                               unsigned short us, size_t Width, size_t Height)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D16_v2_ptds, dstDevice,
-                         dstPitch, us, Width, Height);
-}
-
-CUresult cuMemsetD2D16_v2(CUdeviceptr dstDevice, size_t dstPitch,
-                          unsigned short us, size_t Width, size_t Height)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D16_v2, dstDevice,
-                         dstPitch, us, Width, Height);
-}
-
 CUresult cuMemsetD2D16(CUdeviceptr dstDevice, size_t dstPitch,
                        unsigned short us, size_t Width, size_t Height)
 {
@@ -1969,36 +1615,6 @@ CUresult cuMemsetD2D16(CUdeviceptr dstDevice, size_t dstPitch,
                          us, Width, Height);
 }
 
-CUresult cuMemsetD2D16Async_ptsz(CUdeviceptr dstDevice, size_t dstPitch,
-                                 unsigned short us, size_t Width, size_t Height,
-                                 CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D16Async_ptsz, dstDevice,
-                         dstPitch, us, Width, Height, hStream);
-}
-
-CUresult cuMemsetD2D16Async(CUdeviceptr dstDevice, size_t dstPitch,
-                            unsigned short us, size_t Width, size_t Height,
-                            CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D16Async, dstDevice,
-                         dstPitch, us, Width, Height, hStream);
-}
-
-CUresult cuMemsetD2D32_v2_ptds(CUdeviceptr dstDevice, size_t dstPitch,
-                               unsigned int ui, size_t Width, size_t Height)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D32_v2_ptds, dstDevice,
-                         dstPitch, ui, Width, Height);
-}
-
-CUresult cuMemsetD2D32_v2(CUdeviceptr dstDevice, size_t dstPitch,
-                          unsigned int ui, size_t Width, size_t Height)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D32_v2, dstDevice,
-                         dstPitch, ui, Width, Height);
-}
-
 CUresult cuMemsetD2D32(CUdeviceptr dstDevice, size_t dstPitch, unsigned int ui,
                        size_t Width, size_t Height)
 {
@@ -2006,60 +1622,11 @@ CUresult cuMemsetD2D32(CUdeviceptr dstDevice, size_t dstPitch, unsigned int ui,
                          ui, Width, Height);
 }
 
-CUresult cuMemsetD2D32Async_ptsz(CUdeviceptr dstDevice, size_t dstPitch,
-                                 unsigned int ui, size_t Width, size_t Height,
-                                 CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D32Async_ptsz, dstDevice,
-                         dstPitch, ui, Width, Height, hStream);
-}
-
-CUresult cuMemsetD2D32Async(CUdeviceptr dstDevice, size_t dstPitch,
-                            unsigned int ui, size_t Width, size_t Height,
-                            CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D32Async, dstDevice,
-                         dstPitch, ui, Width, Height, hStream);
-}
-
-CUresult cuMemsetD32_v2_ptds(CUdeviceptr dstDevice, unsigned int ui, size_t N)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD32_v2_ptds, dstDevice, ui,
-                         N);
-}
-
-CUresult cuMemsetD32_v2(CUdeviceptr dstDevice, unsigned int ui, size_t N)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD32_v2, dstDevice, ui, N);
-}
-
 CUresult cuMemsetD32(CUdeviceptr dstDevice, unsigned int ui, size_t N)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD32, dstDevice, ui, N);
 }
 
-CUresult cuMemsetD32Async_ptsz(CUdeviceptr dstDevice, unsigned int ui, size_t N,
-                               CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD32Async_ptsz, dstDevice,
-                         ui, N, hStream);
-}
-
-CUresult cuMemsetD32Async(CUdeviceptr dstDevice, unsigned int ui, size_t N,
-                          CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD32Async, dstDevice, ui, N,
-                         hStream);
-}
-
-CUresult cuModuleLoadDataEx(CUmodule *module, const void *image,
-                            unsigned int numOptions, CUjit_option *options,
-                            void **optionValues)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuModuleLoadDataEx, module, image,
-                         numOptions, options, optionValues);
-}
-
 CUresult cuOccupancyMaxActiveBlocksPerMultiprocessorWithFlags(
     int *numBlocks, CUfunction func, int blockSize, size_t dynamicSMemSize,
     unsigned int flags)
@@ -2440,18 +2007,6 @@ CUresult cuGraphKernelNodeSetParams(CUgraphNode hNode,
                          nodeParams);
 }
 
-CUresult cuGraphLaunch(CUgraphExec hGraphExec, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuGraphLaunch, hGraphExec,
-                         hStream);
-}
-
-CUresult cuGraphLaunch_ptsz(CUgraphExec hGraphExec, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuGraphLaunch_ptsz, hGraphExec,
-                         hStream);
-}
-
 CUresult cuGraphMemcpyNodeGetParams(CUgraphNode hNode,
                                     CUDA_MEMCPY3D *nodeParams)
 {
@@ -2739,14 +2294,6 @@ CUresult cuMemAddressReserve(CUdeviceptr *ptr, size_t size, size_t alignment,
                          alignment, addr, flags);
 }
 
-CUresult cuMemCreate(CUmemGenericAllocationHandle *handle, size_t size,
-                     const CUmemAllocationProp *prop,
-                     unsigned long long flags)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemCreate, handle, size, prop,
-                         flags);
-}
-
 CUresult cuMemExportToShareableHandle(void *shareableHandle,
                                       CUmemGenericAllocationHandle handle,
                                       CUmemAllocationHandleType handleType,
@@ -2763,15 +2310,6 @@ CUresult cuMemGetAccess(unsigned long long *flags,
                          ptr);
 }
 
-CUresult
-cuMemGetAllocationGranularity(size_t *granularity,
-                              const CUmemAllocationProp *prop,
-                              CUmemAllocationGranularity_flags option)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetAllocationGranularity,
-                         granularity, prop, option);
-}
-
 CUresult
 cuMemGetAllocationPropertiesFromHandle(CUmemAllocationProp *prop,
                                        CUmemGenericAllocationHandle handle)
@@ -2789,19 +2327,6 @@ cuMemImportFromShareableHandle(CUmemGenericAllocationHandle *handle,
                          handle, osHandle, shHandleType);
 }
 
-CUresult cuMemMap(CUdeviceptr ptr, size_t size, size_t offset,
-                  CUmemGenericAllocationHandle handle,
-                  unsigned long long flags)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemMap, ptr, size, offset,
-                         handle, flags);
-}
-
-CUresult cuMemRelease(CUmemGenericAllocationHandle handle)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemRelease, handle);
-}
-
 CUresult cuMemSetAccess(CUdeviceptr ptr, size_t size,
                         const CUmemAccessDesc *desc, size_t count)
 {
@@ -2809,26 +2334,11 @@ CUresult cuMemSetAccess(CUdeviceptr ptr, size_t size,
                          count);
 }
 
-CUresult cuMemUnmap(CUdeviceptr ptr, size_t size)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemUnmap, ptr, size);
-}
-
 CUresult cuCtxResetPersistingL2Cache(void)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxResetPersistingL2Cache);
 }
 
-CUresult cuDevicePrimaryCtxRelease_v2(CUdevice dev)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxRelease_v2);
-}
-
-CUresult cuDevicePrimaryCtxReset_v2(CUdevice dev)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxReset_v2, dev);
-}
-
 CUresult cuDevicePrimaryCtxSetFlags_v2(CUdevice dev, unsigned int flags)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxSetFlags_v2, dev,
@@ -2870,13 +2380,6 @@ CUresult cuGraphKernelNodeSetAttribute(CUgraphNode hNode,
                          hNode, attr, value);
 }
 
-CUresult cuMemRetainAllocationHandle(CUmemGenericAllocationHandle *handle,
-                                     void *addr)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemRetainAllocationHandle,
-                         handle, addr);
-}
-
 CUresult cuOccupancyAvailableDynamicSMemPerBlock(size_t *dynamicSmemSize,
                                                  CUfunction func, int numBlocks,
                                                  int blockSize)
@@ -3126,49 +2629,6 @@ CUresult cuGraphUpload_ptsz(CUgraphExec hGraphExec, CUstream hStream)
   return CUDA_ENTRY_CALL(cuda_library_entry, cuGraphUpload_ptsz, hGraphExec,
                          hStream);
 }
-CUresult cuIpcOpenMemHandle_v2(CUdeviceptr *pdptr, CUipcMemHandle handle,
-                               unsigned int Flags)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuIpcOpenMemHandle_v2, pdptr,
-                         handle, Flags);
-}
-
-CUresult cuMemAllocAsync(CUdeviceptr *dptr, size_t bytesize, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocAsync, dptr, bytesize,
-                         hStream);
-}
-
-CUresult cuMemAllocAsync_ptsz(CUdeviceptr *dptr, size_t bytesize,
-                              CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocAsync_ptsz, dptr,
-                         bytesize, hStream);
-}
-CUresult cuMemAllocFromPoolAsync(CUdeviceptr *dptr, size_t bytesize,
-                                 CUmemoryPool pool, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocFromPoolAsync, dptr,
-                         bytesize, pool, hStream);
-}
-CUresult cuMemAllocFromPoolAsync_ptsz(CUdeviceptr *dptr, size_t bytesize,
-                                      CUmemoryPool pool, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocFromPoolAsync_ptsz, dptr,
-                         bytesize, pool, hStream);
-}
-
-CUresult cuMemFreeAsync(CUdeviceptr dptr, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemFreeAsync, dptr, hStream);
-}
-
-CUresult cuMemFreeAsync_ptsz(CUdeviceptr dptr, CUstream hStream)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemFreeAsync_ptsz, dptr,
-                         hStream);
-}
-
 CUresult cuMemMapArrayAsync(CUarrayMapInfo *mapInfoList, unsigned int count,
                             CUstream hStream)
 {
@@ -3182,16 +2642,6 @@ CUresult cuMemMapArrayAsync_ptsz(CUarrayMapInfo *mapInfoList,
   return CUDA_ENTRY_CALL(cuda_library_entry, cuMemMapArrayAsync_ptsz,
                          mapInfoList, count, hStream);
 }
-CUresult cuMemPoolCreate(CUmemoryPool *pool, const CUmemPoolProps *poolProps)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolCreate, pool, poolProps);
-}
-
-CUresult cuMemPoolDestroy(CUmemoryPool pool)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolDestroy, pool);
-}
-
 CUresult cuMemPoolExportPointer(CUmemPoolPtrExportData *shareData_out,
                                 CUdeviceptr ptr)
 {
@@ -3240,18 +2690,6 @@ CUresult cuMemPoolSetAccess(CUmemoryPool pool, const CUmemAccessDesc *map,
                          count);
 }
 
-CUresult cuMemPoolSetAttribute(CUmemoryPool pool, CUmemPool_attribute attr,
-                               void *value)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolSetAttribute, pool, attr,
-                         value);
-}
-CUresult cuMemPoolTrimTo(CUmemoryPool pool, size_t minBytesToKeep)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolTrimTo, pool,
-                         minBytesToKeep);
-}
-
 CUresult cuMipmappedArrayGetSparseProperties(
     CUDA_ARRAY_SPARSE_PROPERTIES *sparseProperties, CUmipmappedArray mipmap)
 {
@@ -3300,16 +2738,6 @@ CUresult cuFlushGPUDirectRDMAWrites(CUflushGPUDirectRDMAWritesTarget target,
                          scope);
 }
 
-CUresult cuGraphAddMemAllocNode(CUgraphNode *phGraphNode, CUgraph hGraph,
-                                const CUgraphNode *dependencies,
-                                size_t numDependencies,
-                                CUDA_MEM_ALLOC_NODE_PARAMS *nodeParams)
-{
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuGraphAddMemAllocNode,
-                         phGraphNode, hGraph, dependencies, numDependencies,
-                         nodeParams);
-}
-
 CUresult cuGraphAddMemFreeNode(CUgraphNode *phGraphNode, CUgraph hGraph,
                                const CUgraphNode *dependencies,
                                size_t numDependencies, CUdeviceptr dptr)
@@ -3395,4 +2823,11 @@ CUresult cuUserObjectRelease(CUuserObject object, unsigned int count)
 CUresult cuUserObjectRetain(CUuserObject object, unsigned int count)
 {
   return CUDA_ENTRY_CALL(cuda_library_entry, cuUserObjectRetain, object, count);
-}
\ No newline at end of file
+}
+
+CUresult cuFuncGetParamInfo(CUfunction func, size_t paramIndex,
+                            size_t *paramOffset, size_t *paramSize)
+{
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuFuncGetParamInfo, func,
+                         paramIndex, paramOffset, paramSize);
+}
@@ -22,9 +22,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/wait.h>
 #include <unistd.h>
-#include <dirent.h>
 
 #include "include/cuda-helper.h"
 #include "include/hijack.h"
@@ -49,14 +49,32 @@ static const struct timespec g_wait = {
     .tv_nsec = 0,
 };
 
+static const char *g_policy_names[OVER_LIMIT_POLICIES] = {
+    [OVER_LIMIT_OOM] = "oom",
+    [OVER_LIMIT_MANAGED] = "managed",
+    [OVER_LIMIT_HOSTMAPPED] = "hostmapped",
+    [OVER_LIMIT_WAIT] = "wait",
+    [OVER_LIMIT_PEER] = "peer",
+};
+
+static const char *g_huge_pages_names[HOST_HUGE_PAGES_MODES] = {
+    [HOST_HUGE_PAGES_NONE] = "none",
+    [HOST_HUGE_PAGES_TRANSPARENT] = "transparent",
+    [HOST_HUGE_PAGES_EXPLICIT] = "explicit",
+};
+
 /** internal function definition */
 static void active_podconf_notifier();
 
 static void *podconf_watcher(void *);
 
+static void active_usage_sampler();
+
+static void *usage_sampler(void *);
+
 int read_anylearn_podconf();
 
-static void get_used_gpu_memory(void *, CUdevice);
+static int get_used_gpu_memory(void *, CUdevice);
 
 static void initialization();
 
@@ -64,7 +82,7 @@ static const char *cuda_error(CUresult, const char **);
 
 void get_uuid_str(char *dest, CUuuid *src);
 
-const char *human_size_str(size_t bytes);
+static size_t get_pod_used_memory(CUdevice);
 
 /** export function definition */
 CUresult cuDriverGetVersion(int *driverVersion);
@@ -78,6 +96,40 @@ CUresult cuMemAllocPitch_v2(CUdeviceptr *dptr, size_t *pPitch,
                             unsigned int ElementSizeBytes);
 CUresult cuMemAllocPitch(CUdeviceptr *dptr, size_t *pPitch, size_t WidthInBytes,
                          size_t Height, unsigned int ElementSizeBytes);
+CUresult cuMemFree_v2(CUdeviceptr dptr);
+CUresult cuMemFree(CUdeviceptr dptr);
+CUresult cuMemCreate(CUmemGenericAllocationHandle *handle, size_t size,
+                     const CUmemAllocationProp *prop,
+                     unsigned long long flags);
+CUresult cuMemRelease(CUmemGenericAllocationHandle handle);
+CUresult cuMemRetainAllocationHandle(CUmemGenericAllocationHandle *handle,
+                                     void *addr);
+CUresult cuMemMap(CUdeviceptr ptr, size_t size, size_t offset,
+                  CUmemGenericAllocationHandle handle,
+                  unsigned long long flags);
+CUresult cuMemUnmap(CUdeviceptr ptr, size_t size);
+CUresult
+cuMemGetAllocationGranularity(size_t *granularity,
+                              const CUmemAllocationProp *prop,
+                              CUmemAllocationGranularity_flags option);
+CUresult cuMemAllocAsync(CUdeviceptr *dptr, size_t bytesize, CUstream hStream);
+CUresult cuMemAllocAsync_ptsz(CUdeviceptr *dptr, size_t bytesize,
+                              CUstream hStream);
+CUresult cuMemAllocFromPoolAsync(CUdeviceptr *dptr, size_t bytesize,
+                                 CUmemoryPool pool, CUstream hStream);
+CUresult cuMemAllocFromPoolAsync_ptsz(CUdeviceptr *dptr, size_t bytesize,
+                                      CUmemoryPool pool, CUstream hStream);
+CUresult cuMemFreeAsync(CUdeviceptr dptr, CUstream hStream);
+CUresult cuMemFreeAsync_ptsz(CUdeviceptr dptr, CUstream hStream);
+CUresult cuMemPoolCreate(CUmemoryPool *pool, const CUmemPoolProps *poolProps);
+CUresult cuMemPoolDestroy(CUmemoryPool pool);
+CUresult cuMemPoolSetAttribute(CUmemoryPool pool, CUmemPool_attribute attr,
+                               void *value);
+CUresult cuMemPoolTrimTo(CUmemoryPool pool, size_t minBytesToKeep);
+CUresult cuGraphAddMemAllocNode(CUgraphNode *phGraphNode, CUgraph hGraph,
+                                const CUgraphNode *dependencies,
+                                size_t numDependencies,
+                                CUDA_MEM_ALLOC_NODE_PARAMS *nodeParams);
 CUresult cuArrayCreate_v2(CUarray *pHandle,
                           const CUDA_ARRAY_DESCRIPTOR *pAllocateArray);
 CUresult cuArrayCreate(CUarray *pHandle,
@@ -90,10 +142,125 @@ CUresult
 cuMipmappedArrayCreate(CUmipmappedArray *pHandle,
                        const CUDA_ARRAY3D_DESCRIPTOR *pMipmappedArrayDesc,
                        unsigned int numMipmapLevels);
+CUresult cuArrayDestroy(CUarray hArray);
+CUresult cuMemHostAlloc(void **pp, size_t bytesize, unsigned int Flags);
+CUresult cuMemAllocHost_v2(void **pp, size_t bytesize);
+CUresult cuMemAllocHost(void **pp, size_t bytesize);
+CUresult cuMemFreeHost(void *p);
+CUresult cuMemHostRegister_v2(void *p, size_t bytesize, unsigned int Flags);
+CUresult cuMemHostRegister(void *p, size_t bytesize, unsigned int Flags);
+CUresult cuMemHostUnregister(void *p);
+CUresult cuIpcGetMemHandle(CUipcMemHandle *pHandle, CUdeviceptr dptr);
+CUresult cuMemGetAddressRange_v2(CUdeviceptr *pbase, size_t *psize,
+                                 CUdeviceptr dptr);
+CUresult cuIpcOpenMemHandle(CUdeviceptr *pdptr, CUipcMemHandle handle,
+                            unsigned int Flags);
+CUresult cuIpcOpenMemHandle_v2(CUdeviceptr *pdptr, CUipcMemHandle handle,
+                               unsigned int Flags);
+CUresult cuIpcCloseMemHandle(CUdeviceptr dptr);
+CUresult cuMipmappedArrayDestroy(CUmipmappedArray hMipmappedArray);
 CUresult cuDeviceTotalMem_v2(size_t *bytes, CUdevice dev);
 CUresult cuDeviceTotalMem(size_t *bytes, CUdevice dev);
 CUresult cuMemGetInfo_v2(size_t *free, size_t *total);
 CUresult cuMemGetInfo(size_t *free, size_t *total);
+CUresult cuMemcpy_ptds(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount);
+CUresult cuMemcpy(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount);
+CUresult cuMemcpyAsync_ptsz(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount,
+                            CUstream hStream);
+CUresult cuMemcpyAsync(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount,
+                       CUstream hStream);
+CUresult cuMemcpyHtoD_v2_ptds(CUdeviceptr dstDevice, const void *srcHost,
+                              size_t ByteCount);
+CUresult cuMemcpyHtoD_v2(CUdeviceptr dstDevice, const void *srcHost,
+                         size_t ByteCount);
+CUresult cuMemcpyHtoDAsync_v2_ptsz(CUdeviceptr dstDevice, const void *srcHost,
+                                   size_t ByteCount, CUstream hStream);
+CUresult cuMemcpyHtoDAsync_v2(CUdeviceptr dstDevice, const void *srcHost,
+                              size_t ByteCount, CUstream hStream);
+CUresult cuMemcpyDtoH_v2_ptds(void *dstHost, CUdeviceptr srcDevice,
+                              size_t ByteCount);
+CUresult cuMemcpyDtoH_v2(void *dstHost, CUdeviceptr srcDevice,
+                         size_t ByteCount);
+CUresult cuMemcpyDtoHAsync_v2_ptsz(void *dstHost, CUdeviceptr srcDevice,
+                                   size_t ByteCount, CUstream hStream);
+CUresult cuMemcpyDtoHAsync_v2(void *dstHost, CUdeviceptr srcDevice,
+                              size_t ByteCount, CUstream hStream);
+CUresult cuMemcpyDtoD_v2_ptds(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
+                              size_t ByteCount);
+CUresult cuMemcpyDtoD_v2(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
+                         size_t ByteCount);
+CUresult cuMemcpyDtoDAsync_v2_ptsz(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
+                                   size_t ByteCount, CUstream hStream);
+CUresult cuMemcpyDtoDAsync_v2(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
+                              size_t ByteCount, CUstream hStream);
+CUresult cuMemsetD8_v2_ptds(CUdeviceptr dstDevice, unsigned char uc, size_t N);
+CUresult cuMemsetD8_v2(CUdeviceptr dstDevice, unsigned char uc, size_t N);
+CUresult cuMemsetD8Async_ptsz(CUdeviceptr dstDevice, unsigned char uc, size_t N,
+                              CUstream hStream);
+CUresult cuMemsetD8Async(CUdeviceptr dstDevice, unsigned char uc, size_t N,
+                         CUstream hStream);
+CUresult cuMemsetD16_v2_ptds(CUdeviceptr dstDevice, unsigned short us,
+                             size_t N);
+CUresult cuMemsetD16_v2(CUdeviceptr dstDevice, unsigned short us, size_t N);
+CUresult cuMemsetD16Async_ptsz(CUdeviceptr dstDevice, unsigned short us,
+                               size_t N, CUstream hStream);
+CUresult cuMemsetD16Async(CUdeviceptr dstDevice, unsigned short us, size_t N,
+                          CUstream hStream);
+CUresult cuMemsetD32_v2_ptds(CUdeviceptr dstDevice, unsigned int ui, size_t N);
+CUresult cuMemsetD32_v2(CUdeviceptr dstDevice, unsigned int ui, size_t N);
+CUresult cuMemsetD32Async_ptsz(CUdeviceptr dstDevice, unsigned int ui, size_t N,
+                               CUstream hStream);
+CUresult cuMemsetD32Async(CUdeviceptr dstDevice, unsigned int ui, size_t N,
+                          CUstream hStream);
+CUresult cuMemsetD2D8_v2_ptds(CUdeviceptr dstDevice, size_t dstPitch,
+                              unsigned char uc, size_t Width, size_t Height);
+CUresult cuMemsetD2D8_v2(CUdeviceptr dstDevice, size_t dstPitch,
+                         unsigned char uc, size_t Width, size_t Height);
+CUresult cuMemsetD2D8Async_ptsz(CUdeviceptr dstDevice, size_t dstPitch,
+                                unsigned char uc, size_t Width, size_t Height,
+                                CUstream hStream);
+CUresult cuMemsetD2D8Async(CUdeviceptr dstDevice, size_t dstPitch,
+                           unsigned char uc, size_t Width, size_t Height,
+                           CUstream hStream);
+CUresult cuMemsetD2D16_v2_ptds(CUdeviceptr dstDevice, size_t dstPitch,
+                               unsigned short us, size_t Width, size_t Height);
+CUresult cuMemsetD2D16_v2(CUdeviceptr dstDevice, size_t dstPitch,
+                          unsigned short us, size_t Width, size_t Height);
+CUresult cuMemsetD2D16Async_ptsz(CUdeviceptr dstDevice, size_t dstPitch,
+                                 unsigned short us, size_t Width, size_t Height,
+                                 CUstream hStream);
+CUresult cuMemsetD2D16Async(CUdeviceptr dstDevice, size_t dstPitch,
+                            unsigned short us, size_t Width, size_t Height,
+                            CUstream hStream);
+CUresult cuMemsetD2D32_v2_ptds(CUdeviceptr dstDevice, size_t dstPitch,
+                               unsigned int ui, size_t Width, size_t Height);
+CUresult cuMemsetD2D32_v2(CUdeviceptr dstDevice, size_t dstPitch,
+                          unsigned int ui, size_t Width, size_t Height);
+CUresult cuMemsetD2D32Async_ptsz(CUdeviceptr dstDevice, size_t dstPitch,
+                                 unsigned int ui, size_t Width, size_t Height,
+                                 CUstream hStream);
+CUresult cuMemsetD2D32Async(CUdeviceptr dstDevice, size_t dstPitch,
+                            unsigned int ui, size_t Width, size_t Height,
+                            CUstream hStream);
+CUresult cuDevicePrimaryCtxRetain(CUcontext *pctx, CUdevice dev);
+CUresult cuDevicePrimaryCtxRelease(CUdevice dev);
+CUresult cuDevicePrimaryCtxRelease_v2(CUdevice dev);
+CUresult cuDevicePrimaryCtxReset(CUdevice dev);
+CUresult cuDevicePrimaryCtxReset_v2(CUdevice dev);
+CUresult cuCtxCreate_v2(CUcontext *pctx, unsigned int flags, CUdevice dev);
+CUresult cuCtxCreate(CUcontext *pctx, unsigned int flags, CUdevice dev);
+CUresult cuCtxCreate_v3(CUcontext *pctx, CUexecAffinityParam *paramsArray,
+                        int numParams, unsigned int flags, CUdevice dev);
+CUresult cuCtxDestroy_v2(CUcontext ctx);
+CUresult cuCtxDestroy(CUcontext ctx);
+CUresult cuCtxSetLimit(CUlimit limit, size_t value);
+CUresult cuModuleLoad(CUmodule *module, const char *fname);
+CUresult cuModuleLoadData(CUmodule *module, const void *image);
+CUresult cuModuleLoadDataEx(CUmodule *module, const void *image,
+                            unsigned int numOptions, CUjit_option *options,
+                            void **optionValues);
+CUresult cuModuleLoadFatBinary(CUmodule *module, const void *fatCubin);
+CUresult cuModuleUnload(CUmodule hmod);
 CUresult cuLaunchKernel_ptsz(CUfunction f, unsigned int gridDimX,
                              unsigned int gridDimY, unsigned int gridDimZ,
                              unsigned int blockDimX, unsigned int blockDimY,
@@ -122,6 +289,8 @@ CUresult cuLaunchGrid(CUfunction f, int grid_width, int grid_height);
 CUresult cuLaunchGridAsync(CUfunction f, int grid_width, int grid_height,
                            CUstream hStream);
 CUresult cuFuncSetBlockShape(CUfunction hfunc, int x, int y, int z);
+CUresult cuGraphLaunch(CUgraphExec hGraphExec, CUstream hStream);
+CUresult cuGraphLaunch_ptsz(CUgraphExec hGraphExec, CUstream hStream);
 
 entry_t cuda_hooks_entry[] = {
     {.name = "cuDriverGetVersion", .fn_ptr = cuDriverGetVersion},
@@ -131,15 +300,109 @@ entry_t cuda_hooks_entry[] = {
     {.name = "cuMemAlloc", .fn_ptr = cuMemAlloc},
     {.name = "cuMemAllocPitch_v2", .fn_ptr = cuMemAllocPitch_v2},
     {.name = "cuMemAllocPitch", .fn_ptr = cuMemAllocPitch},
+    {.name = "cuMemFree_v2", .fn_ptr = cuMemFree_v2},
+    {.name = "cuMemFree", .fn_ptr = cuMemFree},
+    {.name = "cuMemCreate", .fn_ptr = cuMemCreate},
+    {.name = "cuMemRelease", .fn_ptr = cuMemRelease},
+    {.name = "cuMemRetainAllocationHandle",
+     .fn_ptr = cuMemRetainAllocationHandle},
+    {.name = "cuMemMap", .fn_ptr = cuMemMap},
+    {.name = "cuMemUnmap", .fn_ptr = cuMemUnmap},
+    {.name = "cuMemGetAllocationGranularity",
+     .fn_ptr = cuMemGetAllocationGranularity},
+    {.name = "cuMemAllocAsync", .fn_ptr = cuMemAllocAsync},
+    {.name = "cuMemAllocAsync_ptsz", .fn_ptr = cuMemAllocAsync_ptsz},
+    {.name = "cuMemAllocFromPoolAsync", .fn_ptr = cuMemAllocFromPoolAsync},
+    {.name = "cuMemAllocFromPoolAsync_ptsz",
+     .fn_ptr = cuMemAllocFromPoolAsync_ptsz},
+    {.name = "cuMemFreeAsync", .fn_ptr = cuMemFreeAsync},
+    {.name = "cuMemFreeAsync_ptsz", .fn_ptr = cuMemFreeAsync_ptsz},
+    {.name = "cuMemPoolCreate", .fn_ptr = cuMemPoolCreate},
+    {.name = "cuMemPoolDestroy", .fn_ptr = cuMemPoolDestroy},
+    {.name = "cuMemPoolSetAttribute", .fn_ptr = cuMemPoolSetAttribute},
+    {.name = "cuMemPoolTrimTo", .fn_ptr = cuMemPoolTrimTo},
+    {.name = "cuGraphAddMemAllocNode", .fn_ptr = cuGraphAddMemAllocNode},
     {.name = "cuArrayCreate_v2", .fn_ptr = cuArrayCreate_v2},
     {.name = "cuArrayCreate", .fn_ptr = cuArrayCreate},
     {.name = "cuArray3DCreate_v2", .fn_ptr = cuArray3DCreate_v2},
     {.name = "cuArray3DCreate", .fn_ptr = cuArray3DCreate},
     {.name = "cuMipmappedArrayCreate", .fn_ptr = cuMipmappedArrayCreate},
+    {.name = "cuArrayDestroy", .fn_ptr = cuArrayDestroy},
+    {.name = "cuMemHostAlloc", .fn_ptr = cuMemHostAlloc},
+    {.name = "cuMemAllocHost_v2", .fn_ptr = cuMemAllocHost_v2},
+    {.name = "cuMemAllocHost", .fn_ptr = cuMemAllocHost},
+    {.name = "cuMemFreeHost", .fn_ptr = cuMemFreeHost},
+    {.name = "cuMemHostRegister_v2", .fn_ptr = cuMemHostRegister_v2},
+    {.name = "cuMemHostRegister", .fn_ptr = cuMemHostRegister},
+    {.name = "cuMemHostUnregister", .fn_ptr = cuMemHostUnregister},
+    {.name = "cuIpcGetMemHandle", .fn_ptr = cuIpcGetMemHandle},
+    {.name = "cuMemGetAddressRange_v2", .fn_ptr = cuMemGetAddressRange_v2},
+    {.name = "cuIpcOpenMemHandle", .fn_ptr = cuIpcOpenMemHandle},
+    {.name = "cuIpcOpenMemHandle_v2", .fn_ptr = cuIpcOpenMemHandle_v2},
+    {.name = "cuIpcCloseMemHandle", .fn_ptr = cuIpcCloseMemHandle},
+    {.name = "cuMipmappedArrayDestroy", .fn_ptr = cuMipmappedArrayDestroy},
     {.name = "cuDeviceTotalMem_v2", .fn_ptr = cuDeviceTotalMem_v2},
     {.name = "cuDeviceTotalMem", .fn_ptr = cuDeviceTotalMem},
     {.name = "cuMemGetInfo_v2", .fn_ptr = cuMemGetInfo_v2},
     {.name = "cuMemGetInfo", .fn_ptr = cuMemGetInfo},
+    {.name = "cuMemcpy_ptds", .fn_ptr = cuMemcpy_ptds},
+    {.name = "cuMemcpy", .fn_ptr = cuMemcpy},
+    {.name = "cuMemcpyAsync_ptsz", .fn_ptr = cuMemcpyAsync_ptsz},
+    {.name = "cuMemcpyAsync", .fn_ptr = cuMemcpyAsync},
+    {.name = "cuMemcpyHtoD_v2_ptds", .fn_ptr = cuMemcpyHtoD_v2_ptds},
+    {.name = "cuMemcpyHtoD_v2", .fn_ptr = cuMemcpyHtoD_v2},
+    {.name = "cuMemcpyHtoDAsync_v2_ptsz", .fn_ptr = cuMemcpyHtoDAsync_v2_ptsz},
+    {.name = "cuMemcpyHtoDAsync_v2", .fn_ptr = cuMemcpyHtoDAsync_v2},
+    {.name = "cuMemcpyDtoH_v2_ptds", .fn_ptr = cuMemcpyDtoH_v2_ptds},
+    {.name = "cuMemcpyDtoH_v2", .fn_ptr = cuMemcpyDtoH_v2},
+    {.name = "cuMemcpyDtoHAsync_v2_ptsz", .fn_ptr = cuMemcpyDtoHAsync_v2_ptsz},
+    {.name = "cuMemcpyDtoHAsync_v2", .fn_ptr = cuMemcpyDtoHAsync_v2},
+    {.name = "cuMemcpyDtoD_v2_ptds", .fn_ptr = cuMemcpyDtoD_v2_ptds},
+    {.name = "cuMemcpyDtoD_v2", .fn_ptr = cuMemcpyDtoD_v2},
+    {.name = "cuMemcpyDtoDAsync_v2_ptsz", .fn_ptr = cuMemcpyDtoDAsync_v2_ptsz},
+    {.name = "cuMemcpyDtoDAsync_v2", .fn_ptr = cuMemcpyDtoDAsync_v2},
+    {.name = "cuMemsetD8_v2_ptds", .fn_ptr = cuMemsetD8_v2_ptds},
+    {.name = "cuMemsetD8_v2", .fn_ptr = cuMemsetD8_v2},
+    {.name = "cuMemsetD8Async_ptsz", .fn_ptr = cuMemsetD8Async_ptsz},
+    {.name = "cuMemsetD8Async", .fn_ptr = cuMemsetD8Async},
+    {.name = "cuMemsetD16_v2_ptds", .fn_ptr = cuMemsetD16_v2_ptds},
+    {.name = "cuMemsetD16_v2", .fn_ptr = cuMemsetD16_v2},
+    {.name = "cuMemsetD16Async_ptsz", .fn_ptr = cuMemsetD16Async_ptsz},
+    {.name = "cuMemsetD16Async", .fn_ptr = cuMemsetD16Async},
+    {.name = "cuMemsetD32_v2_ptds", .fn_ptr = cuMemsetD32_v2_ptds},
+    {.name = "cuMemsetD32_v2", .fn_ptr = cuMemsetD32_v2},
+    {.name = "cuMemsetD32Async_ptsz", .fn_ptr = cuMemsetD32Async_ptsz},
+    {.name = "cuMemsetD32Async", .fn_ptr = cuMemsetD32Async},
+    {.name = "cuMemsetD2D8_v2_ptds", .fn_ptr = cuMemsetD2D8_v2_ptds},
+    {.name = "cuMemsetD2D8_v2", .fn_ptr = cuMemsetD2D8_v2},
+    {.name = "cuMemsetD2D8Async_ptsz", .fn_ptr = cuMemsetD2D8Async_ptsz},
+    {.name = "cuMemsetD2D8Async", .fn_ptr = cuMemsetD2D8Async},
+    {.name = "cuMemsetD2D16_v2_ptds", .fn_ptr = cuMemsetD2D16_v2_ptds},
+    {.name = "cuMemsetD2D16_v2", .fn_ptr = cuMemsetD2D16_v2},
+    {.name = "cuMemsetD2D16Async_ptsz", .fn_ptr = cuMemsetD2D16Async_ptsz},
+    {.name = "cuMemsetD2D16Async", .fn_ptr = cuMemsetD2D16Async},
+    {.name = "cuMemsetD2D32_v2_ptds", .fn_ptr = cuMemsetD2D32_v2_ptds},
+    {.name = "cuMemsetD2D32_v2", .fn_ptr = cuMemsetD2D32_v2},
+    {.name = "cuMemsetD2D32Async_ptsz", .fn_ptr = cuMemsetD2D32Async_ptsz},
+    {.name = "cuMemsetD2D32Async", .fn_ptr = cuMemsetD2D32Async},
+    {.name = "cuDevicePrimaryCtxRetain", .fn_ptr = cuDevicePrimaryCtxRetain},
+    {.name = "cuDevicePrimaryCtxRelease", .fn_ptr = cuDevicePrimaryCtxRelease},
+    {.name = "cuDevicePrimaryCtxRelease_v2",
+     .fn_ptr = cuDevicePrimaryCtxRelease_v2},
+    {.name = "cuDevicePrimaryCtxReset", .fn_ptr = cuDevicePrimaryCtxReset},
+    {.name = "cuDevicePrimaryCtxReset_v2",
+     .fn_ptr = cuDevicePrimaryCtxReset_v2},
+    {.name = "cuCtxCreate_v2", .fn_ptr = cuCtxCreate_v2},
+    {.name = "cuCtxCreate", .fn_ptr = cuCtxCreate},
+    {.name = "cuCtxCreate_v3", .fn_ptr = cuCtxCreate_v3},
+    {.name = "cuCtxDestroy_v2", .fn_ptr = cuCtxDestroy_v2},
+    {.name = "cuCtxDestroy", .fn_ptr = cuCtxDestroy},
+    {.name = "cuCtxSetLimit", .fn_ptr = cuCtxSetLimit},
+    {.name = "cuModuleLoad", .fn_ptr = cuModuleLoad},
+    {.name = "cuModuleLoadData", .fn_ptr = cuModuleLoadData},
+    {.name = "cuModuleLoadDataEx", .fn_ptr = cuModuleLoadDataEx},
+    {.name = "cuModuleLoadFatBinary", .fn_ptr = cuModuleLoadFatBinary},
+    {.name = "cuModuleUnload", .fn_ptr = cuModuleUnload},
     {.name = "cuLaunchKernel_ptsz", .fn_ptr = cuLaunchKernel_ptsz},
     {.name = "cuLaunchKernel", .fn_ptr = cuLaunchKernel},
     {.name = "cuLaunch", .fn_ptr = cuLaunch},
@@ -149,21 +412,13 @@ entry_t cuda_hooks_entry[] = {
     {.name = "cuLaunchGrid", .fn_ptr = cuLaunchGrid},
     {.name = "cuLaunchGridAsync", .fn_ptr = cuLaunchGridAsync},
     {.name = "cuFuncSetBlockShape", .fn_ptr = cuFuncSetBlockShape},
+    {.name = "cuGraphLaunch", .fn_ptr = cuGraphLaunch},
+    {.name = "cuGraphLaunch_ptsz", .fn_ptr = cuGraphLaunch_ptsz},
 };
 
 const int cuda_hook_nums =
     sizeof(cuda_hooks_entry) / sizeof(cuda_hooks_entry[0]);
 
-/** dynamic rate control */
-typedef struct
-{
-  int user_current;
-  int sys_current;
-  int valid;
-  uint64_t checktime;
-  int sys_process_num;
-} utilization_t;
-
 int strsplit(const char *s, char **dest, const char *sep)
 {
   char *token;
@@ -257,178 +512,184 @@ int read_anylearn_podconf()
       g_anycuda_config.gpu_mem_limit[i] = gpu_mem_limit[i];
     }
   }
-
-  LOGGER(VERBOSE, "pod name         : %s", g_anycuda_config.pod_name);
-  LOGGER(VERBOSE, "resource name    : %s", g_anycuda_config.resource_name);
-  LOGGER(VERBOSE, "gpu count        : %d", g_anycuda_config.gpu_count);
-  for (int i = 0; i < g_anycuda_config.gpu_count; i++)
-  {
-    LOGGER(VERBOSE, "gpu-%d-%s: %zu", i, g_anycuda_config.gpu_uuids[i], g_anycuda_config.gpu_mem_limit[i]);
-  }
-  g_anycuda_config.valid = 1;
-
-  ret = 0;
-DONE:
-  if (likely(fd))
-  {
-    close(fd);
-  }
-
-  return ret;
-}
-
-int split_str(char *line, char *key, char *value, char d)
-{
-  int index = 0;
-  for (index = 0; index < strlen(line) && line[index] != d; index++)
+  cJSON *small_alloc_cache = cJSON_GetObjectItem(g_podconf, "smallAllocCache");
+  g_anycuda_config.small_alloc_cache = cJSON_IsTrue(small_alloc_cache);
+  cJSON *split_residency = cJSON_GetObjectItem(g_podconf, "splitResidency");
+  g_anycuda_config.split_residency = cJSON_IsTrue(split_residency);
+  cJSON *peer_spill = cJSON_GetObjectItem(g_podconf, "peerSpill");
+  if (cJSON_IsBool(peer_spill))
   {
+    g_anycuda_config.peer_spill = cJSON_IsTrue(peer_spill);
   }
-
-  if (index == strlen(line))
+  cJSON *host_huge_pages = cJSON_GetObjectItem(g_podconf, "hostHugePages");
+  if (cJSON_IsString(host_huge_pages))
   {
-    key[0] = '\0';
-    value = '\0';
-    return 1;
+    for (int i = 0; i < HOST_HUGE_PAGES_MODES; i++)
+    {
+      if (strcmp(host_huge_pages->valuestring, g_huge_pages_names[i]) == 0)
+      {
+        g_anycuda_config.host_huge_pages = i;
+      }
+    }
   }
-
-  int start = 0, i = 0;
-  // trim head
-  for (; start < index && (line[start] == ' ' || line[start] == '\t'); start++)
+  cJSON *pinned_limit = cJSON_GetObjectItem(g_podconf, "pinnedLimit");
+  if (cJSON_IsNumber(pinned_limit) && pinned_limit->valueint >= 0)
   {
+    g_anycuda_config.pinned_limit = (size_t)pinned_limit->valueint * 1024 * 1024;
   }
-
-  for (i = 0; start < index; i++, start++)
+  cJSON *pinned_fallback = cJSON_GetObjectItem(g_podconf, "pinnedFallback");
+  if (cJSON_IsBool(pinned_fallback))
   {
-    key[i] = line[start];
+    g_anycuda_config.pinned_fallback = cJSON_IsTrue(pinned_fallback);
   }
-  // trim tail
-  for (; i > 0 && (key[i - 1] == '\0' || key[i - 1] == '\n' || key[i - 1] == '\t'); i--)
+  cJSON *utilization = cJSON_GetObjectItem(g_podconf, "utilization");
+  if (cJSON_IsNumber(utilization) && utilization->valueint > 0 &&
+      utilization->valueint <= MAX_UTILIZATION)
   {
+    g_anycuda_config.utilization = utilization->valueint;
   }
-  key[i] = '\0';
-
-  start = index + 1;
-  i = 0;
-
-  // trim head
-  for (; start < strlen(line) && (line[start] == ' ' || line[start] == '\t'); start++)
+  cJSON *utilization_limit =
+      cJSON_GetObjectItem(g_podconf, "utilizationLimit");
+  if (cJSON_IsNumber(utilization_limit) && utilization_limit->valueint >= 0 &&
+      utilization_limit->valueint <= MAX_UTILIZATION)
   {
+    g_anycuda_config.utilization_limit = utilization_limit->valueint;
   }
-
-  for (i = 0; start < strlen(line); i++, start++)
+  cJSON *max_inflight_kernels =
+      cJSON_GetObjectItem(g_podconf, "maxInflightKernels");
+  if (cJSON_IsNumber(max_inflight_kernels) &&
+      max_inflight_kernels->valueint >= 0)
   {
-    value[i] = line[start];
+    g_anycuda_config.max_inflight_kernels = max_inflight_kernels->valueint;
   }
-  // trim tail
-  for (; i > 0 && (value[i - 1] == '\0' || value[i - 1] == '\n' || value[i - 1] == '\t'); i--)
+  cJSON *max_inflight_ms = cJSON_GetObjectItem(g_podconf, "maxInflightMs");
+  if (cJSON_IsNumber(max_inflight_ms) && max_inflight_ms->valueint >= 0)
   {
+    g_anycuda_config.max_inflight_ms = max_inflight_ms->valueint;
   }
-  value[i] = '\0';
-  return 0;
-}
-
-int read_cgroup(char *pidpath, char *cgroup_key, char *cgroup_value)
-{
-  char buff[255];
-  FILE *f = fopen(pidpath, "rb");
-  if (f == NULL)
+  cJSON *sample_interval = cJSON_GetObjectItem(g_podconf, "sampleInterval");
+  if (cJSON_IsNumber(sample_interval) && sample_interval->valueint > 0)
   {
-    LOGGER(VERBOSE, "read file %s failed\n", pidpath);
-    return 1;
+    g_anycuda_config.sample_interval = sample_interval->valueint;
   }
-
-  while (fgets(buff, 255, f))
+  cJSON *over_limit_policy = cJSON_GetObjectItem(g_podconf, "overLimitPolicy");
+  if (cJSON_IsString(over_limit_policy))
   {
-    int index = 0;
-    for (; index < strlen(buff) && buff[index] != ':'; index++)
+    for (int i = 0; i < OVER_LIMIT_POLICIES; i++)
     {
+      if (i != OVER_LIMIT_PEER &&
+          strcmp(over_limit_policy->valuestring, g_policy_names[i]) == 0)
+      {
+        g_anycuda_config.over_limit_policy = i;
+      }
     }
-
-    if (index == strlen(buff))
-      continue;
-
-    char key[128], value[128];
-    if (split_str(&buff[index + 1], key, value, ':') != 0)
-      continue;
-
-    if (strcmp(key, cgroup_key) == 0)
+  }
+  cJSON *over_limit_fallback = cJSON_GetObjectItem(g_podconf, "overLimitFallback");
+  if (cJSON_IsString(over_limit_fallback))
+  {
+    // waiting again after the timeout makes no sense
+    for (int i = 0; i < OVER_LIMIT_POLICIES; i++)
     {
-      strcpy(cgroup_value, value);
-      fclose(f);
-      return 0;
+      if (i != OVER_LIMIT_WAIT && i != OVER_LIMIT_PEER &&
+          strcmp(over_limit_fallback->valuestring, g_policy_names[i]) == 0)
+      {
+        g_anycuda_config.over_limit_fallback = i;
+      }
     }
   }
-
-  fclose(f);
-  return 1;
-}
-
-int check_in_pod()
-{
-  DIR *proc_dir = opendir("/host_proc/");
-  if (proc_dir)
+  cJSON *over_limit_timeout = cJSON_GetObjectItem(g_podconf, "overLimitTimeout");
+  if (cJSON_IsNumber(over_limit_timeout) && over_limit_timeout->valueint >= 0)
   {
-    closedir(proc_dir);
-    return 0;
+    g_anycuda_config.over_limit_timeout = over_limit_timeout->valueint;
   }
-  return 1;
-}
-
-int check_pod_pid(unsigned int pid)
-{
-  if (pid == 0)
-    return 1;
 
-  char pidpath[128] = "";
-  sprintf(pidpath, "/host_proc/%d/cgroup", pid);
-
-  char pod_cg[256];
-  char process_cg[256];
+  LOGGER(VERBOSE, "pod name         : %s", g_anycuda_config.pod_name);
+  LOGGER(VERBOSE, "resource name    : %s", g_anycuda_config.resource_name);
+  LOGGER(VERBOSE, "gpu count        : %d", g_anycuda_config.gpu_count);
+  LOGGER(VERBOSE, "over limit policy: %s", g_policy_names[g_anycuda_config.over_limit_policy]);
+  for (int i = 0; i < g_anycuda_config.gpu_count; i++)
+  {
+    LOGGER(VERBOSE, "gpu-%d-%s: %zu", i, g_anycuda_config.gpu_uuids[i], g_anycuda_config.gpu_mem_limit[i]);
+  }
+  g_anycuda_config.valid = 1;
 
-  if ((read_cgroup("/proc/1/cgroup", "memory", pod_cg) == 0) && (read_cgroup(pidpath, "memory", process_cg) == 0))
+  ret = 0;
+DONE:
+  if (likely(fd))
   {
-    LOGGER(VERBOSE, "pod cg: %s\nprocess_cg: %s\n", pod_cg, process_cg);
-    if (strstr(process_cg, pod_cg) != NULL)
-    {
-      LOGGER(VERBOSE, "cg match");
-      return 0;
-    }
+    close(fd);
   }
-  LOGGER(VERBOSE, "cg mismatch");
-  return 1;
+
+  return ret;
 }
 
-static void get_used_gpu_memory(void *arg, CUdevice device_id)
+/**
+ * Add the memory the processes of the pod use on device_id to *arg
+ *
+ * @return 0 -> success, 1 -> NVML couldn't tell
+ */
+static int get_used_gpu_memory(void *arg, CUdevice device_id)
 {
+  static nvmlProcessInfo_t *pids_on_device = NULL;
+  static unsigned int pids_capacity = 0;
+
   size_t *used_memory = arg;
 
   nvmlDevice_t dev;
-  nvmlProcessInfo_t pids_on_device[MAX_PIDS];
-  unsigned int size_on_device = MAX_PIDS;
+  unsigned int size_on_device;
+  char uuid_str[48] = "";
   int ret;
 
   unsigned int i;
 
-  ret =
-      NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetHandleByIndex, device_id, &dev);
+  if (NVML_FIND_ENTRY(nvml_library_entry, nvmlDeviceGetHandleByUUID))
+  {
+    get_uuid_str(uuid_str, &g_devices_info[device_id].uuid);
+    ret = NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetHandleByUUID,
+                          uuid_str, &dev);
+  }
+  else
+  {
+    ret = NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetHandleByIndex,
+                          device_id, &dev);
+  }
   if (unlikely(ret))
   {
-    LOGGER(FATAL, "nvmlDeviceGetHandleByIndex can't find device %d, return %d", device_id, ret);
-    *used_memory = 0;
-    return;
+    LOGGER(WARNING, "can't find nvml device %d %s, return %d", device_id,
+           uuid_str, ret);
+    return 1;
   }
 
-  ret =
-      NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetComputeRunningProcesses,
-                      dev, &size_on_device, pids_on_device);
+  // grow the buffer until every process on the device fits
+  do
+  {
+    size_on_device = pids_capacity;
+    ret = NVML_ENTRY_CALL(nvml_library_entry,
+                          nvmlDeviceGetComputeRunningProcesses, dev,
+                          &size_on_device, pids_on_device);
+    if (ret == NVML_ERROR_INSUFFICIENT_SIZE)
+    {
+      nvmlProcessInfo_t *grown;
+      unsigned int capacity = size_on_device * 2 + 16;
+
+      grown = realloc(pids_on_device, capacity * sizeof(nvmlProcessInfo_t));
+      if (unlikely(!grown))
+      {
+        LOGGER(WARNING, "can't grow process buffer to %u", capacity);
+        return 1;
+      }
+      pids_on_device = grown;
+      pids_capacity = capacity;
+    }
+  } while (ret == NVML_ERROR_INSUFFICIENT_SIZE);
+
   if (unlikely(ret))
   {
-    LOGGER(FATAL,
-           "nvmlDeviceGetComputeRunningProcesses can't get pids on device 0, "
+    LOGGER(WARNING,
+           "nvmlDeviceGetComputeRunningProcesses can't get pids on device %d, "
            "return %d",
-           ret);
-    *used_memory = 0;
-    return;
+           device_id, ret);
+    return 1;
   }
 
   if (check_in_pod() == 0)
@@ -454,6 +715,58 @@ static void get_used_gpu_memory(void *arg, CUdevice device_id)
   }
 
   LOGGER(VERBOSE, "total used memory: %zu", *used_memory);
+
+  return 0;
+}
+
+/**
+ * Pod usage of device: the last NVML snapshot plus what the ledger has
+ * charged since, the driver is never queried on the allocation path
+ */
+static size_t get_pod_used_memory(CUdevice device_id)
+{
+  return ledger_used(device_id);
+}
+
+static void active_usage_sampler()
+{
+  pthread_t tid;
+
+  pthread_create(&tid, NULL, usage_sampler, NULL);
+  pthread_setname_np(tid, "usage_sampler");
+}
+
+static void *usage_sampler(void *arg UNUSED)
+{
+  struct timespec wait;
+  size_t used;
+  int interval;
+  int i;
+
+  LOGGER(5, "start %s", __FUNCTION__);
+  while (1)
+  {
+    pod_shm_reap();
+    slab_trim(-1, 0);
+    mem_pool_sync();
+    residency_enforce();
+    for (i = 0; i < g_device_count && i < MAX_DEVICES; i++)
+    {
+      used = 0;
+      // a failed query is no measurement, the pod isn't empty
+      if (get_used_gpu_memory((void *)&used, i) == 0)
+      {
+        ledger_reconcile(i, used);
+      }
+    }
+
+    interval = g_anycuda_config.sample_interval > 0
+                   ? g_anycuda_config.sample_interval
+                   : DEFAULT_SAMPLE_INTERVAL;
+    wait.tv_sec = interval / 1000;
+    wait.tv_nsec = (interval % 1000) * MILLISEC;
+    nanosleep(&wait, NULL);
+  }
 }
 
 void get_uuid_str(char *dest, CUuuid *src)
@@ -526,7 +839,11 @@ static void initialization()
 
   load_devices_info();
   read_anylearn_podconf();
+  pod_shm_attach(g_anycuda_config.pod_name);
   active_podconf_notifier();
+  active_usage_sampler();
+  sm_limiter_start();
+  arbiter_connect();
 }
 
 /** hijack entrypoint */
@@ -570,522 +887,2179 @@ CUresult cuMemAllocManaged(CUdeviceptr *dptr, size_t bytesize,
 {
   size_t used = 0;
   size_t request_size = bytesize;
+  int over_limit = 0;
+  CUdevice ordinal;
   CUresult ret;
 
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal);
+  if (ret != CUDA_SUCCESS)
+  {
+    goto DONE;
+  }
+
   if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
   {
-    CUdevice ordinal;
-    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal);
-    if (ret != CUDA_SUCCESS)
-    {
-      goto DONE;
-    }
-    get_used_gpu_memory((void *)&used, ordinal);
+    used = get_pod_used_memory(ordinal);
 
     if (g_anycuda_config.gpu_mem_limit[ordinal] >= 0 && used + request_size > g_anycuda_config.gpu_mem_limit[ordinal])
     {
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr, bytesize, CU_MEM_ATTACH_GLOBAL);
-      goto DONE;
+      flags = CU_MEM_ATTACH_GLOBAL;
+      over_limit = 1;
     }
   }
 
   ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr, bytesize,
                         flags);
+  if (ret == CUDA_SUCCESS)
+  {
+    ledger_add(*dptr, bytesize, ordinal, LEDGER_MANAGED);
+    if (over_limit)
+    {
+      residency_track(*dptr, bytesize, ordinal);
+    }
+  }
 DONE:
   return ret;
 }
 
-CUresult cuMemAlloc_v2(CUdeviceptr *dptr, size_t bytesize)
+/**
+ * Park the thread until quota of device is given back by any process of the
+ * pod, then allocate on the device. Gives up after overLimitTimeout ms
+ */
+static CUresult wait_for_quota(CUdeviceptr *dptr, size_t request_size,
+                               CUdevice ordinal, uint64_t *waited)
 {
-  size_t used = 0;
-  size_t request_size = bytesize;
+  size_t limit = g_anycuda_config.gpu_mem_limit[ordinal];
+  uint64_t timeout = (uint64_t)g_anycuda_config.over_limit_timeout;
+  uint64_t start = monotonic_ms();
+  uint64_t slice;
+  uint32_t seq;
   CUresult ret;
 
-  if (g_anycuda_config.valid)
+  while (1)
   {
-    if (!g_anycuda_config.gpu_mem_limit_valid)
+    // read before the check, so a release in between is never missed
+    seq = ledger_free_seq(ordinal);
+    if (ledger_reserve(ordinal, request_size, limit) == 0)
     {
-      LOGGER(VERBOSE, "gpuLimit is not valid now, use host memory");
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr, bytesize, CU_MEM_ATTACH_GLOBAL);
-      goto DONE;
+      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc_v2, dptr,
+                            request_size);
+      if (ret == CUDA_SUCCESS)
+      {
+        ledger_commit(*dptr, request_size, ordinal);
+        break;
+      }
+      ledger_unreserve(ordinal, request_size);
     }
-    CUdevice ordinal;
-    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal);
-    if (ret != CUDA_SUCCESS)
+
+    *waited = monotonic_ms() - start;
+    if (*waited >= timeout)
     {
-      LOGGER(VERBOSE, "[cuMemAlloc_v2] can't load device info, ret is %d", ret);
-      goto DONE;
+      ret = CUDA_ERROR_OUT_OF_MEMORY;
+      break;
     }
-    get_used_gpu_memory((void *)&used, ordinal);
-
-    if (g_anycuda_config.gpu_mem_limit[ordinal] >= 0 && (used + request_size > g_anycuda_config.gpu_mem_limit[ordinal]))
+    // limits can change with the podconf, don't sleep past a sample
+    slice = timeout - *waited;
+    if (slice > (uint64_t)g_anycuda_config.sample_interval)
     {
-      LOGGER(WARNING, "has used more gpu mem than limit on device %d: %lu >= %lu", ordinal, used + request_size, g_anycuda_config.gpu_mem_limit[ordinal]);
-FROM_HOST:
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr, bytesize, CU_MEM_ATTACH_GLOBAL);
-      LOGGER(INFO, "[cuMemAlloc_v2] alloc mem from host, %s", CUDA_SUCCESS == ret ? "OK" : "KO");
-      LOGGER(INFO, "[cuMemAlloc_v2] device %d: used %s, request %s, limit %s", ordinal, human_size_str(used), human_size_str(request_size), human_size_str(g_anycuda_config.gpu_mem_limit[ordinal]));
-      goto DONE;
-    } else {
-      LOGGER(VERBOSE, "[Device %d] used %lu, request %lu, limit %lu",  ordinal, used, request_size, g_anycuda_config.gpu_mem_limit[ordinal]);
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc_v2, dptr, bytesize);
-      LOGGER(VERBOSE, "[cuMemAlloc_v2] alloc mem from device, ret is %d", ret);
-      if (ret == CUDA_SUCCESS) {
-        goto DONE;
-      } else {
-        LOGGER(WARNING, "--------------------------------")
-        LOGGER(WARNING, "[cuMemAlloc_v2] fail to alloc mem from device, ret is %d", ret);
-        goto FROM_HOST;
-      }
+      slice = g_anycuda_config.sample_interval;
     }
+    ledger_wait(ordinal, seq, slice);
   }
+  *waited = monotonic_ms() - start;
 
-  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc_v2, dptr, bytesize);
-  LOGGER(VERBOSE, "[cuMemAlloc_v2] alloc mem from device, ret is %d", ret);
-DONE:
   return ret;
 }
 
-const char *human_size_str(size_t bytes)
+/**
+ * Allocate managed memory whose head, as large as the pod quota still
+ * allows, is pinned to the device while the tail prefers the host. Only the
+ * head is charged
+ *
+ * @return CUDA_SUCCESS, or CUDA_ERROR_OUT_OF_MEMORY when no head fits
+ */
+static CUresult split_alloc(CUdeviceptr *dptr, size_t request_size,
+                            CUdevice ordinal, size_t *head_size)
 {
-  char *suffix[] = {"B", "KiB", "MiB", "GiB"};
-  int length = sizeof(suffix) / sizeof(suffix[0]);
-
-  double dblBytes = bytes;
-  int i = 0;
+  size_t limit = g_anycuda_config.gpu_mem_limit[ordinal];
+  size_t used = get_pod_used_memory(ordinal);
+  size_t head;
+  CUresult ret;
 
-  if (bytes > 1024) {
-    while (dblBytes > 1024 && i < length - 1) {
-      dblBytes /= 1024.0;
-      i++;
-    }
+  if (!g_anycuda_config.gpu_mem_limit_valid || used >= limit)
+  {
+    return CUDA_ERROR_OUT_OF_MEMORY;
   }
-
-  if (dblBytes > 1024) {
-    return ">1 TiB";
-  } else {
-    int olength = snprintf(NULL, 0, "%.02lf %s", dblBytes, suffix[i]);
-    char *output = malloc(sizeof(char) * olength);
-    sprintf(output, "%.02lf %s", dblBytes, suffix[i]);
-    return output;
+  head = (limit - used) & ~(SPLIT_ALIGN - 1);
+  if (head == 0 || head >= request_size ||
+      ledger_reserve(ordinal, head, limit) != 0)
+  {
+    return CUDA_ERROR_OUT_OF_MEMORY;
   }
-}
-
-CUresult cuMemAlloc(CUdeviceptr *dptr, size_t bytesize)
-{
-  size_t used = 0;
-  size_t request_size = bytesize;
-  CUresult ret;
 
-  if (g_anycuda_config.valid)
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr,
+                        request_size, CU_MEM_ATTACH_GLOBAL);
+  if (ret != CUDA_SUCCESS)
   {
-    if (!g_anycuda_config.gpu_mem_limit_valid)
-    {
-      LOGGER(VERBOSE, "gpuLimit is not valid now, use host memory");
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr, bytesize, CU_MEM_ATTACH_GLOBAL);
-      goto DONE;
-    }
-    CUdevice ordinal;
-    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal);
-    if (ret != CUDA_SUCCESS)
-    {
-      goto DONE;
-    }
-    get_used_gpu_memory((void *)&used, ordinal);
-
-    if (g_anycuda_config.gpu_mem_limit[ordinal] >= 0 && (used + request_size > g_anycuda_config.gpu_mem_limit[ordinal]))
-    {
-      LOGGER(WARNING, "has used more gpu mem than limit on device %d: %lu >= %lu", ordinal, used + request_size, g_anycuda_config.gpu_mem_limit[ordinal]);
-FROM_HOST:
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr, bytesize, CU_MEM_ATTACH_GLOBAL);
-      LOGGER(VERBOSE, "[cuMemAlloc_v2] alloc mem from host, ret is %d", ret);
-      goto DONE;
-    } else {
-      LOGGER(VERBOSE, "[Device %d] used %lu, request %lu, limit %lu",  ordinal, used, request_size, g_anycuda_config.gpu_mem_limit[ordinal]);
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc_v2, dptr, bytesize);
-      LOGGER(VERBOSE, "[cuMemAlloc_v2] alloc mem from device, ret is %d", ret);
-      if (ret == CUDA_SUCCESS) {
-        goto DONE;
-      } else {
-        LOGGER(WARNING, "[cuMemAlloc_v2] fail to alloc mem from device, ret is %d", ret);
-        goto FROM_HOST;
-      }
-    }
+    ledger_unreserve(ordinal, head);
+    return ret;
   }
-
-  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc, dptr, bytesize);
-DONE:
-  return ret;
+  CUDA_ENTRY_CALL(cuda_library_entry, cuMemAdvise, *dptr, head,
+                  CU_MEM_ADVISE_SET_PREFERRED_LOCATION, ordinal);
+  CUDA_ENTRY_CALL(cuda_library_entry, cuMemAdvise, *dptr + head,
+                  request_size - head, CU_MEM_ADVISE_SET_PREFERRED_LOCATION,
+                  CU_DEVICE_CPU);
+  CUDA_ENTRY_CALL(cuda_library_entry, cuMemPrefetchAsync, *dptr, head,
+                  ordinal, NULL);
+  host_numa_bind(*dptr + head, request_size - head, ordinal);
+  ledger_commit_split(*dptr, head, request_size, ordinal);
+  // the tail is promoted later if quota is given back
+  residency_track(*dptr + head, request_size - head, ordinal);
+  *head_size = head;
+
+  return CUDA_SUCCESS;
 }
 
-CUresult cuMemAllocPitch_v2(CUdeviceptr *dptr, size_t *pPitch,
-                            size_t WidthInBytes, size_t Height,
-                            unsigned int ElementSizeBytes)
+/**
+ * Place an allocation which doesn't fit in the pod limit as overLimitPolicy
+ * of the podconf says, every outcome is accounted to the policy
+ */
+static CUresult over_limit_alloc(const char *caller, CUdeviceptr *dptr,
+                                 size_t request_size, CUdevice ordinal,
+                                 int policy)
 {
-  size_t used = 0;
-  size_t request_size = ROUND_UP(WidthInBytes * Height, ElementSizeBytes);
-  CUresult ret;
+  uint64_t waited = 0;
+  size_t head = 0;
+  void *host = NULL;
+  CUresult ret = CUDA_ERROR_OUT_OF_MEMORY;
 
-  if (g_anycuda_config.valid)
+  switch (policy)
   {
-    if (!g_anycuda_config.gpu_mem_limit_valid)
-    {
-      LOGGER(VERBOSE, "gpuLimit is not valid now, use host memory");
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr, request_size, CU_MEM_ATTACH_GLOBAL);
-      goto DONE;
-    }
-    CUdevice ordinal;
-    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal);
-    if (ret != CUDA_SUCCESS)
+  case OVER_LIMIT_MANAGED:
+    if (g_anycuda_config.split_residency &&
+        split_alloc(dptr, request_size, ordinal, &head) == CUDA_SUCCESS)
     {
-      goto DONE;
+      ret = CUDA_SUCCESS;
+      break;
     }
-    get_used_gpu_memory((void *)&used, ordinal);
-
-    if (g_anycuda_config.gpu_mem_limit[ordinal] >= 0 && (used + request_size > g_anycuda_config.gpu_mem_limit[ordinal]))
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr,
+                          request_size, CU_MEM_ATTACH_GLOBAL);
+    if (ret == CUDA_SUCCESS)
     {
-      LOGGER(WARNING, "has used more gpu mem than limit on device %d: %lu >= %lu", ordinal, used + request_size, g_anycuda_config.gpu_mem_limit[ordinal]);
-FROM_HOST:
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr, request_size, CU_MEM_ATTACH_GLOBAL);
-      LOGGER(VERBOSE, "[cuMemAlloc_v2] alloc mem from host, ret is %d", ret);
-      goto DONE;
-    } else {
-      LOGGER(VERBOSE, "[Device %d] used %lu, request %lu, limit %lu",  ordinal, used, request_size, g_anycuda_config.gpu_mem_limit[ordinal]);
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc_v2, dptr, request_size);
-      LOGGER(VERBOSE, "[cuMemAlloc_v2] alloc mem from device, ret is %d", ret);
-      if (ret == CUDA_SUCCESS) {
-        goto DONE;
-      } else {
-        LOGGER(WARNING, "[cuMemAlloc_v2] fail to alloc mem from device, ret is %d", ret);
-        goto FROM_HOST;
-      }
+      host_numa_bind(*dptr, request_size, ordinal);
+      ledger_add(*dptr, request_size, ordinal, LEDGER_MANAGED);
+      residency_track(*dptr, request_size, ordinal);
     }
-  }
-
-  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocPitch_v2, dptr, pPitch,
-                        WidthInBytes, Height, ElementSizeBytes);
-DONE:
-  return ret;
-}
-
-CUresult cuMemAllocPitch(CUdeviceptr *dptr, size_t *pPitch, size_t WidthInBytes,
-                         size_t Height, unsigned int ElementSizeBytes)
-{
-  size_t used = 0;
-  size_t request_size = ROUND_UP(WidthInBytes * Height, ElementSizeBytes);
-  CUresult ret;
-
-  if (g_anycuda_config.valid)
-  {
-    if (!g_anycuda_config.gpu_mem_limit_valid)
+    break;
+  case OVER_LIMIT_HOSTMAPPED:
+    ret = host_spill_alloc(&host, request_size, ordinal);
+    if (ret != CUDA_SUCCESS)
     {
-      LOGGER(VERBOSE, "gpuLimit is not valid now, use host memory");
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr, request_size, CU_MEM_ATTACH_GLOBAL);
-      goto DONE;
+      break;
     }
-    CUdevice ordinal;
-    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal);
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostGetDevicePointer_v2,
+                          dptr, host, 0);
     if (ret != CUDA_SUCCESS)
     {
-      goto DONE;
+      host_spill_free(host, request_size);
+      break;
     }
-    get_used_gpu_memory((void *)&used, ordinal);
-
-    if (g_anycuda_config.gpu_mem_limit[ordinal] >= 0 && (used + request_size > g_anycuda_config.gpu_mem_limit[ordinal]))
+    ledger_add_mapped(*dptr, (uint64_t)(uintptr_t)host, request_size, ordinal);
+    break;
+  case OVER_LIMIT_WAIT:
+    ret = wait_for_quota(dptr, request_size, ordinal, &waited);
+    if (ret == CUDA_SUCCESS)
     {
-      LOGGER(WARNING, "has used more gpu mem than limit on device %d: %lu >= %lu", ordinal, used + request_size, g_anycuda_config.gpu_mem_limit[ordinal]);
-FROM_HOST:
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocManaged, dptr, request_size, CU_MEM_ATTACH_GLOBAL);
-      LOGGER(VERBOSE, "[cuMemAlloc_v2] alloc mem from host, ret is %d", ret);
-      goto DONE;
-    } else {
-      LOGGER(VERBOSE, "[Device %d] used %lu, request %lu, limit %lu",  ordinal, used, request_size, g_anycuda_config.gpu_mem_limit[ordinal]);
-      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc_v2, dptr, request_size);
-      LOGGER(VERBOSE, "[cuMemAlloc_v2] alloc mem from device, ret is %d", ret);
-      if (ret == CUDA_SUCCESS) {
-        goto DONE;
-      } else {
-        LOGGER(WARNING, "[cuMemAlloc_v2] fail to alloc mem from device, ret is %d", ret);
-        goto FROM_HOST;
-      }
+      break;
     }
+    pod_shm_account_policy(policy, request_size, waited, 1);
+    LOGGER(INFO, "[%s] no quota after %" PRIu64 " ms, fall back to %s",
+           caller, waited,
+           g_policy_names[g_anycuda_config.over_limit_fallback]);
+    return over_limit_alloc(caller, dptr, request_size, ordinal,
+                            g_anycuda_config.over_limit_fallback);
+  default:
+    break;
   }
 
-  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocPitch, dptr, pPitch,
-                        WidthInBytes, Height, ElementSizeBytes);
-DONE:
+  // the head of a split allocation is on the device and paid by the quota
+  pod_shm_account_policy(policy, request_size - head, waited,
+                         ret != CUDA_SUCCESS);
+  LOGGER(INFO, "[%s] %zu bytes over limit, %zu on device, policy %s, waited %" PRIu64 " ms, %s",
+         caller, request_size, head, g_policy_names[policy], waited,
+         CUDA_SUCCESS == ret ? "OK" : "KO");
+
   return ret;
 }
 
-static size_t get_array_base_size(int format)
+/**
+ * Place an allocation which is over the pod limit on a peer with room, or
+ * else as the over limit policy says
+ */
+static CUresult spill_alloc(const char *caller, CUdeviceptr *dptr,
+                            size_t request_size, CUdevice ordinal)
 {
-  size_t base_size = 0;
+  int peer;
 
-  switch (format)
+  // a peer with room is much closer than the host
+  if (g_anycuda_config.peer_spill && g_device_count > 1 &&
+      peer_spill_alloc(dptr, request_size, ordinal, &peer) == CUDA_SUCCESS)
   {
-  case CU_AD_FORMAT_UNSIGNED_INT8:
-  case CU_AD_FORMAT_SIGNED_INT8:
-    base_size = 8;
-    break;
-  case CU_AD_FORMAT_UNSIGNED_INT16:
-  case CU_AD_FORMAT_SIGNED_INT16:
-  case CU_AD_FORMAT_HALF:
-    base_size = 16;
-    break;
-  case CU_AD_FORMAT_UNSIGNED_INT32:
-  case CU_AD_FORMAT_SIGNED_INT32:
-  case CU_AD_FORMAT_FLOAT:
-    base_size = 32;
-    break;
-  default:
-    base_size = 32;
+    pod_shm_account_policy(OVER_LIMIT_PEER, request_size, 0, 0);
+    LOGGER(INFO, "[%s] %zu bytes over limit, spilled to device %d", caller, request_size, peer);
+    return CUDA_SUCCESS;
   }
 
-  return base_size;
+  return over_limit_alloc(caller, dptr, request_size, ordinal,
+                          g_anycuda_config.over_limit_policy);
 }
 
-static CUresult
-cuArrayCreate_helper(const CUDA_ARRAY_DESCRIPTOR *pAllocateArray)
+/**
+ * Allocate request_size bytes on device ordinal within the pod limit, the
+ * over limit policy decides what happens when the limit is reached
+ */
+static CUresult mem_alloc_helper(const char *caller, CUdeviceptr *dptr,
+                                 size_t request_size, CUdevice ordinal)
 {
-  size_t used = 0;
-  size_t base_size = 0;
-  size_t request_size = 0;
-  CUresult ret = CUDA_SUCCESS;
+  size_t limit = g_anycuda_config.gpu_mem_limit[ordinal];
+  CUresult ret;
 
-  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  if (!g_anycuda_config.gpu_mem_limit_valid)
   {
-    CUdevice device_id;
-    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device_id);
-    if (ret != CUDA_SUCCESS)
-    {
-      goto DONE;
-    }
-    base_size = get_array_base_size(pAllocateArray->Format);
-    request_size = base_size * pAllocateArray->NumChannels *
-                   pAllocateArray->Height * pAllocateArray->Width;
+    LOGGER(VERBOSE, "gpuLimit is not valid now, use host memory");
+    ret = over_limit_alloc(caller, dptr, request_size, ordinal,
+                           OVER_LIMIT_MANAGED);
+    goto DONE;
+  }
 
-    get_used_gpu_memory((void *)&used, device_id);
+  // the quota is reserved before the driver call, so concurrent threads can
+  // never pass the check together and overshoot the limit
+  // cached chunks and idle pool memory are given back before the
+  // allocation leaves the device
+  if (ledger_reserve_or_trim(ordinal, request_size, limit) != 0)
+  {
+    LOGGER(WARNING, "has used more gpu mem than limit on device %d: %lu >= %lu", ordinal, get_pod_used_memory(ordinal) + request_size, limit);
+    goto OVER_LIMIT;
+  }
 
-    if (g_anycuda_config.gpu_mem_limit[device_id] >= 0 && used + request_size > g_anycuda_config.gpu_mem_limit[device_id])
-    {
-      ret = CUDA_ERROR_OUT_OF_MEMORY;
-      goto DONE;
-    }
+  LOGGER(VERBOSE, "[Device %d] used %lu, request %lu, limit %lu", ordinal, get_pod_used_memory(ordinal), request_size, limit);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc_v2, dptr, request_size);
+  LOGGER(VERBOSE, "[%s] alloc mem from device, ret is %d", caller, ret);
+  if (ret == CUDA_SUCCESS)
+  {
+    ledger_commit(*dptr, request_size, ordinal);
+    goto DONE;
   }
+  ledger_unreserve(ordinal, request_size);
+  LOGGER(WARNING, "[%s] fail to alloc mem from device, ret is %d", caller, ret);
 
+OVER_LIMIT:
+  ret = spill_alloc(caller, dptr, request_size, ordinal);
 DONE:
   return ret;
 }
 
-CUresult cuArrayCreate_v2(CUarray *pHandle,
-                          const CUDA_ARRAY_DESCRIPTOR *pAllocateArray)
+CUresult cuMemAlloc_v2(CUdeviceptr *dptr, size_t bytesize)
 {
+  CUdevice ordinal;
   CUresult ret;
 
-  ret = cuArrayCreate_helper(pAllocateArray);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal);
   if (ret != CUDA_SUCCESS)
   {
+    LOGGER(VERBOSE, "[cuMemAlloc_v2] can't load device info, ret is %d", ret);
     goto DONE;
   }
 
-  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuArrayCreate_v2, pHandle,
-                        pAllocateArray);
-DONE:
-  return ret;
-}
+  if (g_anycuda_config.small_alloc_cache && bytesize <= SLAB_MAX_SIZE &&
+      slab_alloc(dptr, bytesize, ordinal) == CUDA_SUCCESS)
+  {
+    goto DONE;
+  }
+
+  if (g_anycuda_config.valid)
+  {
+    ret = mem_alloc_helper("cuMemAlloc_v2", dptr, bytesize, ordinal);
+    goto DONE;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc_v2, dptr, bytesize);
+  LOGGER(VERBOSE, "[cuMemAlloc_v2] alloc mem from device, ret is %d", ret);
+  if (ret == CUDA_SUCCESS)
+  {
+    ledger_add(*dptr, bytesize, ordinal, LEDGER_DEVICE);
+  }
+DONE:
+  return ret;
+}
+
+CUresult cuMemAlloc(CUdeviceptr *dptr, size_t bytesize)
+{
+  // cuGetProcAddress hands this out for cuMemAlloc_v2 too, the legacy 32 bit
+  // entry would truncate the pointer
+  return cuMemAlloc_v2(dptr, bytesize);
+}
+
+/**
+ * Allocate Height rows of WidthInBytes within the pod limit. The pitch is
+ * the driver's choice so what it gave is charged, rows which go over the
+ * limit are PITCH_ALIGN apart
+ */
+static CUresult mem_alloc_pitch_helper(const char *caller, CUdeviceptr *dptr,
+                                       size_t *pPitch, size_t WidthInBytes,
+                                       size_t Height,
+                                       unsigned int ElementSizeBytes,
+                                       CUdevice ordinal)
+{
+  size_t limit = g_anycuda_config.gpu_mem_limit[ordinal];
+  size_t request_size = ROUND_UP(WidthInBytes, PITCH_ALIGN) * Height;
+  CUdeviceptr base;
+  size_t size;
+  CUresult ret;
+
+  if (!g_anycuda_config.gpu_mem_limit_valid)
+  {
+    *pPitch = ROUND_UP(WidthInBytes, PITCH_ALIGN);
+    ret = over_limit_alloc(caller, dptr, request_size, ordinal,
+                           OVER_LIMIT_MANAGED);
+    goto DONE;
+  }
+
+  if (ledger_reserve_or_trim(ordinal, request_size, limit) != 0)
+  {
+    LOGGER(WARNING, "has used more gpu mem than limit on device %d: %lu >= %lu", ordinal, get_pod_used_memory(ordinal) + request_size, limit);
+    goto OVER_LIMIT;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocPitch_v2, dptr, pPitch,
+                        WidthInBytes, Height, ElementSizeBytes);
+  if (ret == CUDA_SUCCESS)
+  {
+    size = *pPitch * Height;
+    CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetAddressRange_v2, &base, &size,
+                    *dptr);
+    ledger_settle(*dptr, size, request_size, ordinal, LEDGER_DEVICE);
+    goto DONE;
+  }
+  ledger_unreserve(ordinal, request_size);
+  LOGGER(WARNING, "[%s] fail to alloc mem from device, ret is %d", caller, ret);
+
+OVER_LIMIT:
+  *pPitch = ROUND_UP(WidthInBytes, PITCH_ALIGN);
+  ret = spill_alloc(caller, dptr, *pPitch * Height, ordinal);
+DONE:
+  return ret;
+}
+
+CUresult cuMemAllocPitch_v2(CUdeviceptr *dptr, size_t *pPitch,
+                            size_t WidthInBytes, size_t Height,
+                            unsigned int ElementSizeBytes)
+{
+  CUdevice ordinal;
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal);
+  if (ret != CUDA_SUCCESS)
+  {
+    goto DONE;
+  }
+
+  if (g_anycuda_config.valid)
+  {
+    ret = mem_alloc_pitch_helper("cuMemAllocPitch_v2", dptr, pPitch, WidthInBytes, Height,
+                                 ElementSizeBytes, ordinal);
+    goto DONE;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocPitch_v2, dptr, pPitch,
+                        WidthInBytes, Height, ElementSizeBytes);
+  if (ret == CUDA_SUCCESS)
+  {
+    ledger_add(*dptr, *pPitch * Height, ordinal, LEDGER_DEVICE);
+  }
+DONE:
+  return ret;
+}
+
+CUresult cuMemAllocPitch(CUdeviceptr *dptr, size_t *pPitch, size_t WidthInBytes,
+                         size_t Height, unsigned int ElementSizeBytes)
+{
+  return cuMemAllocPitch_v2(dptr, pPitch, WidthInBytes, Height,
+                            ElementSizeBytes);
+}
+
+/**
+ * Free dptr if it is mapped host memory given out by the hostmapped policy,
+ * the driver doesn't take such pointers in cuMemFree
+ *
+ * @return 0 -> dptr was mapped host memory
+ */
+static int mapped_host_free(CUdeviceptr dptr)
+{
+  ledger_entry_t entry;
+
+  if (ledger_find(dptr, &entry) || entry.kind != LEDGER_HOSTMAPPED)
+  {
+    return 1;
+  }
+  if (host_spill_free((void *)(uintptr_t)entry.tag, entry.size) ==
+      CUDA_SUCCESS)
+  {
+    ledger_del(dptr, NULL);
+  }
+
+  return 0;
+}
+
+/**
+ * Drop a freed allocation from the ledger and from the residency manager
+ */
+static void forget_allocation(CUdeviceptr dptr)
+{
+  ledger_entry_t entry;
+
+  pod_shm_ipc_unexport(dptr);
+  if (ledger_del(dptr, &entry) != 0)
+  {
+    return;
+  }
+  // only the tail of a split allocation is managed by residency
+  residency_untrack(entry.kind == LEDGER_SPLIT ? dptr + entry.size : dptr);
+}
+
+CUresult cuMemFree_v2(CUdeviceptr dptr)
+{
+  CUresult ret;
+
+  if (slab_free(dptr) == 0)
+  {
+    return CUDA_SUCCESS;
+  }
+  if (mapped_host_free(dptr) == 0)
+  {
+    return CUDA_SUCCESS;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemFree_v2, dptr);
+  if (ret == CUDA_SUCCESS)
+  {
+    forget_allocation(dptr);
+  }
+
+  return ret;
+}
+
+CUresult cuMemFree(CUdeviceptr dptr)
+{
+  return cuMemFree_v2(dptr);
+}
+
+/**
+ * Bytes the kernel locks to register [p, p + bytesize), whole pages
+ */
+static size_t pinned_length(void *p, size_t bytesize)
+{
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)p & ~(page - 1);
+
+  return ROUND_UP((uintptr_t)p + bytesize - start, page);
+}
+
+/**
+ * Allocate page locked host memory within the pinned quota. Over the quota
+ * it's out of memory, unless the pod opted into pageable memory and the
+ * device doesn't have to reach it
+ */
+static CUresult host_alloc_helper(const char *caller, void **pp,
+                                  size_t bytesize, unsigned int Flags)
+{
+  CUresult ret;
+
+  if (pinned_charge(bytesize) == 0)
+  {
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostAlloc, pp, bytesize,
+                          Flags);
+    if (ret != CUDA_SUCCESS)
+    {
+      pinned_uncharge(bytesize);
+      return ret;
+    }
+    // memory that isn't recorded would never be uncharged
+    if (pinned_record(*pp, bytesize, LEDGER_PINNED))
+    {
+      CUDA_ENTRY_CALL(cuda_library_entry, cuMemFreeHost, *pp);
+      pinned_uncharge(bytesize);
+      return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+    return CUDA_SUCCESS;
+  }
+
+  if (!g_anycuda_config.pinned_fallback || (Flags & CU_MEMHOSTALLOC_DEVICEMAP))
+  {
+    LOGGER(WARNING, "[%s] %zu bytes over the pinned limit", caller, bytesize);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  if (posix_memalign(pp, (size_t)sysconf(_SC_PAGESIZE),
+                     bytesize ? bytesize : 1) != 0)
+  {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  if (pinned_record(*pp, bytesize, LEDGER_PAGEABLE))
+  {
+    free(*pp);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  LOGGER(INFO, "[%s] %zu bytes over the pinned limit, given pageable memory",
+         caller, bytesize);
+
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMemHostAlloc(void **pp, size_t bytesize, unsigned int Flags)
+{
+  return host_alloc_helper("cuMemHostAlloc", pp, bytesize, Flags);
+}
+
+CUresult cuMemAllocHost_v2(void **pp, size_t bytesize)
+{
+  return host_alloc_helper("cuMemAllocHost_v2", pp, bytesize, 0);
+}
+
+CUresult cuMemAllocHost(void **pp, size_t bytesize)
+{
+  return host_alloc_helper("cuMemAllocHost", pp, bytesize, 0);
+}
+
+CUresult cuMemFreeHost(void *p)
+{
+  ledger_entry_t entry;
+  CUresult ret;
+
+  if (pinned_forget(p, &entry) != 0)
+  {
+    return CUDA_ENTRY_CALL(cuda_library_entry, cuMemFreeHost, p);
+  }
+  if (entry.kind == LEDGER_PAGEABLE)
+  {
+    free(p);
+    return CUDA_SUCCESS;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemFreeHost, p);
+  if (ret == CUDA_SUCCESS)
+  {
+    pinned_uncharge(entry.size);
+  }
+  else
+  {
+    pinned_record(p, entry.size, entry.kind);
+  }
+
+  return ret;
+}
+
+/**
+ * Register host memory within the pinned quota. Over the quota it's out of
+ * memory, unless the pod opted into leaving it pageable, which copies still
+ * work with, and the device doesn't have to reach it
+ */
+static CUresult host_register_helper(const char *caller, void *p,
+                                     size_t bytesize, unsigned int Flags,
+                                     int legacy)
+{
+  size_t length = pinned_length(p, bytesize);
+  CUresult ret;
+
+  if (pinned_charge(length) == 0)
+  {
+    if (legacy)
+    {
+      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostRegister, p,
+                            bytesize, Flags);
+    }
+    else
+    {
+      ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostRegister_v2, p,
+                            bytesize, Flags);
+    }
+    if (ret != CUDA_SUCCESS)
+    {
+      pinned_uncharge(length);
+      return ret;
+    }
+    // memory that isn't recorded would never be uncharged
+    if (pinned_record(p, length, LEDGER_PINNED))
+    {
+      CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostUnregister, p);
+      pinned_uncharge(length);
+      return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+    return CUDA_SUCCESS;
+  }
+
+  if (!g_anycuda_config.pinned_fallback ||
+      (Flags & (CU_MEMHOSTREGISTER_DEVICEMAP | CU_MEMHOSTREGISTER_IOMEMORY)))
+  {
+    LOGGER(WARNING, "[%s] %zu bytes over the pinned limit", caller, length);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  if (pinned_record(p, length, LEDGER_PAGEABLE))
+  {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  LOGGER(INFO, "[%s] %zu bytes over the pinned limit, left pageable", caller,
+         length);
+
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMemHostRegister_v2(void *p, size_t bytesize, unsigned int Flags)
+{
+  return host_register_helper("cuMemHostRegister_v2", p, bytesize, Flags, 0);
+}
+
+CUresult cuMemHostRegister(void *p, size_t bytesize, unsigned int Flags)
+{
+  return host_register_helper("cuMemHostRegister", p, bytesize, Flags, 1);
+}
+
+CUresult cuMemHostUnregister(void *p)
+{
+  ledger_entry_t entry;
+  CUresult ret;
+
+  if (pinned_forget(p, &entry) != 0)
+  {
+    return CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostUnregister, p);
+  }
+  if (entry.kind == LEDGER_PAGEABLE)
+  {
+    return CUDA_SUCCESS;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostUnregister, p);
+  if (ret == CUDA_SUCCESS)
+  {
+    pinned_uncharge(entry.size);
+  }
+  else
+  {
+    pinned_record(p, entry.size, entry.kind);
+  }
+
+  return ret;
+}
+
+CUresult cuIpcGetMemHandle(CUipcMemHandle *pHandle, CUdeviceptr dptr)
+{
+  CUdeviceptr base;
+  CUdevice ordinal;
+  size_t size;
+  CUresult ret;
+
+  // the handle would open the whole chunk, other allocations included
+  if (slab_range(dptr, &base, &size) == 0)
+  {
+    LOGGER(WARNING, "can't export 0x%llx, it shares a slab chunk", dptr);
+    return CUDA_ERROR_NOT_SUPPORTED;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuIpcGetMemHandle, pHandle, dptr);
+  if (ret != CUDA_SUCCESS)
+  {
+    return ret;
+  }
+  // the handle stands for the whole allocation dptr is in
+  if (CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetAddressRange_v2, &base,
+                      &size, dptr) == CUDA_SUCCESS &&
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal) ==
+          CUDA_SUCCESS)
+  {
+    pod_shm_ipc_export(pHandle, base, size, ordinal);
+  }
+
+  return ret;
+}
+
+CUresult cuMemGetAddressRange_v2(CUdeviceptr *pbase, size_t *psize,
+                                 CUdeviceptr dptr)
+{
+  CUdeviceptr base;
+  size_t size;
+
+  // an allocation served by a slab chunk ends with its slot
+  if (slab_range(dptr, &base, &size) == 0)
+  {
+    if (pbase)
+    {
+      *pbase = base;
+    }
+    if (psize)
+    {
+      *psize = size;
+    }
+    return CUDA_SUCCESS;
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetAddressRange_v2, pbase,
+                         psize, dptr);
+}
+
+/**
+ * Record memory opened through IPC at dptr, the exporter pays for it when
+ * it is in the pod, otherwise its own pod does
+ */
+static void ipc_opened(CUdeviceptr dptr, const CUipcMemHandle *handle)
+{
+  CUdeviceptr base;
+  CUdevice ordinal;
+  size_t size;
+  int entry;
+
+  entry = pod_shm_ipc_open(handle);
+  if (entry < 0)
+  {
+    return;
+  }
+  if (CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetAddressRange_v2, &base,
+                      &size, dptr) != CUDA_SUCCESS ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal) !=
+          CUDA_SUCCESS)
+  {
+    size = 0;
+    ordinal = 0;
+  }
+  ledger_add_ipc(dptr, entry, size, ordinal);
+}
+
+CUresult cuIpcOpenMemHandle(CUdeviceptr *pdptr, CUipcMemHandle handle,
+                            unsigned int Flags)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuIpcOpenMemHandle, pdptr, handle,
+                        Flags);
+  if (ret == CUDA_SUCCESS)
+  {
+    ipc_opened(*pdptr, &handle);
+  }
+
+  return ret;
+}
+
+CUresult cuIpcOpenMemHandle_v2(CUdeviceptr *pdptr, CUipcMemHandle handle,
+                               unsigned int Flags)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuIpcOpenMemHandle_v2, pdptr,
+                        handle, Flags);
+  if (ret == CUDA_SUCCESS)
+  {
+    ipc_opened(*pdptr, &handle);
+  }
+
+  return ret;
+}
+
+CUresult cuIpcCloseMemHandle(CUdeviceptr dptr)
+{
+  ledger_entry_t entry;
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuIpcCloseMemHandle, dptr);
+  if (ret == CUDA_SUCCESS && ledger_del(dptr, &entry) == 0 &&
+      entry.kind == LEDGER_IPC)
+  {
+    pod_shm_ipc_close((int)entry.tag);
+  }
+
+  return ret;
+}
+
+/**
+ * Device ordinal whose quota pays for an allocation with prop, the id of a
+ * device location is its ordinal
+ *
+ * @return ordinal, or -1 when it's not device memory
+ */
+static int vmm_device(const CUmemAllocationProp *prop)
+{
+  if (prop == NULL || prop->location.type != CU_MEM_LOCATION_TYPE_DEVICE ||
+      prop->location.id < 0 || prop->location.id >= MAX_DEVICES)
+  {
+    return -1;
+  }
+
+  return prop->location.id;
+}
+
+CUresult cuMemCreate(CUmemGenericAllocationHandle *handle, size_t size,
+                     const CUmemAllocationProp *prop,
+                     unsigned long long flags)
+{
+  int ordinal = vmm_device(prop);
+  size_t limit = (size_t)-1;
+  CUresult ret;
+
+  if (ordinal < 0)
+  {
+    return CUDA_ENTRY_CALL(cuda_library_entry, cuMemCreate, handle, size, prop,
+                           flags);
+  }
+  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  {
+    limit = g_anycuda_config.gpu_mem_limit[ordinal];
+  }
+
+  // physical memory is charged when it's created, mappings are free
+  if (ledger_reserve_or_trim(ordinal, size, limit) != 0)
+  {
+    // a handle can't be backed by the host, so over limit is out of memory
+    pod_shm_account_policy(OVER_LIMIT_OOM, size, 0, 1);
+    LOGGER(WARNING, "[cuMemCreate] %zu bytes over limit on device %d, used %zu, limit %zu",
+           size, ordinal, get_pod_used_memory(ordinal), limit);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemCreate, handle, size, prop,
+                        flags);
+  if (ret != CUDA_SUCCESS)
+  {
+    ledger_unreserve(ordinal, size);
+    return ret;
+  }
+  ledger_commit_handle(*handle, size, ordinal);
+
+  return CUDA_SUCCESS;
+}
+
+CUresult cuMemRelease(CUmemGenericAllocationHandle handle)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemRelease, handle);
+  if (ret == CUDA_SUCCESS)
+  {
+    // the memory stays charged while it's still mapped
+    ledger_put_handle(handle);
+  }
+
+  return ret;
+}
+
+CUresult cuMemRetainAllocationHandle(CUmemGenericAllocationHandle *handle,
+                                     void *addr)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemRetainAllocationHandle,
+                        handle, addr);
+  if (ret == CUDA_SUCCESS)
+  {
+    // the retained handle is released on its own, the memory stays charged
+    // until then
+    ledger_get_handle(*handle);
+  }
+
+  return ret;
+}
+
+CUresult cuMemMap(CUdeviceptr ptr, size_t size, size_t offset,
+                  CUmemGenericAllocationHandle handle,
+                  unsigned long long flags)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemMap, ptr, size, offset,
+                        handle, flags);
+  if (ret == CUDA_SUCCESS)
+  {
+    ledger_map_handle(ptr, handle, size);
+  }
+
+  return ret;
+}
+
+CUresult cuMemUnmap(CUdeviceptr ptr, size_t size)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemUnmap, ptr, size);
+  if (ret == CUDA_SUCCESS)
+  {
+    ledger_unmap(ptr, size);
+  }
+
+  return ret;
+}
+
+CUresult
+cuMemGetAllocationGranularity(size_t *granularity,
+                              const CUmemAllocationProp *prop,
+                              CUmemAllocationGranularity_flags option)
+{
+  int ordinal = vmm_device(prop);
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetAllocationGranularity,
+                        granularity, prop, option);
+  if (ret != CUDA_SUCCESS || ordinal < 0 ||
+      option != CU_MEM_ALLOC_GRANULARITY_RECOMMENDED ||
+      !g_anycuda_config.valid || !g_anycuda_config.gpu_mem_limit_valid ||
+      *granularity <= g_anycuda_config.gpu_mem_limit[ordinal])
+  {
+    return ret;
+  }
+
+  // allocators sizing their segments by it would never fit in the pod
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetAllocationGranularity,
+                         granularity, prop, CU_MEM_ALLOC_GRANULARITY_MINIMUM);
+}
+
+/**
+ * Allocate from pool, or from the current pool of the device when it's NULL,
+ * charging what the pool grows by. Allocations which don't fit are spilled
+ * like synchronous ones
+ */
+static CUresult mem_alloc_async_helper(const char *caller, CUdeviceptr *dptr,
+                                       size_t bytesize, CUmemoryPool pool,
+                                       CUstream hStream, int per_thread)
+{
+  CUmemoryPool current = pool;
+  size_t reservation;
+  CUdevice ordinal;
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &ordinal);
+  if (ret != CUDA_SUCCESS)
+  {
+    return ret;
+  }
+  if (current == NULL)
+  {
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceGetMemPool, &current,
+                          ordinal);
+    if (ret != CUDA_SUCCESS)
+    {
+      return ret;
+    }
+  }
+
+  if (mem_pool_reserve(current, ordinal, bytesize, &reservation) != 0)
+  {
+    LOGGER(WARNING, "[%s] pool %p has no room for %zu bytes on device %d",
+           caller, current, bytesize, ordinal);
+    return spill_alloc(caller, dptr, bytesize, ordinal);
+  }
+
+  if (pool != NULL)
+  {
+    ret = per_thread ? CUDA_ENTRY_CALL(cuda_library_entry,
+                                       cuMemAllocFromPoolAsync_ptsz, dptr,
+                                       bytesize, pool, hStream)
+                     : CUDA_ENTRY_CALL(cuda_library_entry,
+                                       cuMemAllocFromPoolAsync, dptr,
+                                       bytesize, pool, hStream);
+  }
+  else
+  {
+    ret = per_thread ? CUDA_ENTRY_CALL(cuda_library_entry,
+                                       cuMemAllocAsync_ptsz, dptr, bytesize,
+                                       hStream)
+                     : CUDA_ENTRY_CALL(cuda_library_entry, cuMemAllocAsync,
+                                       dptr, bytesize, hStream);
+  }
+  mem_pool_commit(current, ordinal, reservation);
+  LOGGER(VERBOSE, "[%s] alloc %zu bytes from pool %p, ret is %d", caller,
+         bytesize, current, ret);
+
+  return ret;
+}
+
+/**
+ * Free dptr in stream order. Memory of pools stays charged until the pool is
+ * trimmed, spilled allocations are freed once hStream is done with them
+ */
+static CUresult mem_free_async_helper(CUdeviceptr dptr, CUstream hStream,
+                                      int per_thread)
+{
+  CUresult ret;
+
+  if (ledger_find(dptr, NULL) == 0)
+  {
+    ret = per_thread ? CUDA_ENTRY_CALL(cuda_library_entry,
+                                       cuStreamSynchronize_ptsz, hStream)
+                     : CUDA_ENTRY_CALL(cuda_library_entry,
+                                       cuStreamSynchronize, hStream);
+    if (ret != CUDA_SUCCESS)
+    {
+      return ret;
+    }
+
+    return cuMemFree_v2(dptr);
+  }
+
+  if (per_thread)
+  {
+    return CUDA_ENTRY_CALL(cuda_library_entry, cuMemFreeAsync_ptsz, dptr,
+                           hStream);
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemFreeAsync, dptr, hStream);
+}
+
+CUresult cuMemAllocAsync(CUdeviceptr *dptr, size_t bytesize, CUstream hStream)
+{
+  return mem_alloc_async_helper("cuMemAllocAsync", dptr, bytesize, NULL,
+                                hStream, 0);
+}
+
+CUresult cuMemAllocAsync_ptsz(CUdeviceptr *dptr, size_t bytesize,
+                              CUstream hStream)
+{
+  return mem_alloc_async_helper("cuMemAllocAsync_ptsz", dptr, bytesize, NULL,
+                                hStream, 1);
+}
+
+CUresult cuMemAllocFromPoolAsync(CUdeviceptr *dptr, size_t bytesize,
+                                 CUmemoryPool pool, CUstream hStream)
+{
+  return mem_alloc_async_helper("cuMemAllocFromPoolAsync", dptr, bytesize,
+                                pool, hStream, 0);
+}
+
+CUresult cuMemAllocFromPoolAsync_ptsz(CUdeviceptr *dptr, size_t bytesize,
+                                      CUmemoryPool pool, CUstream hStream)
+{
+  return mem_alloc_async_helper("cuMemAllocFromPoolAsync_ptsz", dptr,
+                                bytesize, pool, hStream, 1);
+}
+
+CUresult cuMemFreeAsync(CUdeviceptr dptr, CUstream hStream)
+{
+  return mem_free_async_helper(dptr, hStream, 0);
+}
+
+CUresult cuMemFreeAsync_ptsz(CUdeviceptr dptr, CUstream hStream)
+{
+  return mem_free_async_helper(dptr, hStream, 1);
+}
+
+CUresult cuMemPoolCreate(CUmemoryPool *pool, const CUmemPoolProps *poolProps)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolCreate, pool, poolProps);
+  if (ret == CUDA_SUCCESS &&
+      poolProps->location.type == CU_MEM_LOCATION_TYPE_DEVICE)
+  {
+    mem_pool_register(*pool, poolProps->location.id);
+  }
+
+  return ret;
+}
+
+CUresult cuMemPoolDestroy(CUmemoryPool pool)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolDestroy, pool);
+  if (ret == CUDA_SUCCESS)
+  {
+    mem_pool_forget(pool);
+  }
+
+  return ret;
+}
+
+CUresult cuMemPoolSetAttribute(CUmemoryPool pool, CUmemPool_attribute attr,
+                               void *value)
+{
+  int device = mem_pool_device(pool);
+  cuuint64_t threshold;
+
+  if (attr != CU_MEMPOOL_ATTR_RELEASE_THRESHOLD || value == NULL ||
+      !g_anycuda_config.valid || !g_anycuda_config.gpu_mem_limit_valid ||
+      (device < 0 && CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice,
+                                     &device) != CUDA_SUCCESS))
+  {
+    return CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolSetAttribute, pool,
+                           attr, value);
+  }
+
+  // a pool keeping more than the pod may use can only hurt co-tenants
+  threshold = *(cuuint64_t *)value;
+  if (threshold > g_anycuda_config.gpu_mem_limit[device])
+  {
+    LOGGER(VERBOSE, "release threshold of pool %p clamped from %" PRIu64 " to %zu",
+           pool, threshold, g_anycuda_config.gpu_mem_limit[device]);
+    threshold = g_anycuda_config.gpu_mem_limit[device];
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolSetAttribute, pool,
+                         attr, &threshold);
+}
+
+CUresult cuMemPoolTrimTo(CUmemoryPool pool, size_t minBytesToKeep)
+{
+  int device = mem_pool_device(pool);
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolTrimTo, pool,
+                        minBytesToKeep);
+  if (ret == CUDA_SUCCESS &&
+      (device >= 0 || CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice,
+                                      &device) == CUDA_SUCCESS))
+  {
+    mem_pool_commit(pool, device, 0);
+  }
+
+  return ret;
+}
+
+CUresult cuGraphAddMemAllocNode(CUgraphNode *phGraphNode, CUgraph hGraph,
+                                const CUgraphNode *dependencies,
+                                size_t numDependencies,
+                                CUDA_MEM_ALLOC_NODE_PARAMS *nodeParams)
+{
+  size_t reservation = 0;
+  int device = -1;
+  CUresult ret;
+
+  // graph memory can't be spilled, it must fit when the node is added
+  if (nodeParams != NULL &&
+      nodeParams->poolProps.location.type == CU_MEM_LOCATION_TYPE_DEVICE)
+  {
+    device = nodeParams->poolProps.location.id;
+    if (mem_pool_graph_reserve(device, nodeParams->bytesize, &reservation) !=
+        0)
+    {
+      pod_shm_account_policy(OVER_LIMIT_OOM, nodeParams->bytesize, 0, 1);
+      LOGGER(WARNING, "[cuGraphAddMemAllocNode] %zu bytes over limit on device %d",
+             nodeParams->bytesize, device);
+      return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuGraphAddMemAllocNode,
+                        phGraphNode, hGraph, dependencies, numDependencies,
+                        nodeParams);
+  if (device >= 0)
+  {
+    mem_pool_commit(NULL, device, reservation);
+  }
+
+  return ret;
+}
+
+/**
+ * Reserve the estimated size of an array on the current device, refused
+ * when it is over the pod limit
+ */
+static CUresult array_reserve(const char *caller,
+                              const CUDA_ARRAY3D_DESCRIPTOR *desc,
+                              unsigned int levels, CUdevice *ordinal,
+                              size_t *reservation)
+{
+  size_t limit = (size_t)-1;
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, ordinal);
+  if (ret != CUDA_SUCCESS)
+  {
+    return ret;
+  }
+  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  {
+    limit = g_anycuda_config.gpu_mem_limit[*ordinal];
+  }
+
+  *reservation = array_size(desc, levels);
+  if (ledger_reserve_or_trim(*ordinal, *reservation, limit) != 0)
+  {
+    // arrays can't live in host memory, so over limit is out of memory
+    pod_shm_account_policy(OVER_LIMIT_OOM, *reservation, 0, 1);
+    LOGGER(WARNING, "[%s] %zu bytes over limit on device %d, used %zu, limit %zu",
+           caller, *reservation, *ordinal, get_pod_used_memory(*ordinal),
+           limit);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+
+  return CUDA_SUCCESS;
+}
+
+/**
+ * Charge a created array for what the driver says it is, or give its
+ * reservation back when it wasn't created
+ */
+static void array_commit(CUresult ret, CUarray array, CUdevice ordinal,
+                         size_t reservation)
+{
+  if (ret != CUDA_SUCCESS)
+  {
+    ledger_unreserve(ordinal, reservation);
+    return;
+  }
+  ledger_settle((uint64_t)(uintptr_t)array,
+                array_measure(array, reservation), reservation, ordinal,
+                LEDGER_ARRAY);
+}
+
+static void array_desc_3d(CUDA_ARRAY3D_DESCRIPTOR *desc,
+                          const CUDA_ARRAY_DESCRIPTOR *desc_2d)
+{
+  desc->Width = desc_2d->Width;
+  desc->Height = desc_2d->Height;
+  desc->Depth = 0;
+  desc->Format = desc_2d->Format;
+  desc->NumChannels = desc_2d->NumChannels;
+  desc->Flags = 0;
+}
+
+CUresult cuArrayCreate_v2(CUarray *pHandle,
+                          const CUDA_ARRAY_DESCRIPTOR *pAllocateArray)
+{
+  CUDA_ARRAY3D_DESCRIPTOR desc;
+  size_t reservation;
+  CUdevice ordinal;
+  CUresult ret;
+
+  array_desc_3d(&desc, pAllocateArray);
+  ret = array_reserve("cuArrayCreate_v2", &desc, 1, &ordinal, &reservation);
+  if (ret != CUDA_SUCCESS)
+  {
+    goto DONE;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuArrayCreate_v2, pHandle,
+                        pAllocateArray);
+  array_commit(ret, ret == CUDA_SUCCESS ? *pHandle : NULL, ordinal,
+               reservation);
+DONE:
+  return ret;
+}
+
+CUresult cuArrayCreate(CUarray *pHandle,
+                       const CUDA_ARRAY_DESCRIPTOR *pAllocateArray)
+{
+  CUDA_ARRAY3D_DESCRIPTOR desc;
+  size_t reservation;
+  CUdevice ordinal;
+  CUresult ret;
+
+  array_desc_3d(&desc, pAllocateArray);
+  ret = array_reserve("cuArrayCreate", &desc, 1, &ordinal, &reservation);
+  if (ret != CUDA_SUCCESS)
+  {
+    goto DONE;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuArrayCreate, pHandle,
+                        pAllocateArray);
+  array_commit(ret, ret == CUDA_SUCCESS ? *pHandle : NULL, ordinal,
+               reservation);
+DONE:
+  return ret;
+}
+
+CUresult cuArray3DCreate_v2(CUarray *pHandle,
+                            const CUDA_ARRAY3D_DESCRIPTOR *pAllocateArray)
+{
+  size_t reservation;
+  CUdevice ordinal;
+  CUresult ret;
+
+  ret = array_reserve("cuArray3DCreate_v2", pAllocateArray, 1, &ordinal,
+                      &reservation);
+  if (ret != CUDA_SUCCESS)
+  {
+    goto DONE;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuArray3DCreate_v2, pHandle,
+                        pAllocateArray);
+  array_commit(ret, ret == CUDA_SUCCESS ? *pHandle : NULL, ordinal,
+               reservation);
+DONE:
+  return ret;
+}
+
+CUresult cuArray3DCreate(CUarray *pHandle,
+                         const CUDA_ARRAY3D_DESCRIPTOR *pAllocateArray)
+{
+  size_t reservation;
+  CUdevice ordinal;
+  CUresult ret;
+
+  ret = array_reserve("cuArray3DCreate", pAllocateArray, 1, &ordinal,
+                      &reservation);
+  if (ret != CUDA_SUCCESS)
+  {
+    goto DONE;
+  }
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuArray3DCreate, pHandle,
+                        pAllocateArray);
+  array_commit(ret, ret == CUDA_SUCCESS ? *pHandle : NULL, ordinal,
+               reservation);
+DONE:
+  return ret;
+}
+
+CUresult cuArrayDestroy(CUarray hArray)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuArrayDestroy, hArray);
+  if (ret == CUDA_SUCCESS)
+  {
+    ledger_del((uint64_t)(uintptr_t)hArray, NULL);
+  }
+
+  return ret;
+}
+
+CUresult
+cuMipmappedArrayCreate(CUmipmappedArray *pHandle,
+                       const CUDA_ARRAY3D_DESCRIPTOR *pMipmappedArrayDesc,
+                       unsigned int numMipmapLevels)
+{
+  size_t reservation;
+  CUdevice ordinal;
+  CUresult ret;
+
+  ret = array_reserve("cuMipmappedArrayCreate", pMipmappedArrayDesc,
+                      numMipmapLevels, &ordinal, &reservation);
+  if (ret != CUDA_SUCCESS)
+  {
+    goto DONE;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMipmappedArrayCreate, pHandle,
+                        pMipmappedArrayDesc, numMipmapLevels);
+  if (ret != CUDA_SUCCESS)
+  {
+    ledger_unreserve(ordinal, reservation);
+    goto DONE;
+  }
+  // the levels belong to the mipmapped array, only it is charged
+  ledger_settle((uint64_t)(uintptr_t)*pHandle,
+                mipmap_measure(*pHandle, pMipmappedArrayDesc, numMipmapLevels,
+                               reservation),
+                reservation, ordinal, LEDGER_ARRAY);
+DONE:
+  return ret;
+}
+
+CUresult cuMipmappedArrayDestroy(CUmipmappedArray hMipmappedArray)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMipmappedArrayDestroy,
+                        hMipmappedArray);
+  if (ret == CUDA_SUCCESS)
+  {
+    ledger_del((uint64_t)(uintptr_t)hMipmappedArray, NULL);
+  }
+
+  return ret;
+}
+
+CUresult cuDeviceTotalMem_v2(size_t *bytes, CUdevice dev)
+{
+  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  {
+    *bytes = g_anycuda_config.gpu_mem_limit[dev];
+
+    return CUDA_SUCCESS;
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceTotalMem_v2, bytes, dev);
+}
+
+CUresult cuDeviceTotalMem(size_t *bytes, CUdevice dev)
+{
+  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  {
+    *bytes = g_anycuda_config.gpu_mem_limit[dev];
+
+    return CUDA_SUCCESS;
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceTotalMem, bytes, dev);
+}
+
+CUresult cuMemGetInfo_v2(size_t *free, size_t *total)
+{
+  size_t used = 0;
+  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  {
+    CUdevice device_id;
+    CUresult ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device_id);
+    if (ret != CUDA_SUCCESS)
+    {
+      return ret;
+    }
+    used = get_pod_used_memory(device_id);
+
+    *total = g_anycuda_config.gpu_mem_limit[device_id];
+    *free =
+        used > g_anycuda_config.gpu_mem_limit[device_id] ? 0 : g_anycuda_config.gpu_mem_limit[device_id] - used;
+
+    LOGGER(VERBOSE, "[cuMemGetInfo_v2] device %d, used %lu, free %lu, total %lu", device_id, used, free, total);
+
+    return CUDA_SUCCESS;
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetInfo_v2, free, total);
+}
+
+CUresult cuMemGetInfo(size_t *free, size_t *total)
+{
+  size_t used = 0;
+
+  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  {
+    CUdevice device_id;
+    CUresult ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device_id);
+    if (ret != CUDA_SUCCESS)
+    {
+      return ret;
+    }
+    used = get_pod_used_memory(device_id);
+
+    *total = g_anycuda_config.gpu_mem_limit[device_id];
+    *free =
+        used > g_anycuda_config.gpu_mem_limit[device_id] ? 0 : g_anycuda_config.gpu_mem_limit[device_id] - used;
+
+    return CUDA_SUCCESS;
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetInfo, free, total);
+}
+
+CUresult cuMemcpy_ptds(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dst, 1);
+  residency_touch(src, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpy_ptds, dst, src,
+                        ByteCount);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpy(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dst, 1);
+  residency_touch(src, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpy, dst, src, ByteCount);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyAsync_ptsz(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount,
+                            CUstream hStream)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dst, 1);
+  residency_touch(src, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyAsync_ptsz, dst, src,
+                        ByteCount, hStream);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyAsync(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount,
+                       CUstream hStream)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dst, 1);
+  residency_touch(src, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyAsync, dst, src, ByteCount,
+                        hStream);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyHtoD_v2_ptds(CUdeviceptr dstDevice, const void *srcHost,
+                              size_t ByteCount)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dstDevice, 1);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyHtoD_v2_ptds, dstDevice,
+                        srcHost, ByteCount);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyHtoD_v2(CUdeviceptr dstDevice, const void *srcHost,
+                         size_t ByteCount)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dstDevice, 1);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyHtoD_v2, dstDevice,
+                        srcHost, ByteCount);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyHtoDAsync_v2_ptsz(CUdeviceptr dstDevice, const void *srcHost,
+                                   size_t ByteCount, CUstream hStream)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dstDevice, 1);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyHtoDAsync_v2_ptsz,
+                        dstDevice, srcHost, ByteCount, hStream);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyHtoDAsync_v2(CUdeviceptr dstDevice, const void *srcHost,
+                              size_t ByteCount, CUstream hStream)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dstDevice, 1);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyHtoDAsync_v2, dstDevice,
+                        srcHost, ByteCount, hStream);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyDtoH_v2_ptds(void *dstHost, CUdeviceptr srcDevice,
+                              size_t ByteCount)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(srcDevice, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoH_v2_ptds, dstHost,
+                        srcDevice, ByteCount);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyDtoH_v2(void *dstHost, CUdeviceptr srcDevice,
+                         size_t ByteCount)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(srcDevice, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoH_v2, dstHost,
+                        srcDevice, ByteCount);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyDtoHAsync_v2_ptsz(void *dstHost, CUdeviceptr srcDevice,
+                                   size_t ByteCount, CUstream hStream)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(srcDevice, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoHAsync_v2_ptsz, dstHost,
+                        srcDevice, ByteCount, hStream);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyDtoHAsync_v2(void *dstHost, CUdeviceptr srcDevice,
+                              size_t ByteCount, CUstream hStream)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(srcDevice, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoHAsync_v2, dstHost,
+                        srcDevice, ByteCount, hStream);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyDtoD_v2_ptds(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
+                              size_t ByteCount)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dstDevice, 1);
+  residency_touch(srcDevice, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoD_v2_ptds, dstDevice,
+                        srcDevice, ByteCount);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyDtoD_v2(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
+                         size_t ByteCount)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dstDevice, 1);
+  residency_touch(srcDevice, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoD_v2, dstDevice,
+                        srcDevice, ByteCount);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyDtoDAsync_v2_ptsz(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
+                                   size_t ByteCount, CUstream hStream)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dstDevice, 1);
+  residency_touch(srcDevice, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoDAsync_v2_ptsz,
+                        dstDevice, srcDevice, ByteCount, hStream);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemcpyDtoDAsync_v2(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
+                              size_t ByteCount, CUstream hStream)
+{
+  int device;
+  CUresult ret;
+
+  residency_touch(dstDevice, 1);
+  residency_touch(srcDevice, 0);
+
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemcpyDtoDAsync_v2, dstDevice,
+                        srcDevice, ByteCount, hStream);
+  arbiter_leave(device);
+
+  return ret;
+}
+
+CUresult cuMemsetD8_v2_ptds(CUdeviceptr dstDevice, unsigned char uc, size_t N)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD8_v2_ptds, dstDevice, uc,
+                         N);
+}
+
+CUresult cuMemsetD8_v2(CUdeviceptr dstDevice, unsigned char uc, size_t N)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD8_v2, dstDevice, uc, N);
+}
+
+CUresult cuMemsetD8Async_ptsz(CUdeviceptr dstDevice, unsigned char uc, size_t N,
+                              CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD8Async_ptsz, dstDevice,
+                         uc, N, hStream);
+}
+
+CUresult cuMemsetD8Async(CUdeviceptr dstDevice, unsigned char uc, size_t N,
+                         CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD8Async, dstDevice, uc, N,
+                         hStream);
+}
+
+CUresult cuMemsetD16_v2_ptds(CUdeviceptr dstDevice, unsigned short us,
+                             size_t N)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD16_v2_ptds, dstDevice, us,
+                         N);
+}
+
+CUresult cuMemsetD16_v2(CUdeviceptr dstDevice, unsigned short us, size_t N)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD16_v2, dstDevice, us, N);
+}
+
+CUresult cuMemsetD16Async_ptsz(CUdeviceptr dstDevice, unsigned short us,
+                               size_t N, CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD16Async_ptsz, dstDevice,
+                         us, N, hStream);
+}
+
+CUresult cuMemsetD16Async(CUdeviceptr dstDevice, unsigned short us, size_t N,
+                          CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD16Async, dstDevice, us, N,
+                         hStream);
+}
+
+CUresult cuMemsetD32_v2_ptds(CUdeviceptr dstDevice, unsigned int ui, size_t N)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD32_v2_ptds, dstDevice, ui,
+                         N);
+}
+
+CUresult cuMemsetD32_v2(CUdeviceptr dstDevice, unsigned int ui, size_t N)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD32_v2, dstDevice, ui, N);
+}
+
+CUresult cuMemsetD32Async_ptsz(CUdeviceptr dstDevice, unsigned int ui, size_t N,
+                               CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD32Async_ptsz, dstDevice,
+                         ui, N, hStream);
+}
+
+CUresult cuMemsetD32Async(CUdeviceptr dstDevice, unsigned int ui, size_t N,
+                          CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD32Async, dstDevice, ui, N,
+                         hStream);
+}
+
+CUresult cuMemsetD2D8_v2_ptds(CUdeviceptr dstDevice, size_t dstPitch,
+                              unsigned char uc, size_t Width, size_t Height)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D8_v2_ptds, dstDevice,
+                         dstPitch, uc, Width, Height);
+}
+
+CUresult cuMemsetD2D8_v2(CUdeviceptr dstDevice, size_t dstPitch,
+                         unsigned char uc, size_t Width, size_t Height)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D8_v2, dstDevice,
+                         dstPitch, uc, Width, Height);
+}
+
+CUresult cuMemsetD2D8Async_ptsz(CUdeviceptr dstDevice, size_t dstPitch,
+                                unsigned char uc, size_t Width, size_t Height,
+                                CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D8Async_ptsz, dstDevice,
+                         dstPitch, uc, Width, Height, hStream);
+}
+
+CUresult cuMemsetD2D8Async(CUdeviceptr dstDevice, size_t dstPitch,
+                           unsigned char uc, size_t Width, size_t Height,
+                           CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D8Async, dstDevice,
+                         dstPitch, uc, Width, Height, hStream);
+}
+
+CUresult cuMemsetD2D16_v2_ptds(CUdeviceptr dstDevice, size_t dstPitch,
+                               unsigned short us, size_t Width, size_t Height)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D16_v2_ptds, dstDevice,
+                         dstPitch, us, Width, Height);
+}
+
+CUresult cuMemsetD2D16_v2(CUdeviceptr dstDevice, size_t dstPitch,
+                          unsigned short us, size_t Width, size_t Height)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D16_v2, dstDevice,
+                         dstPitch, us, Width, Height);
+}
+
+CUresult cuMemsetD2D16Async_ptsz(CUdeviceptr dstDevice, size_t dstPitch,
+                                 unsigned short us, size_t Width, size_t Height,
+                                 CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D16Async_ptsz, dstDevice,
+                         dstPitch, us, Width, Height, hStream);
+}
+
+CUresult cuMemsetD2D16Async(CUdeviceptr dstDevice, size_t dstPitch,
+                            unsigned short us, size_t Width, size_t Height,
+                            CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D16Async, dstDevice,
+                         dstPitch, us, Width, Height, hStream);
+}
+
+CUresult cuMemsetD2D32_v2_ptds(CUdeviceptr dstDevice, size_t dstPitch,
+                               unsigned int ui, size_t Width, size_t Height)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D32_v2_ptds, dstDevice,
+                         dstPitch, ui, Width, Height);
+}
+
+CUresult cuMemsetD2D32_v2(CUdeviceptr dstDevice, size_t dstPitch,
+                          unsigned int ui, size_t Width, size_t Height)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D32_v2, dstDevice,
+                         dstPitch, ui, Width, Height);
+}
+
+CUresult cuMemsetD2D32Async_ptsz(CUdeviceptr dstDevice, size_t dstPitch,
+                                 unsigned int ui, size_t Width, size_t Height,
+                                 CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D32Async_ptsz, dstDevice,
+                         dstPitch, ui, Width, Height, hStream);
+}
+
+CUresult cuMemsetD2D32Async(CUdeviceptr dstDevice, size_t dstPitch,
+                            unsigned int ui, size_t Width, size_t Height,
+                            CUstream hStream)
+{
+  residency_touch(dstDevice, 1);
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemsetD2D32Async, dstDevice,
+                         dstPitch, ui, Width, Height, hStream);
+}
+
+CUresult cuDevicePrimaryCtxRetain(CUcontext *pctx, CUdevice dev)
+{
+  implicit_probe_t probe;
+  int first;
+  CUresult ret;
+
+  // only the first retain creates the context
+  first = implicit_primary_retain(dev);
+  if (first)
+  {
+    implicit_begin(&probe, dev);
+  }
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxRetain, pctx,
+                        dev);
+  if (ret != CUDA_SUCCESS)
+  {
+    implicit_primary_retained(dev, NULL);
+    return ret;
+  }
+  implicit_primary_retained(dev, *pctx);
+  if (first)
+  {
+    implicit_end(&probe, (uint64_t)(uintptr_t)*pctx);
+  }
 
-CUresult cuArrayCreate(CUarray *pHandle,
-                       const CUDA_ARRAY_DESCRIPTOR *pAllocateArray)
+  return ret;
+}
+
+/**
+ * Drop what is cached for ctx, its memory and events are freed with it
+ */
+static void forget_context(CUcontext ctx)
+{
+  kernel_cost_forget_context(ctx);
+  queue_depth_forget_context(ctx);
+  slab_forget_context(ctx);
+}
+
+CUresult cuDevicePrimaryCtxRelease(CUdevice dev)
 {
+  CUcontext ctx;
   CUresult ret;
 
-  ret = cuArrayCreate_helper(pAllocateArray);
-  if (ret != CUDA_SUCCESS)
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxRelease, dev);
+  if (ret == CUDA_SUCCESS && (ctx = implicit_primary_release(dev)) != NULL)
   {
-    goto DONE;
+    forget_context(ctx);
   }
 
-  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuArrayCreate, pHandle,
-                        pAllocateArray);
-DONE:
   return ret;
 }
 
-static CUresult
-cuArray3DCreate_helper(const CUDA_ARRAY3D_DESCRIPTOR *pAllocateArray)
+CUresult cuDevicePrimaryCtxRelease_v2(CUdevice dev)
 {
-  size_t used = 0;
-  size_t base_size = 0;
-  size_t request_size = 0;
-  CUresult ret = CUDA_SUCCESS;
+  CUcontext ctx;
+  CUresult ret;
 
-  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxRelease_v2,
+                        dev);
+  if (ret == CUDA_SUCCESS && (ctx = implicit_primary_release(dev)) != NULL)
   {
-    CUdevice device_id;
-    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device_id);
-    if (ret != CUDA_SUCCESS)
-    {
-      goto DONE;
-    }
-    base_size = get_array_base_size(pAllocateArray->Format);
-    request_size = base_size * pAllocateArray->NumChannels *
-                   pAllocateArray->Height * pAllocateArray->Width;
+    forget_context(ctx);
+  }
+
+  return ret;
+}
 
-    get_used_gpu_memory((void *)&used, device_id);
+CUresult cuDevicePrimaryCtxReset(CUdevice dev)
+{
+  CUcontext ctx = implicit_primary_context(dev);
 
-    if (g_anycuda_config.gpu_mem_limit[device_id] >= 0 && used + request_size > g_anycuda_config.gpu_mem_limit[device_id])
-    {
-      ret = CUDA_ERROR_OUT_OF_MEMORY;
-      goto DONE;
-    }
+  // the handle outlives the reset, what it held doesn't
+  if (ctx)
+  {
+    forget_context(ctx);
   }
 
-DONE:
-  return ret;
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxReset, dev);
 }
 
-CUresult cuArray3DCreate_v2(CUarray *pHandle,
-                            const CUDA_ARRAY3D_DESCRIPTOR *pAllocateArray)
+CUresult cuDevicePrimaryCtxReset_v2(CUdevice dev)
+{
+  CUcontext ctx = implicit_primary_context(dev);
+
+  if (ctx)
+  {
+    forget_context(ctx);
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxReset_v2, dev);
+}
+
+CUresult cuCtxCreate_v2(CUcontext *pctx, unsigned int flags, CUdevice dev)
 {
+  implicit_probe_t probe;
   CUresult ret;
 
-  ret = cuArray3DCreate_helper(pAllocateArray);
-  if (ret != CUDA_SUCCESS)
+  implicit_begin(&probe, dev);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxCreate_v2, pctx, flags, dev);
+  if (ret == CUDA_SUCCESS)
   {
-    goto DONE;
+    implicit_end(&probe, (uint64_t)(uintptr_t)*pctx);
   }
 
-  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuArray3DCreate_v2, pHandle,
-                        pAllocateArray);
-DONE:
   return ret;
 }
 
-CUresult cuArray3DCreate(CUarray *pHandle,
-                         const CUDA_ARRAY3D_DESCRIPTOR *pAllocateArray)
+CUresult cuCtxCreate(CUcontext *pctx, unsigned int flags, CUdevice dev)
 {
+  implicit_probe_t probe;
   CUresult ret;
 
-  ret = cuArray3DCreate_helper(pAllocateArray);
-  if (ret != CUDA_SUCCESS)
+  implicit_begin(&probe, dev);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxCreate, pctx, flags, dev);
+  if (ret == CUDA_SUCCESS)
   {
-    goto DONE;
+    implicit_end(&probe, (uint64_t)(uintptr_t)*pctx);
   }
-  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuArray3DCreate, pHandle,
-                        pAllocateArray);
-DONE:
+
   return ret;
 }
 
-CUresult
-cuMipmappedArrayCreate(CUmipmappedArray *pHandle,
-                       const CUDA_ARRAY3D_DESCRIPTOR *pMipmappedArrayDesc,
-                       unsigned int numMipmapLevels)
+CUresult cuCtxCreate_v3(CUcontext *pctx, CUexecAffinityParam *paramsArray,
+                        int numParams, unsigned int flags, CUdevice dev)
 {
-  size_t used = 0;
-  size_t base_size = 0;
-  size_t request_size = 0;
+  implicit_probe_t probe;
   CUresult ret;
 
-  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  implicit_begin(&probe, dev);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxCreate_v3, pctx, paramsArray,
+                        numParams, flags, dev);
+  if (ret == CUDA_SUCCESS)
   {
-    CUdevice device_id;
-    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device_id);
-    if (ret != CUDA_SUCCESS)
-    {
-      goto DONE;
-    }
-    base_size = get_array_base_size(pMipmappedArrayDesc->Format);
-    request_size = base_size * pMipmappedArrayDesc->NumChannels *
-                   pMipmappedArrayDesc->Height * pMipmappedArrayDesc->Width *
-                   pMipmappedArrayDesc->Depth;
+    implicit_end(&probe, (uint64_t)(uintptr_t)*pctx);
+  }
 
-    get_used_gpu_memory((void *)&used, device_id);
+  return ret;
+}
 
-    if (g_anycuda_config.gpu_mem_limit[device_id] >= 0 && used + request_size > g_anycuda_config.gpu_mem_limit[device_id])
-    {
-      ret = CUDA_ERROR_OUT_OF_MEMORY;
-      goto DONE;
-    }
+CUresult cuCtxDestroy_v2(CUcontext ctx)
+{
+  CUresult ret;
+
+  forget_context(ctx);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxDestroy_v2, ctx);
+  if (ret == CUDA_SUCCESS)
+  {
+    implicit_forget_context(ctx);
   }
 
-  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMipmappedArrayCreate, pHandle,
-                        pMipmappedArrayDesc, numMipmapLevels);
-DONE:
   return ret;
 }
 
-CUresult cuDeviceTotalMem_v2(size_t *bytes, CUdevice dev)
+CUresult cuCtxDestroy(CUcontext ctx)
 {
-  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
-  {
-    *bytes = g_anycuda_config.gpu_mem_limit[dev];
+  CUresult ret;
 
-    return CUDA_SUCCESS;
+  forget_context(ctx);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxDestroy, ctx);
+  if (ret == CUDA_SUCCESS)
+  {
+    implicit_forget_context(ctx);
   }
 
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceTotalMem_v2, bytes, dev);
+  return ret;
 }
 
-CUresult cuDeviceTotalMem(size_t *bytes, CUdevice dev)
+CUresult cuCtxSetLimit(CUlimit limit, size_t value)
 {
-  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
-  {
-    *bytes = g_anycuda_config.gpu_mem_limit[dev];
+  return implicit_set_limit(limit, value);
+}
 
-    return CUDA_SUCCESS;
+CUresult cuModuleLoad(CUmodule *module, const char *fname)
+{
+  implicit_probe_t probe;
+  CUresult ret;
+
+  implicit_begin(&probe, -1);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuModuleLoad, module, fname);
+  if (ret == CUDA_SUCCESS)
+  {
+    implicit_end(&probe, (uint64_t)(uintptr_t)*module);
   }
 
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceTotalMem, bytes, dev);
+  return ret;
 }
 
-CUresult cuMemGetInfo_v2(size_t *free, size_t *total)
+CUresult cuModuleLoadData(CUmodule *module, const void *image)
 {
-  size_t used = 0;
-  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  implicit_probe_t probe;
+  CUresult ret;
+
+  implicit_begin(&probe, -1);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuModuleLoadData, module, image);
+  if (ret == CUDA_SUCCESS)
   {
-    CUdevice device_id;
-    CUresult ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device_id);
-    if (ret != CUDA_SUCCESS)
-    {
-      return ret;
-    }
-    get_used_gpu_memory((void *)&used, device_id);
+    implicit_end(&probe, (uint64_t)(uintptr_t)*module);
+  }
 
-    *total = g_anycuda_config.gpu_mem_limit[device_id];
-    *free =
-        used > g_anycuda_config.gpu_mem_limit[device_id] ? 0 : g_anycuda_config.gpu_mem_limit[device_id] - used;
+  return ret;
+}
 
-    LOGGER(VERBOSE, "[cuMemGetInfo_v2] device %d, used %lu, free %lu, total %lu", device_id, used, free, total);
+CUresult cuModuleLoadDataEx(CUmodule *module, const void *image,
+                            unsigned int numOptions, CUjit_option *options,
+                            void **optionValues)
+{
+  implicit_probe_t probe;
+  CUresult ret;
 
-    return CUDA_SUCCESS;
+  implicit_begin(&probe, -1);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuModuleLoadDataEx, module, image,
+                        numOptions, options, optionValues);
+  if (ret == CUDA_SUCCESS)
+  {
+    implicit_end(&probe, (uint64_t)(uintptr_t)*module);
   }
 
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetInfo_v2, free, total);
+  return ret;
 }
 
-CUresult cuMemGetInfo(size_t *free, size_t *total)
+CUresult cuModuleLoadFatBinary(CUmodule *module, const void *fatCubin)
 {
-  size_t used = 0;
+  implicit_probe_t probe;
+  CUresult ret;
 
-  if (g_anycuda_config.valid && g_anycuda_config.gpu_mem_limit_valid)
+  implicit_begin(&probe, -1);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuModuleLoadFatBinary, module,
+                        fatCubin);
+  if (ret == CUDA_SUCCESS)
   {
-    CUdevice device_id;
-    CUresult ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device_id);
-    if (ret != CUDA_SUCCESS)
-    {
-      return ret;
-    }
-    get_used_gpu_memory((void *)&used, device_id);
+    implicit_end(&probe, (uint64_t)(uintptr_t)*module);
+  }
 
-    *total = g_anycuda_config.gpu_mem_limit[device_id];
-    *free =
-        used > g_anycuda_config.gpu_mem_limit[device_id] ? 0 : g_anycuda_config.gpu_mem_limit[device_id] - used;
+  return ret;
+}
 
-    return CUDA_SUCCESS;
+CUresult cuModuleUnload(CUmodule hmod)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuModuleUnload, hmod);
+  if (ret == CUDA_SUCCESS)
+  {
+    ledger_del_implicit((uint64_t)(uintptr_t)hmod);
   }
 
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetInfo, free, total);
+  return ret;
 }
 
 CUresult cuLaunchKernel_ptsz(CUfunction f, unsigned int gridDimX,
@@ -1095,9 +3069,29 @@ CUresult cuLaunchKernel_ptsz(CUfunction f, unsigned int gridDimX,
                              unsigned int sharedMemBytes, CUstream hStream,
                              void **kernelParams, void **extra)
 {
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchKernel_ptsz, f, gridDimX,
-                         gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
-                         sharedMemBytes, hStream, kernelParams, extra);
+  kernel_sample_t *sample;
+  queue_batch_t *batch;
+  CUresult ret;
+  int device;
+
+  implicit_launch(f);
+  residency_prefetch(f, kernelParams, extra, hStream, 1);
+  batch = queue_depth_enter(f, gridDimX * gridDimY * gridDimZ,
+                            blockDimX * blockDimY * blockDimZ, hStream, 1);
+  sample = sm_limiter_launch(f, gridDimX * gridDimY * gridDimZ,
+                             blockDimX * blockDimY * blockDimZ, hStream, 1);
+
+  device = arbiter_enter();
+  // the slice may be waited for, that is not time of the kernel
+  sample = kernel_cost_start(sample);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchKernel_ptsz, f, gridDimX,
+                        gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
+                        sharedMemBytes, hStream, kernelParams, extra);
+  arbiter_leave(device);
+  queue_depth_leave(batch, ret);
+  kernel_cost_end(sample, ret);
+
+  return ret;
 }
 
 CUresult cuLaunchKernel(CUfunction f, unsigned int gridDimX,
@@ -1106,14 +3100,51 @@ CUresult cuLaunchKernel(CUfunction f, unsigned int gridDimX,
                         unsigned int blockDimZ, unsigned int sharedMemBytes,
                         CUstream hStream, void **kernelParams, void **extra)
 {
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchKernel, f, gridDimX,
-                         gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
-                         sharedMemBytes, hStream, kernelParams, extra);
+  kernel_sample_t *sample;
+  queue_batch_t *batch;
+  CUresult ret;
+  int device;
+
+  implicit_launch(f);
+  residency_prefetch(f, kernelParams, extra, hStream, 0);
+  batch = queue_depth_enter(f, gridDimX * gridDimY * gridDimZ,
+                            blockDimX * blockDimY * blockDimZ, hStream, 0);
+  sample = sm_limiter_launch(f, gridDimX * gridDimY * gridDimZ,
+                             blockDimX * blockDimY * blockDimZ, hStream, 0);
+
+  device = arbiter_enter();
+  // the slice may be waited for, that is not time of the kernel
+  sample = kernel_cost_start(sample);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchKernel, f, gridDimX,
+                        gridDimY, gridDimZ, blockDimX, blockDimY, blockDimZ,
+                        sharedMemBytes, hStream, kernelParams, extra);
+  arbiter_leave(device);
+  queue_depth_leave(batch, ret);
+  kernel_cost_end(sample, ret);
+
+  return ret;
 }
 
 CUresult cuLaunch(CUfunction f)
 {
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuLaunch, f);
+  kernel_sample_t *sample;
+  queue_batch_t *batch;
+  CUresult ret;
+  int device;
+
+  implicit_launch(f);
+  batch = queue_depth_enter(f, 1, sm_limiter_shape(f), NULL, 0);
+  sample = sm_limiter_launch(f, 1, sm_limiter_shape(f), NULL, 0);
+
+  device = arbiter_enter();
+  // the slice may be waited for, that is not time of the kernel
+  sample = kernel_cost_start(sample);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuLaunch, f);
+  arbiter_leave(device);
+  queue_depth_leave(batch, ret);
+  kernel_cost_end(sample, ret);
+
+  return ret;
 }
 
 CUresult cuLaunchCooperativeKernel_ptsz(
@@ -1122,9 +3153,29 @@ CUresult cuLaunchCooperativeKernel_ptsz(
     unsigned int blockDimZ, unsigned int sharedMemBytes, CUstream hStream,
     void **kernelParams)
 {
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchCooperativeKernel_ptsz, f,
-                         gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY,
-                         blockDimZ, sharedMemBytes, hStream, kernelParams);
+  kernel_sample_t *sample;
+  queue_batch_t *batch;
+  CUresult ret;
+  int device;
+
+  implicit_launch(f);
+  residency_prefetch(f, kernelParams, NULL, hStream, 1);
+  batch = queue_depth_enter(f, gridDimX * gridDimY * gridDimZ,
+                            blockDimX * blockDimY * blockDimZ, hStream, 1);
+  sample = sm_limiter_launch(f, gridDimX * gridDimY * gridDimZ,
+                             blockDimX * blockDimY * blockDimZ, hStream, 1);
+
+  device = arbiter_enter();
+  // the slice may be waited for, that is not time of the kernel
+  sample = kernel_cost_start(sample);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchCooperativeKernel_ptsz, f,
+                        gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY,
+                        blockDimZ, sharedMemBytes, hStream, kernelParams);
+  arbiter_leave(device);
+  queue_depth_leave(batch, ret);
+  kernel_cost_end(sample, ret);
+
+  return ret;
 }
 
 CUresult cuLaunchCooperativeKernel(CUfunction f, unsigned int gridDimX,
@@ -1135,50 +3186,241 @@ CUresult cuLaunchCooperativeKernel(CUfunction f, unsigned int gridDimX,
                                    unsigned int sharedMemBytes,
                                    CUstream hStream, void **kernelParams)
 {
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchCooperativeKernel, f,
-                         gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY,
-                         blockDimZ, sharedMemBytes, hStream, kernelParams);
+  kernel_sample_t *sample;
+  queue_batch_t *batch;
+  CUresult ret;
+  int device;
+
+  implicit_launch(f);
+  residency_prefetch(f, kernelParams, NULL, hStream, 0);
+  batch = queue_depth_enter(f, gridDimX * gridDimY * gridDimZ,
+                            blockDimX * blockDimY * blockDimZ, hStream, 0);
+  sample = sm_limiter_launch(f, gridDimX * gridDimY * gridDimZ,
+                             blockDimX * blockDimY * blockDimZ, hStream, 0);
+
+  device = arbiter_enter();
+  // the slice may be waited for, that is not time of the kernel
+  sample = kernel_cost_start(sample);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchCooperativeKernel, f,
+                        gridDimX, gridDimY, gridDimZ, blockDimX, blockDimY,
+                        blockDimZ, sharedMemBytes, hStream, kernelParams);
+  arbiter_leave(device);
+  queue_depth_leave(batch, ret);
+  kernel_cost_end(sample, ret);
+
+  return ret;
 }
 
 CUresult cuLaunchGrid(CUfunction f, int grid_width, int grid_height)
 {
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchGrid, f, grid_width,
-                         grid_height);
+  kernel_sample_t *sample;
+  queue_batch_t *batch;
+  CUresult ret;
+  int device;
+
+  implicit_launch(f);
+  batch = queue_depth_enter(f, grid_width * grid_height,
+                            sm_limiter_shape(f), NULL, 0);
+  sample = sm_limiter_launch(f, grid_width * grid_height, sm_limiter_shape(f),
+                             NULL, 0);
+
+  device = arbiter_enter();
+  // the slice may be waited for, that is not time of the kernel
+  sample = kernel_cost_start(sample);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchGrid, f, grid_width,
+                        grid_height);
+  arbiter_leave(device);
+  queue_depth_leave(batch, ret);
+  kernel_cost_end(sample, ret);
+
+  return ret;
 }
 
 CUresult cuLaunchGridAsync(CUfunction f, int grid_width, int grid_height,
                            CUstream hStream)
 {
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchGridAsync, f, grid_width,
-                         grid_height, hStream);
+  kernel_sample_t *sample;
+  queue_batch_t *batch;
+  CUresult ret;
+  int device;
+
+  implicit_launch(f);
+  batch = queue_depth_enter(f, grid_width * grid_height,
+                            sm_limiter_shape(f), hStream, 0);
+  sample = sm_limiter_launch(f, grid_width * grid_height, sm_limiter_shape(f),
+                             hStream, 0);
+
+  device = arbiter_enter();
+  // the slice may be waited for, that is not time of the kernel
+  sample = kernel_cost_start(sample);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuLaunchGridAsync, f, grid_width,
+                        grid_height, hStream);
+  arbiter_leave(device);
+  queue_depth_leave(batch, ret);
+  kernel_cost_end(sample, ret);
+
+  return ret;
 }
 
 CUresult cuFuncSetBlockShape(CUfunction hfunc, int x, int y, int z)
 {
-  return CUDA_ENTRY_CALL(cuda_library_entry, cuFuncSetBlockShape, hfunc, x, y,
-                         z);
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuFuncSetBlockShape, hfunc, x, y,
+                        z);
+  if (ret == CUDA_SUCCESS)
+  {
+    sm_limiter_set_shape(hfunc, x * y * z);
+  }
+
+  return ret;
 }
 
-CUresult cuGetProcAddress(const char *symbol, void **pfn, int cudaVersion,
-                          cuuint64_t flags)
+CUresult cuGraphLaunch(CUgraphExec hGraphExec, CUstream hStream)
 {
+  queue_batch_t *batch;
+  int device;
   CUresult ret;
-  int i;
 
-  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuGetProcAddress, symbol, pfn,
-                        cudaVersion, flags);
-  if (ret == CUDA_SUCCESS)
+  batch = queue_depth_enter(NULL, 0, 0, hStream, 0);
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuGraphLaunch, hGraphExec, hStream);
+  arbiter_leave(device);
+  queue_depth_leave(batch, ret);
+
+  return ret;
+}
+
+CUresult cuGraphLaunch_ptsz(CUgraphExec hGraphExec, CUstream hStream)
+{
+  queue_batch_t *batch;
+  int device;
+  CUresult ret;
+
+  batch = queue_depth_enter(NULL, 0, 0, hStream, 1);
+  device = arbiter_enter();
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuGraphLaunch_ptsz, hGraphExec,
+                        hStream);
+  arbiter_leave(device);
+  queue_depth_leave(batch, ret);
+
+  return ret;
+}
+
+/**
+ * Driver functions the hooks stand for, a pointer cuGetProcAddress resolved
+ * is looked up among them
+ */
+static void *g_hook_originals[sizeof(cuda_hooks_entry) /
+                              sizeof(cuda_hooks_entry[0])];
+static pthread_once_t g_hook_originals_set = PTHREAD_ONCE_INIT;
+
+static void load_hook_originals()
+{
+  int i, j;
+
+  for (i = 0; i < cuda_hook_nums; i++)
   {
-    for (i = 0; i < cuda_hook_nums; i++)
+    for (j = 0; j < CUDA_ENTRY_END; j++)
     {
-      if (!strcmp(symbol, cuda_hooks_entry[i].name))
+      if (cuda_library_entry[j].name &&
+          !strcmp(cuda_hooks_entry[i].name, cuda_library_entry[j].name))
       {
-        LOGGER(5, "Match hook %s", symbol);
-        *pfn = cuda_hooks_entry[i].fn_ptr;
+        g_hook_originals[i] = cuda_library_entry[j].fn_ptr;
         break;
       }
     }
   }
+}
+
+static int hook_by_name(const char *symbol)
+{
+  int i;
+
+  for (i = 0; i < cuda_hook_nums; i++)
+  {
+    if (!strcmp(symbol, cuda_hooks_entry[i].name))
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Hook of what the driver resolved symbol to. cudart asks for base names,
+ * "cuMemcpyHtoD", and the driver picks the _v2 or per-thread function,
+ * which has to be hooked as well. A name is only guessed when the pointer
+ * is none of the exports the library knows
+ *
+ * @return index in cuda_hooks_entry, -1 when it's not hooked
+ */
+static int hook_of(const char *symbol, void *resolved, cuuint64_t flags)
+{
+  static const char *per_thread[] = {"_v2_ptds", "_ptds", "_v2_ptsz",
+                                     "_ptsz"};
+  char name[128];
+  unsigned int j;
+  int i;
+
+  pthread_once(&g_hook_originals_set, load_hook_originals);
+  for (i = 0; i < cuda_hook_nums; i++)
+  {
+    if (g_hook_originals[i] && g_hook_originals[i] == resolved)
+    {
+      return i;
+    }
+  }
+
+  // an export which isn't hooked keeps its own ABI, a variant of another
+  // name may not share it
+  if (resolved)
+  {
+    for (i = 0; i < CUDA_ENTRY_END; i++)
+    {
+      if (cuda_library_entry[i].fn_ptr == resolved)
+      {
+        return -1;
+      }
+    }
+  }
+
+  // the driver handed out a pointer which isn't a known export, the name of
+  // the variant it would pick is guessed from the flags
+  if (flags & CU_GET_PROC_ADDRESS_PER_THREAD_DEFAULT_STREAM)
+  {
+    for (j = 0; j < sizeof(per_thread) / sizeof(per_thread[0]); j++)
+    {
+      snprintf(name, sizeof(name), "%s%s", symbol, per_thread[j]);
+      if ((i = hook_by_name(name)) >= 0)
+      {
+        return i;
+      }
+    }
+  }
+  snprintf(name, sizeof(name), "%s_v2", symbol);
+  if ((i = hook_by_name(name)) >= 0)
+  {
+    return i;
+  }
+
+  return hook_by_name(symbol);
+}
+
+CUresult cuGetProcAddress(const char *symbol, void **pfn, int cudaVersion,
+                          cuuint64_t flags)
+{
+  CUresult ret;
+  int i;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuGetProcAddress, symbol, pfn,
+                        cudaVersion, flags);
+  if (ret == CUDA_SUCCESS && (i = hook_of(symbol, *pfn, flags)) >= 0)
+  {
+    LOGGER(5, "Match hook %s for %s", cuda_hooks_entry[i].name, symbol);
+    *pfn = cuda_hooks_entry[i].fn_ptr;
+  }
 
   return ret;
 }
@@ -0,0 +1,316 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+#include "include/nvml-helper.h"
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << 26)
+#endif
+
+/** memory policy modes of mbind(2), numaif.h isn't always installed */
+#define MPOL_PREFERRED (1)
+
+#define NUMA_MASK_BITS (8 * sizeof(unsigned long))
+
+extern entry_t cuda_library_entry[];
+extern entry_t nvml_library_entry[];
+extern resource_data_t g_anycuda_config;
+extern device_info g_devices_info[16];
+extern int g_device_count;
+
+void get_uuid_str(char *dest, CUuuid *src);
+
+static int g_numa_node[MAX_DEVICES];
+
+static pthread_once_t g_numa_set = PTHREAD_ONCE_INIT;
+
+static int read_int_file(const char *path, int *value)
+{
+  FILE *fp = fopen(path, "r");
+  int ret = 1;
+
+  if (fp == NULL)
+  {
+    return 1;
+  }
+  if (fscanf(fp, "%d", value) == 1)
+  {
+    ret = 0;
+  }
+  fclose(fp);
+
+  return ret;
+}
+
+/**
+ * Node of the device from the numa_node attribute of its PCI function
+ */
+static int sysfs_numa_node(CUdevice device)
+{
+  char bus_id[32] = "";
+  char path[FILENAME_MAX];
+  char *p;
+  int node = -1;
+
+  if (CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceGetPCIBusId, bus_id,
+                      (int)sizeof(bus_id), device) != CUDA_SUCCESS)
+  {
+    return -1;
+  }
+  // the driver reports upper case hex digits, sysfs uses lower case
+  for (p = bus_id; *p; p++)
+  {
+    *p = tolower(*p);
+  }
+  snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/numa_node", bus_id);
+  if (read_int_file(path, &node))
+  {
+    return -1;
+  }
+
+  return node;
+}
+
+/**
+ * Node of the first cpu NVML reports close to the device
+ */
+static int nvml_numa_node(int index)
+{
+  unsigned long cpus[HOST_NUMA_NODES / NUMA_MASK_BITS];
+  char path[FILENAME_MAX];
+  char uuid_str[48] = "";
+  struct dirent *ent;
+  nvmlDevice_t dev;
+  DIR *dir;
+  int node = -1, cpu = -1;
+  unsigned int i;
+
+  if (!NVML_FIND_ENTRY(nvml_library_entry, nvmlDeviceGetCpuAffinity))
+  {
+    return -1;
+  }
+  get_uuid_str(uuid_str, &g_devices_info[index].uuid);
+  if (NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetHandleByUUID, uuid_str,
+                      &dev) != NVML_SUCCESS)
+  {
+    return -1;
+  }
+  memset(cpus, 0, sizeof(cpus));
+  if (NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetCpuAffinity, dev,
+                      (unsigned int)(sizeof(cpus) / sizeof(cpus[0])),
+                      cpus) != NVML_SUCCESS)
+  {
+    return -1;
+  }
+  for (i = 0; i < sizeof(cpus) / sizeof(cpus[0]) && cpu < 0; i++)
+  {
+    if (cpus[i])
+    {
+      cpu = i * NUMA_MASK_BITS + __builtin_ctzl(cpus[i]);
+    }
+  }
+  if (cpu < 0)
+  {
+    return -1;
+  }
+
+  // the cpu directory links to its node as nodeN
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  dir = opendir(path);
+  if (dir == NULL)
+  {
+    return -1;
+  }
+  while ((ent = readdir(dir)) != NULL)
+  {
+    if (strncmp(ent->d_name, "node", 4) == 0 && isdigit(ent->d_name[4]))
+    {
+      node = atoi(ent->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+
+  return node;
+}
+
+static void load_numa_nodes()
+{
+  int i;
+
+  for (i = 0; i < MAX_DEVICES; i++)
+  {
+    g_numa_node[i] = -1;
+    if (i >= g_device_count)
+    {
+      continue;
+    }
+    g_numa_node[i] = sysfs_numa_node(g_devices_info[i].device);
+    if (g_numa_node[i] < 0)
+    {
+      g_numa_node[i] = nvml_numa_node(i);
+    }
+    if (g_numa_node[i] >= HOST_NUMA_NODES)
+    {
+      g_numa_node[i] = -1;
+    }
+    LOGGER(VERBOSE, "device %d is close to numa node %d", i, g_numa_node[i]);
+  }
+}
+
+int host_numa_node(CUdevice ordinal)
+{
+  if (ordinal < 0 || ordinal >= MAX_DEVICES)
+  {
+    return -1;
+  }
+  pthread_once(&g_numa_set, load_numa_nodes);
+
+  return g_numa_node[ordinal];
+}
+
+/**
+ * Prefer node for the pages of [addr, addr + len), pages already placed
+ * stay where they are
+ */
+static void numa_prefer(void *addr, size_t len, int node)
+{
+  unsigned long mask[HOST_NUMA_NODES / NUMA_MASK_BITS];
+
+  memset(mask, 0, sizeof(mask));
+  mask[node / NUMA_MASK_BITS] = 1UL << (node % NUMA_MASK_BITS);
+  // preferred instead of bind, a full node must not get the pod killed
+  if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, HOST_NUMA_NODES + 1,
+              0))
+  {
+    LOGGER(VERBOSE, "can't prefer node %d for %p, error %s", node, addr,
+           strerror(errno));
+  }
+}
+
+void host_numa_bind(CUdeviceptr base, size_t size, CUdevice ordinal)
+{
+  int node = host_numa_node(ordinal);
+
+  if (node < 0)
+  {
+    return;
+  }
+  numa_prefer((void *)(uintptr_t)base, size, node);
+}
+
+/**
+ * Length mapped for size bytes, large buffers are rounded to whole huge
+ * pages whatever the mode, so the length is known again at free
+ */
+static size_t host_spill_length(size_t size)
+{
+  if (size >= HOST_HUGE_PAGE_SIZE)
+  {
+    return ROUND_UP(size, HOST_HUGE_PAGE_SIZE);
+  }
+
+  return ROUND_UP(size, (size_t)sysconf(_SC_PAGESIZE));
+}
+
+CUresult host_spill_alloc(void **host, size_t size, CUdevice ordinal)
+{
+  size_t length = host_spill_length(size);
+  int huge = g_anycuda_config.host_huge_pages;
+  int node = host_numa_node(ordinal);
+  void *addr = MAP_FAILED;
+  CUresult ret;
+
+  if (length >= HOST_HUGE_PAGE_SIZE && huge == HOST_HUGE_PAGES_EXPLICIT)
+  {
+    addr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1,
+                0);
+    if (addr == MAP_FAILED)
+    {
+      LOGGER(VERBOSE, "no huge page reserved for %zu bytes, error %s", length,
+             strerror(errno));
+    }
+  }
+  if (addr == MAP_FAILED)
+  {
+    addr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+      return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+    if (length >= HOST_HUGE_PAGE_SIZE && huge != HOST_HUGE_PAGES_NONE)
+    {
+      madvise(addr, length, MADV_HUGEPAGE);
+    }
+  }
+  // the policy is set before registration faults the pages in
+  if (node >= 0)
+  {
+    numa_prefer(addr, length, node);
+  }
+
+  // the pages are locked like any the pod pins itself
+  if (pinned_charge(length))
+  {
+    LOGGER(WARNING, "%zu bytes over the pinned limit", length);
+    munmap(addr, length);
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostRegister_v2, addr,
+                        length,
+                        CU_MEMHOSTREGISTER_PORTABLE |
+                            CU_MEMHOSTREGISTER_DEVICEMAP);
+  if (ret != CUDA_SUCCESS)
+  {
+    pinned_uncharge(length);
+    munmap(addr, length);
+    return ret;
+  }
+  *host = addr;
+
+  return CUDA_SUCCESS;
+}
+
+CUresult host_spill_free(void *host, size_t size)
+{
+  CUresult ret;
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemHostUnregister, host);
+  if (ret != CUDA_SUCCESS)
+  {
+    return ret;
+  }
+  pinned_uncharge(host_spill_length(size));
+  munmap(host, host_spill_length(size));
+
+  return CUDA_SUCCESS;
+}
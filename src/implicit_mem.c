@@ -0,0 +1,343 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Device memory no allocation accounts for: contexts, module images, limits
+// and local memory. Footprints are measured as the drop of free memory
+// around the driver call, local memory is estimated from the kernels
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+#include "include/nvml-helper.h"
+
+/**
+ * A context is charged under its handle, its limits and local memory under
+ * the next keys, handles being at least 8 bytes aligned
+ */
+#define CTX_KEY(ctx) ((uint64_t)(uintptr_t)(ctx))
+#define LIMIT_KEY(ctx, limit) (CTX_KEY(ctx) + 1 + (limit))
+#define LOCAL_KEY(ctx) LIMIT_KEY(ctx, CU_LIMIT_MALLOC_HEAP_SIZE + 1)
+
+extern entry_t cuda_library_entry[];
+extern entry_t nvml_library_entry[];
+extern device_info g_devices_info[16];
+
+void get_uuid_str(char *dest, CUuuid *src);
+
+/** retains of primary contexts made through the hooks */
+static struct
+{
+  int refs;
+  CUcontext ctx;
+} g_primary[MAX_DEVICES];
+
+static pthread_mutex_t g_primary_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** functions whose local memory was estimated */
+static CUfunction g_launched[IMPLICIT_FUNC_CACHE];
+
+/** threads a device runs at once, 0 until asked */
+static size_t g_resident_threads[MAX_DEVICES];
+
+/**
+ * Free memory of device, from the current context when by_context is set
+ * since it's the cheapest, otherwise from NVML
+ *
+ * @return 0 -> measured
+ */
+static int device_free(int device, int by_context, size_t *free)
+{
+  char uuid_str[48] = "";
+  nvmlDevice_t dev;
+  nvmlMemory_t mem;
+  size_t total;
+
+  if (by_context)
+  {
+    return CUDA_ENTRY_CALL(cuda_library_entry, cuMemGetInfo_v2, free,
+                           &total) != CUDA_SUCCESS;
+  }
+
+  get_uuid_str(uuid_str, &g_devices_info[device].uuid);
+  if (NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetHandleByUUID, uuid_str,
+                      &dev) != NVML_SUCCESS ||
+      NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetMemoryInfo, dev,
+                      &mem) != NVML_SUCCESS)
+  {
+    return 1;
+  }
+  *free = mem.free;
+
+  return 0;
+}
+
+void implicit_begin(implicit_probe_t *probe, int device)
+{
+  CUdevice current;
+
+  probe->device = -1;
+  probe->by_context =
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &current) ==
+      CUDA_SUCCESS;
+  if (device < 0 && probe->by_context)
+  {
+    device = current;
+  }
+  // a context on another device can't tell the free memory of this one
+  probe->by_context = probe->by_context && current == device;
+  if (device < 0 || device >= MAX_DEVICES ||
+      device_free(device, probe->by_context, &probe->free))
+  {
+    return;
+  }
+  probe->charged = ledger_charged(device);
+  probe->device = device;
+}
+
+void implicit_end(implicit_probe_t *probe, uint64_t key)
+{
+  ledger_entry_t entry = {.size = 0, .tag = 0};
+  int64_t taken, charged;
+  size_t free;
+
+  if (probe->device < 0 ||
+      device_free(probe->device, probe->by_context, &free))
+  {
+    return;
+  }
+  // allocations recorded meanwhile by other threads are charged already
+  charged = (int64_t)ledger_charged(probe->device) - (int64_t)probe->charged;
+  taken = (int64_t)probe->free - (int64_t)free - charged;
+  ledger_find_implicit(key, &entry);
+  if (taken == 0 || (taken < 0 && entry.size == 0))
+  {
+    return;
+  }
+  if (taken < 0 && (size_t)-taken > entry.size)
+  {
+    taken = -(int64_t)entry.size;
+  }
+  ledger_set_implicit(key, entry.tag, entry.size + taken, probe->device);
+  LOGGER(VERBOSE, "footprint of 0x%" PRIx64 " on device %d is %zu bytes",
+         key, probe->device, (size_t)(entry.size + taken));
+}
+
+void implicit_forget_context(CUcontext ctx)
+{
+  uint64_t key;
+
+  for (key = CTX_KEY(ctx); key <= LOCAL_KEY(ctx); key++)
+  {
+    ledger_del_implicit(key);
+  }
+}
+
+int implicit_primary_retain(int device)
+{
+  int first;
+
+  if (device < 0 || device >= MAX_DEVICES)
+  {
+    return 0;
+  }
+  pthread_mutex_lock(&g_primary_lock);
+  first = g_primary[device].refs++ == 0;
+  pthread_mutex_unlock(&g_primary_lock);
+
+  return first;
+}
+
+void implicit_primary_retained(int device, CUcontext ctx)
+{
+  if (device < 0 || device >= MAX_DEVICES)
+  {
+    return;
+  }
+  pthread_mutex_lock(&g_primary_lock);
+  if (ctx == NULL)
+  {
+    g_primary[device].refs--;
+  }
+  else
+  {
+    g_primary[device].ctx = ctx;
+  }
+  pthread_mutex_unlock(&g_primary_lock);
+}
+
+CUcontext implicit_primary_release(int device)
+{
+  CUcontext ctx = NULL;
+
+  if (device < 0 || device >= MAX_DEVICES)
+  {
+    return NULL;
+  }
+  pthread_mutex_lock(&g_primary_lock);
+  if (g_primary[device].refs > 0 && --g_primary[device].refs == 0)
+  {
+    ctx = g_primary[device].ctx;
+    g_primary[device].ctx = NULL;
+  }
+  pthread_mutex_unlock(&g_primary_lock);
+
+  if (ctx)
+  {
+    implicit_forget_context(ctx);
+  }
+
+  return ctx;
+}
+
+CUcontext implicit_primary_context(int device)
+{
+  CUcontext ctx;
+
+  if (device < 0 || device >= MAX_DEVICES)
+  {
+    return NULL;
+  }
+  pthread_mutex_lock(&g_primary_lock);
+  ctx = g_primary[device].ctx;
+  pthread_mutex_unlock(&g_primary_lock);
+
+  return ctx;
+}
+
+CUresult implicit_set_limit(CUlimit limit, size_t value)
+{
+  ledger_entry_t entry = {.size = 0};
+  implicit_probe_t probe;
+  CUcontext ctx = NULL;
+  CUdevice device;
+  size_t old = 0;
+  int64_t size;
+  CUresult ret;
+
+  if (limit > CU_LIMIT_MALLOC_HEAP_SIZE ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetCurrent, &ctx) !=
+          CUDA_SUCCESS ||
+      ctx == NULL ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device) !=
+          CUDA_SUCCESS)
+  {
+    return CUDA_ENTRY_CALL(cuda_library_entry, cuCtxSetLimit, limit, value);
+  }
+
+  // the stack is resized for every resident thread at once
+  if (limit == CU_LIMIT_STACK_SIZE)
+  {
+    implicit_begin(&probe, device);
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxSetLimit, limit, value);
+    if (ret == CUDA_SUCCESS)
+    {
+      implicit_end(&probe, LIMIT_KEY(ctx, limit));
+    }
+
+    return ret;
+  }
+
+  // the heap and the printf FIFO are only allocated by the next launch, the
+  // growth asked for is charged
+  CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetLimit, &old, limit);
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxSetLimit, limit, value);
+  if (ret != CUDA_SUCCESS)
+  {
+    return ret;
+  }
+  ledger_find_implicit(LIMIT_KEY(ctx, limit), &entry);
+  size = (int64_t)entry.size + (int64_t)value - (int64_t)old;
+  ledger_set_implicit(LIMIT_KEY(ctx, limit), 0, size > 0 ? (size_t)size : 0,
+                      device);
+
+  return CUDA_SUCCESS;
+}
+
+static size_t resident_threads(CUdevice device)
+{
+  int sms = 0, threads = 0;
+
+  if (g_resident_threads[device] == 0 &&
+      CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceGetAttribute, &sms,
+                      CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT,
+                      device) == CUDA_SUCCESS &&
+      CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceGetAttribute, &threads,
+                      CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_MULTIPROCESSOR,
+                      device) == CUDA_SUCCESS)
+  {
+    g_resident_threads[device] = (size_t)sms * threads;
+  }
+
+  return g_resident_threads[device];
+}
+
+void implicit_launch(CUfunction f)
+{
+  unsigned int slot = ((uintptr_t)f >> 4) & (IMPLICIT_FUNC_CACHE - 1);
+  ledger_entry_t entry = {.size = 0};
+  size_t per_thread = 0;
+  CUcontext ctx = NULL;
+  CUdevice device;
+  int local = 0;
+
+  // a racy check is fine, at worst a function is estimated twice
+  if (g_launched[slot] == f)
+  {
+    return;
+  }
+  g_launched[slot] = f;
+
+  if (CUDA_ENTRY_CALL(cuda_library_entry, cuFuncGetAttribute, &local,
+                      CU_FUNC_ATTRIBUTE_LOCAL_SIZE_BYTES, f) != CUDA_SUCCESS ||
+      local <= 0 ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetCurrent, &ctx) !=
+          CUDA_SUCCESS ||
+      ctx == NULL ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device) !=
+          CUDA_SUCCESS ||
+      device < 0 || device >= MAX_DEVICES)
+  {
+    return;
+  }
+
+  // the driver keeps local memory for the largest need seen so far, which
+  // starts at the stack every context has
+  if (ledger_find_implicit(LOCAL_KEY(ctx), &entry) == 0)
+  {
+    per_thread = entry.tag;
+  }
+  else
+  {
+    CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetLimit, &per_thread,
+                    CU_LIMIT_STACK_SIZE);
+  }
+  if ((size_t)local <= per_thread)
+  {
+    return;
+  }
+  ledger_set_implicit(LOCAL_KEY(ctx), local,
+                      entry.size + ((size_t)local - per_thread) *
+                                       resident_threads(device),
+                      device);
+  LOGGER(VERBOSE, "local memory of %p grows to %d bytes per thread", ctx,
+         local);
+}
@@ -0,0 +1,358 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Kernel cost model: some launches are bracketed by a pair of events on
+// their stream, the GPU time between them feeds a moving average per
+// function and grid shape. Events come from a pool and are read back by the
+// watcher thread, a launch never waits for one
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+
+extern entry_t cuda_library_entry[];
+
+struct kernel_sample_st
+{
+  CUevent start;
+  CUevent end;
+  CUcontext ctx;
+  CUfunction f;
+  unsigned int blocks;
+  unsigned int threads;
+  CUstream stream;
+  int per_thread;
+  struct kernel_sample_st *next;
+};
+
+/**
+ * Average GPU time of a function launched with a grid shape, 0 until one
+ * launch was timed
+ */
+typedef struct
+{
+  CUfunction f;
+  unsigned int blocks;
+  unsigned int threads;
+  volatile int64_t ns;
+} kernel_cost_t;
+
+static kernel_cost_t g_costs[KERNEL_COST_CACHE];
+
+/** pairs of events ready to be recorded, and recorded ones not read yet */
+static kernel_sample_t *g_idle = NULL;
+static kernel_sample_t *g_pending = NULL;
+static int g_sample_count = 0;
+
+static pthread_mutex_t g_sample_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int g_launches = 0;
+
+static unsigned int cost_slot(CUfunction f, unsigned int blocks,
+                              unsigned int threads)
+{
+  uint64_t h = ((uintptr_t)f >> 4) * 0x9E3779B97F4A7C15ULL;
+
+  h ^= ((uint64_t)blocks << 20) ^ threads;
+  h *= 0x9E3779B97F4A7C15ULL;
+
+  return (unsigned int)(h >> 32) & (KERNEL_COST_CACHE - 1);
+}
+
+int64_t kernel_cost_predict(CUfunction f, unsigned int blocks,
+                            unsigned int threads)
+{
+  kernel_cost_t *c = &g_costs[cost_slot(f, blocks, threads)];
+
+  // a racy read is fine, at worst one launch is priced by another shape
+  if (c->f != f || c->blocks != blocks || c->threads != threads)
+  {
+    return 0;
+  }
+
+  return c->ns;
+}
+
+static void sample_destroy(kernel_sample_t *s)
+{
+  CUDA_ENTRY_CALL(cuda_library_entry, cuEventDestroy_v2, s->start);
+  CUDA_ENTRY_CALL(cuda_library_entry, cuEventDestroy_v2, s->end);
+  free(s);
+  __sync_fetch_and_sub(&g_sample_count, 1);
+}
+
+/**
+ * Take a pair of events of ctx from the pool, or create one while fewer
+ * than KERNEL_COST_EVENTS pairs exist
+ */
+static kernel_sample_t *sample_get(CUcontext ctx)
+{
+  kernel_sample_t **prev, *s = NULL;
+
+  pthread_mutex_lock(&g_sample_lock);
+  for (prev = &g_idle; *prev; prev = &(*prev)->next)
+  {
+    if ((*prev)->ctx == ctx)
+    {
+      s = *prev;
+      *prev = s->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_sample_lock);
+  if (s)
+  {
+    return s;
+  }
+
+  if (__sync_fetch_and_add(&g_sample_count, 1) >= KERNEL_COST_EVENTS)
+  {
+    __sync_fetch_and_sub(&g_sample_count, 1);
+    return NULL;
+  }
+  s = calloc(1, sizeof(kernel_sample_t));
+  if (unlikely(!s))
+  {
+    __sync_fetch_and_sub(&g_sample_count, 1);
+    return NULL;
+  }
+  if (CUDA_ENTRY_CALL(cuda_library_entry, cuEventCreate, &s->start,
+                      CU_EVENT_DEFAULT) != CUDA_SUCCESS)
+  {
+    free(s);
+    __sync_fetch_and_sub(&g_sample_count, 1);
+    return NULL;
+  }
+  if (CUDA_ENTRY_CALL(cuda_library_entry, cuEventCreate, &s->end,
+                      CU_EVENT_DEFAULT) != CUDA_SUCCESS)
+  {
+    CUDA_ENTRY_CALL(cuda_library_entry, cuEventDestroy_v2, s->start);
+    free(s);
+    __sync_fetch_and_sub(&g_sample_count, 1);
+    return NULL;
+  }
+  s->ctx = ctx;
+
+  return s;
+}
+
+static void sample_put(kernel_sample_t *s, kernel_sample_t **list)
+{
+  pthread_mutex_lock(&g_sample_lock);
+  s->next = *list;
+  *list = s;
+  pthread_mutex_unlock(&g_sample_lock);
+}
+
+static CUresult sample_record(kernel_sample_t *s, CUevent event)
+{
+  if (s->per_thread)
+  {
+    return CUDA_ENTRY_CALL(cuda_library_entry, cuEventRecord_ptsz, event,
+                           s->stream);
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuEventRecord, event, s->stream);
+}
+
+kernel_sample_t *kernel_cost_begin(CUfunction f, unsigned int blocks,
+                                   unsigned int threads, CUstream hStream,
+                                   int per_thread)
+{
+  CUstreamCaptureStatus status = CU_STREAM_CAPTURE_STATUS_NONE;
+  CUcontext ctx = NULL;
+  kernel_sample_t *s;
+  CUresult ret;
+
+  // shapes never timed are always sampled, the others once in a while
+  if (__sync_fetch_and_add(&g_launches, 1) % KERNEL_COST_SAMPLE != 0 &&
+      kernel_cost_predict(f, blocks, threads) > 0)
+  {
+    return NULL;
+  }
+
+  // an event recorded while capturing would become a node of the graph
+  if (per_thread)
+  {
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuStreamIsCapturing_ptsz,
+                          hStream, &status);
+  }
+  else
+  {
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuStreamIsCapturing, hStream,
+                          &status);
+  }
+  if (ret != CUDA_SUCCESS || status != CU_STREAM_CAPTURE_STATUS_NONE ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetCurrent, &ctx) !=
+          CUDA_SUCCESS ||
+      ctx == NULL)
+  {
+    return NULL;
+  }
+
+  s = sample_get(ctx);
+  if (s == NULL)
+  {
+    return NULL;
+  }
+  s->f = f;
+  s->blocks = blocks;
+  s->threads = threads;
+  s->stream = hStream;
+  s->per_thread = per_thread;
+
+  return s;
+}
+
+kernel_sample_t *kernel_cost_start(kernel_sample_t *sample)
+{
+  if (sample == NULL)
+  {
+    return NULL;
+  }
+  // the context of a pooled pair may have been torn down and its handle
+  // reused, the pair is dropped when it can't be recorded
+  if (sample_record(sample, sample->start) != CUDA_SUCCESS)
+  {
+    sample_destroy(sample);
+    return NULL;
+  }
+
+  return sample;
+}
+
+void kernel_cost_end(kernel_sample_t *sample, CUresult launched)
+{
+  if (sample == NULL)
+  {
+    return;
+  }
+  if (launched != CUDA_SUCCESS)
+  {
+    sample_put(sample, &g_idle);
+    return;
+  }
+  if (sample_record(sample, sample->end) != CUDA_SUCCESS)
+  {
+    sample_destroy(sample);
+    return;
+  }
+  sample_put(sample, &g_pending);
+}
+
+/**
+ * Fold a measured time into the average of the shape of s
+ */
+static void cost_update(kernel_sample_t *s, int64_t ns)
+{
+  kernel_cost_t *c = &g_costs[cost_slot(s->f, s->blocks, s->threads)];
+
+  if (c->f != s->f || c->blocks != s->blocks || c->threads != s->threads ||
+      c->ns == 0)
+  {
+    c->ns = 0;
+    c->f = s->f;
+    c->blocks = s->blocks;
+    c->threads = s->threads;
+    c->ns = ns > 0 ? ns : 1;
+    return;
+  }
+  c->ns += (ns - c->ns) / KERNEL_COST_WEIGHT;
+  if (c->ns <= 0)
+  {
+    c->ns = 1;
+  }
+}
+
+void kernel_cost_harvest()
+{
+  kernel_sample_t *pending, *s, *keep = NULL;
+  float ms;
+  CUresult ret;
+
+  pthread_mutex_lock(&g_sample_lock);
+  pending = g_pending;
+  g_pending = NULL;
+  pthread_mutex_unlock(&g_sample_lock);
+
+  while (pending)
+  {
+    s = pending;
+    pending = s->next;
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuEventQuery, s->end);
+    if (ret == CUDA_ERROR_NOT_READY)
+    {
+      s->next = keep;
+      keep = s;
+      continue;
+    }
+    if (ret != CUDA_SUCCESS ||
+        CUDA_ENTRY_CALL(cuda_library_entry, cuEventElapsedTime, &ms, s->start,
+                        s->end) != CUDA_SUCCESS)
+    {
+      sample_destroy(s);
+      continue;
+    }
+    cost_update(s, (int64_t)(ms * MILLISEC));
+    sample_put(s, &g_idle);
+  }
+
+  while (keep)
+  {
+    s = keep;
+    keep = s->next;
+    sample_put(s, &g_pending);
+  }
+}
+
+void kernel_cost_forget_context(CUcontext ctx)
+{
+  kernel_sample_t **lists[] = {&g_idle, &g_pending};
+  kernel_sample_t **prev, *s, *dead = NULL;
+  unsigned int i;
+
+  pthread_mutex_lock(&g_sample_lock);
+  for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++)
+  {
+    prev = lists[i];
+    while (*prev)
+    {
+      s = *prev;
+      if (s->ctx != ctx)
+      {
+        prev = &s->next;
+        continue;
+      }
+      *prev = s->next;
+      s->next = dead;
+      dead = s;
+    }
+  }
+  pthread_mutex_unlock(&g_sample_lock);
+
+  while (dead)
+  {
+    s = dead;
+    dead = s->next;
+    sample_destroy(s);
+  }
+}
@@ -566,6 +566,7 @@ entry_t cuda_library_entry[] = {
     {.name = "cuUserObjectCreate"},
     {.name = "cuUserObjectRelease"},
     {.name = "cuUserObjectRetain"},
+    {.name = "cuFuncGetParamInfo"},
 };
 
 entry_t nvml_library_entry[] = {
@@ -851,6 +852,18 @@ resource_data_t g_anycuda_config = {
     .gpu_count = 0,
     .gpu_mem_limit_valid = 0,
     .gpu_mem_limit = {0},
+    .sample_interval = DEFAULT_SAMPLE_INTERVAL,
+    .over_limit_policy = OVER_LIMIT_MANAGED,
+    .over_limit_fallback = OVER_LIMIT_OOM,
+    .over_limit_timeout = DEFAULT_OVER_LIMIT_TIMEOUT,
+    .peer_spill = 1,
+    .host_huge_pages = HOST_HUGE_PAGES_TRANSPARENT,
+    .pinned_limit = (size_t)-1,
+    .pinned_fallback = 0,
+    .utilization = MAX_UTILIZATION,
+    .utilization_limit = 0,
+    .max_inflight_kernels = 0,
+    .max_inflight_ms = 0,
     .valid = 0,
 };
 
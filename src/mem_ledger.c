@@ -0,0 +1,608 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "include/hijack.h"
+
+/** allocations made by this process, keyed by device pointer */
+static ledger_table_t g_alloc_table = LEDGER_TABLE_INITIALIZER;
+
+/** physical memory of the VMM API keyed by handle, the tag counts the
+ * references to it */
+static ledger_table_t g_handle_table = LEDGER_TABLE_INITIALIZER;
+
+/** mappings of VMM handles keyed by address, the tag is the handle */
+static ledger_table_t g_mapping_table = LEDGER_TABLE_INITIALIZER;
+
+/** memory the driver takes for contexts, modules and limits, keyed by
+ * handle */
+static ledger_table_t g_implicit_table = LEDGER_TABLE_INITIALIZER;
+
+/** bytes charged by this process on each device */
+static size_t g_ledger_charged[MAX_DEVICES];
+
+/** bytes charged plus bytes reserved for allocations in flight by this
+ * process, one word for reservations to check against */
+static size_t g_ledger_total[MAX_DEVICES];
+
+/** pod usage which is not seen by the ledgers, measured by NVML */
+static int64_t g_ledger_offset[MAX_DEVICES];
+
+/** futex words of this process when usage is not shared */
+static volatile uint32_t g_ledger_free_seq[MAX_DEVICES];
+static volatile uint32_t g_ledger_waiters[MAX_DEVICES];
+
+static inline unsigned int ledger_hash(uint64_t key)
+{
+  return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 52) &
+         (LEDGER_BUCKETS - 1);
+}
+
+/**
+ * Whether entries of kind take device memory from the pod quota
+ */
+static inline int ledger_charges(int kind)
+{
+  return kind == LEDGER_DEVICE || kind == LEDGER_SPLIT ||
+         kind == LEDGER_HANDLE || kind == LEDGER_IMPLICIT ||
+         kind == LEDGER_ARRAY;
+}
+
+static inline pthread_mutex_t *ledger_lock(ledger_table_t *table,
+                                           unsigned int bucket)
+{
+  return &table->locks[bucket % LEDGER_LOCKS];
+}
+
+int ledger_table_insert(ledger_table_t *table, uint64_t key, uint64_t tag,
+                        size_t size, int device, int kind)
+{
+  unsigned int bucket = ledger_hash(key);
+  ledger_entry_t *entry = malloc(sizeof(ledger_entry_t));
+
+  if (unlikely(!entry))
+  {
+    return 1;
+  }
+  entry->key = key;
+  entry->tag = tag;
+  entry->size = size;
+  entry->device = device;
+  entry->kind = kind;
+
+  pthread_mutex_lock(ledger_lock(table, bucket));
+  entry->next = table->buckets[bucket];
+  table->buckets[bucket] = entry;
+  pthread_mutex_unlock(ledger_lock(table, bucket));
+
+  return 0;
+}
+
+int ledger_table_remove(ledger_table_t *table, uint64_t key,
+                        ledger_entry_t *entry)
+{
+  unsigned int bucket = ledger_hash(key);
+  ledger_entry_t **prev, *cur = NULL;
+
+  pthread_mutex_lock(ledger_lock(table, bucket));
+  for (prev = &table->buckets[bucket]; *prev; prev = &(*prev)->next)
+  {
+    if ((*prev)->key == key)
+    {
+      cur = *prev;
+      *prev = cur->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(ledger_lock(table, bucket));
+
+  if (!cur)
+  {
+    return 1;
+  }
+  if (entry)
+  {
+    memcpy(entry, cur, sizeof(ledger_entry_t));
+    entry->next = NULL;
+  }
+  free(cur);
+
+  return 0;
+}
+
+int ledger_table_lookup(ledger_table_t *table, uint64_t key,
+                        ledger_entry_t *entry)
+{
+  unsigned int bucket = ledger_hash(key);
+  ledger_entry_t *cur;
+  int ret = 1;
+
+  pthread_mutex_lock(ledger_lock(table, bucket));
+  for (cur = table->buckets[bucket]; cur; cur = cur->next)
+  {
+    if (cur->key == key)
+    {
+      if (entry)
+      {
+        memcpy(entry, cur, sizeof(ledger_entry_t));
+        entry->next = NULL;
+      }
+      ret = 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock(ledger_lock(table, bucket));
+
+  return ret;
+}
+
+/**
+ * Add delta to the reference count kept in the tag of key, the entry is
+ * removed once no reference is left
+ *
+ * @return 0 -> removed, 1 -> still referenced, -1 -> not found
+ */
+static int ledger_table_ref(ledger_table_t *table, uint64_t key, int delta,
+                            ledger_entry_t *entry)
+{
+  unsigned int bucket = ledger_hash(key);
+  ledger_entry_t **prev, *cur = NULL;
+  int ret = -1;
+
+  pthread_mutex_lock(ledger_lock(table, bucket));
+  for (prev = &table->buckets[bucket]; *prev; prev = &(*prev)->next)
+  {
+    if ((*prev)->key == key)
+    {
+      cur = *prev;
+      cur->tag += delta;
+      ret = 1;
+      if (cur->tag == 0)
+      {
+        *prev = cur->next;
+        ret = 0;
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(ledger_lock(table, bucket));
+
+  if (cur && entry)
+  {
+    memcpy(entry, cur, sizeof(ledger_entry_t));
+    entry->next = NULL;
+  }
+  if (ret == 0)
+  {
+    free(cur);
+  }
+
+  return ret;
+}
+
+/**
+ * Charge (positive) or uncharge (negative) bytes of device, uncharged quota
+ * wakes the threads waiting for it
+ */
+static void ledger_charge(int device, int64_t bytes)
+{
+  __sync_fetch_and_add(&g_ledger_charged[device], (size_t)bytes);
+  __sync_fetch_and_add(&g_ledger_total[device], (size_t)bytes);
+  pod_shm_charge(device, bytes);
+  if (bytes < 0)
+  {
+    ledger_wake(device);
+  }
+}
+
+static void ledger_add_tagged(uint64_t dptr, uint64_t tag, size_t size,
+                              int device, int kind)
+{
+  if (unlikely(device < 0 || device >= MAX_DEVICES))
+  {
+    return;
+  }
+  if (unlikely(ledger_table_insert(&g_alloc_table, dptr, tag, size, device,
+                                   kind)))
+  {
+    LOGGER(WARNING, "can't record allocation 0x%llx", dptr);
+    return;
+  }
+  if (ledger_charges(kind))
+  {
+    ledger_charge(device, (int64_t)size);
+  }
+}
+
+void ledger_add(uint64_t dptr, size_t size, int device, int kind)
+{
+  ledger_add_tagged(dptr, 0, size, device, kind);
+}
+
+void ledger_add_ipc(uint64_t dptr, int entry, size_t size, int device)
+{
+  ledger_add_tagged(dptr, (uint64_t)entry, size, device, LEDGER_IPC);
+}
+
+void ledger_add_mapped(uint64_t dptr, uint64_t host, size_t size, int device)
+{
+  ledger_add_tagged(dptr, host, size, device, LEDGER_HOSTMAPPED);
+}
+
+int ledger_find(uint64_t dptr, ledger_entry_t *entry)
+{
+  return ledger_table_lookup(&g_alloc_table, dptr, entry);
+}
+
+int ledger_del(uint64_t dptr, ledger_entry_t *entry)
+{
+  ledger_entry_t removed;
+
+  if (ledger_table_remove(&g_alloc_table, dptr, &removed))
+  {
+    return 1;
+  }
+  if (ledger_charges(removed.kind))
+  {
+    ledger_charge(removed.device, -(int64_t)removed.size);
+  }
+  if (entry)
+  {
+    memcpy(entry, &removed, sizeof(ledger_entry_t));
+  }
+
+  return 0;
+}
+
+size_t ledger_charged(int device)
+{
+  return __sync_fetch_and_add(&g_ledger_charged[device], 0);
+}
+
+/**
+ * Bytes charged by all processes of the pod when they share a usage segment,
+ * otherwise by this process only
+ */
+static size_t ledger_base(int device)
+{
+  size_t pod_used;
+
+  if (pod_shm_used(device, &pod_used) == 0)
+  {
+    return pod_used;
+  }
+
+  return __sync_fetch_and_add(&g_ledger_total[device], 0);
+}
+
+size_t ledger_used(int device)
+{
+  int64_t used = (int64_t)ledger_base(device) + g_ledger_offset[device];
+
+  return used > 0 ? (size_t)used : 0;
+}
+
+void ledger_reconcile(int device, size_t measured)
+{
+  int64_t offset = (int64_t)measured - (int64_t)ledger_base(device);
+  int64_t last = g_ledger_offset[device];
+  int64_t shared;
+
+  // IPC memory is charged once to its exporter, NVML may count it again for
+  // the processes mapping it
+  if (offset > 0)
+  {
+    shared = (int64_t)pod_shm_ipc_shared(device);
+    offset = offset > shared ? offset - shared : 0;
+  }
+  // allocations charged after NVML looked are not in measured, they'd be
+  // forgiven until the next sample
+  if (offset < 0)
+  {
+    offset = 0;
+  }
+  g_ledger_offset[device] = offset;
+  // memory freed outside the ledgers shows up here first
+  if (offset < last)
+  {
+    ledger_wake(device);
+  }
+  LOGGER(VERBOSE, "device %d reconciled, measured %zu, offset %" PRId64,
+         device, measured, g_ledger_offset[device]);
+}
+
+int ledger_reserve(int device, size_t bytes, size_t limit)
+{
+  int64_t headroom;
+  size_t total;
+  int ret;
+
+  if (unlikely(device < 0 || device >= MAX_DEVICES))
+  {
+    return 1;
+  }
+  if (limit >= (size_t)INT64_MAX)
+  {
+    headroom = INT64_MAX;
+  }
+  else
+  {
+    headroom = (int64_t)limit - g_ledger_offset[device];
+  }
+
+  ret = pod_shm_reserve(device, bytes, headroom);
+  if (ret >= 0)
+  {
+    return ret;
+  }
+
+  // usage is not shared, the same protocol runs on the process counters
+  do
+  {
+    total = g_ledger_total[device];
+    if ((int64_t)(total + bytes) > headroom)
+    {
+      return 1;
+    }
+  } while (!CAS(&g_ledger_total[device], total, total + bytes));
+
+  return 0;
+}
+
+int ledger_reserve_or_trim(int device, size_t bytes, size_t limit)
+{
+  if (ledger_reserve(device, bytes, limit) == 0)
+  {
+    return 0;
+  }
+  // idle memory of the slabs and the pools of device goes back before the
+  // request is refused
+  if (slab_trim(device, 1) + mem_pool_trim(device, bytes) == 0)
+  {
+    return 1;
+  }
+
+  return ledger_reserve(device, bytes, limit);
+}
+
+static void ledger_release(int device, size_t bytes)
+{
+  if (pod_shm_unreserve(device, bytes) < 0)
+  {
+    __sync_fetch_and_sub(&g_ledger_total[device], bytes);
+  }
+}
+
+void ledger_unreserve(int device, size_t bytes)
+{
+  if (unlikely(device < 0 || device >= MAX_DEVICES))
+  {
+    return;
+  }
+  ledger_release(device, bytes);
+  ledger_wake(device);
+}
+
+void ledger_commit(uint64_t dptr, size_t size, int device)
+{
+  // charge before releasing the reservation, so the pod never looks emptier
+  // than it is
+  ledger_add(dptr, size, device, LEDGER_DEVICE);
+  ledger_release(device, size);
+}
+
+void ledger_commit_split(uint64_t dptr, size_t head, size_t size, int device)
+{
+  ledger_add_tagged(dptr, size, head, device, LEDGER_SPLIT);
+  ledger_release(device, head);
+}
+
+void ledger_settle(uint64_t key, size_t size, size_t reserved, int device,
+                   int kind)
+{
+  ledger_add(key, size, device, kind);
+  // the estimate may have been larger, waiters get to try again
+  ledger_unreserve(device, reserved);
+}
+
+void ledger_adjust(int device, int64_t bytes, size_t reserved)
+{
+  if (unlikely(device < 0 || device >= MAX_DEVICES))
+  {
+    return;
+  }
+  if (bytes)
+  {
+    ledger_charge(device, bytes);
+  }
+  if (reserved)
+  {
+    ledger_release(device, reserved);
+  }
+}
+
+void ledger_commit_handle(uint64_t handle, size_t size, int device)
+{
+  // the handle holds a reference until it's released, every mapping another
+  if (unlikely(ledger_table_insert(&g_handle_table, handle, 1, size, device,
+                                   LEDGER_HANDLE)))
+  {
+    LOGGER(WARNING, "can't record handle 0x%llx", handle);
+  }
+  else
+  {
+    ledger_charge(device, (int64_t)size);
+  }
+  ledger_release(device, size);
+}
+
+void ledger_get_handle(uint64_t handle)
+{
+  // handles imported from other processes aren't recorded, nothing to hold
+  ledger_table_ref(&g_handle_table, handle, 1, NULL);
+}
+
+void ledger_put_handle(uint64_t handle)
+{
+  ledger_entry_t entry;
+
+  if (ledger_table_ref(&g_handle_table, handle, -1, &entry) == 0)
+  {
+    ledger_charge(entry.device, -(int64_t)entry.size);
+  }
+}
+
+int ledger_map_handle(uint64_t dptr, uint64_t handle, size_t size)
+{
+  ledger_entry_t entry;
+
+  // handles imported from other processes are charged to their exporter
+  if (ledger_table_ref(&g_handle_table, handle, 1, &entry) < 0)
+  {
+    return 1;
+  }
+  if (unlikely(ledger_table_insert(&g_mapping_table, dptr, handle, size,
+                                   entry.device, LEDGER_HANDLE)))
+  {
+    LOGGER(WARNING, "can't record mapping 0x%llx", dptr);
+    ledger_put_handle(handle);
+    return 1;
+  }
+
+  return 0;
+}
+
+void ledger_unmap(uint64_t dptr, size_t size)
+{
+  uint64_t end = dptr + size;
+  ledger_entry_t mapping;
+
+  // one range may cover several mappings placed back to back
+  while (dptr < end &&
+         ledger_table_remove(&g_mapping_table, dptr, &mapping) == 0)
+  {
+    ledger_put_handle(mapping.tag);
+    dptr += mapping.size;
+  }
+}
+
+void ledger_set_implicit(uint64_t key, uint64_t tag, size_t size,
+                         int device)
+{
+  ledger_entry_t old;
+  int64_t delta = (int64_t)size;
+
+  if (unlikely(device < 0 || device >= MAX_DEVICES))
+  {
+    return;
+  }
+  if (ledger_table_remove(&g_implicit_table, key, &old) == 0)
+  {
+    delta -= (int64_t)old.size;
+  }
+  if (size && unlikely(ledger_table_insert(&g_implicit_table, key, tag, size,
+                                           device, LEDGER_IMPLICIT)))
+  {
+    LOGGER(WARNING, "can't record footprint of 0x%llx", key);
+    delta -= (int64_t)size;
+  }
+  ledger_adjust(device, delta, 0);
+}
+
+int ledger_find_implicit(uint64_t key, ledger_entry_t *entry)
+{
+  return ledger_table_lookup(&g_implicit_table, key, entry);
+}
+
+void ledger_del_implicit(uint64_t key)
+{
+  ledger_entry_t old;
+
+  if (ledger_table_remove(&g_implicit_table, key, &old) == 0)
+  {
+    ledger_adjust(old.device, -(int64_t)old.size, 0);
+  }
+}
+
+/**
+ * Futex words of device, shared by the pod when the segment is attached
+ *
+ * @return futex operation flags matching the words
+ */
+static int ledger_wait_words(int device, volatile uint32_t **seq,
+                             volatile uint32_t **waiters)
+{
+  if (pod_shm_wait_words(device, seq, waiters) == 0)
+  {
+    return 0;
+  }
+  *seq = &g_ledger_free_seq[device];
+  *waiters = &g_ledger_waiters[device];
+
+  return FUTEX_PRIVATE_FLAG;
+}
+
+uint32_t ledger_free_seq(int device)
+{
+  volatile uint32_t *seq, *waiters;
+
+  ledger_wait_words(device, &seq, &waiters);
+
+  return __sync_fetch_and_add(seq, 0);
+}
+
+void ledger_wait(int device, uint32_t seq, uint64_t timeout_ms)
+{
+  volatile uint32_t *word, *waiters;
+  struct timespec timeout;
+  int flags;
+
+  flags = ledger_wait_words(device, &word, &waiters);
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * MILLISEC;
+
+  __sync_fetch_and_add(waiters, 1);
+  // returns at once with EAGAIN if quota was given back after seq was read
+  syscall(SYS_futex, word, FUTEX_WAIT | flags, seq, &timeout, NULL, 0);
+  __sync_fetch_and_sub(waiters, 1);
+}
+
+void ledger_wake(int device)
+{
+  volatile uint32_t *seq, *waiters;
+  int flags;
+
+  if (unlikely(device < 0 || device >= MAX_DEVICES))
+  {
+    return;
+  }
+  flags = ledger_wait_words(device, &seq, &waiters);
+  __sync_fetch_and_add(seq, 1);
+  // the sequence is bumped first, a waiter registering afterwards sees it
+  // change and doesn't sleep
+  if (__sync_fetch_and_add(waiters, 0))
+  {
+    syscall(SYS_futex, seq, FUTEX_WAKE | flags, INT_MAX, NULL, NULL, 0);
+  }
+}
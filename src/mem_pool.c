@@ -0,0 +1,312 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Stream ordered allocator accounting: a pool is charged for the memory it
+// keeps reserved, which only changes when it grows or is trimmed, not at
+// every allocation and free
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+
+extern entry_t cuda_library_entry[];
+extern resource_data_t g_anycuda_config;
+
+/**
+ * A pool and the bytes charged for it, graph memory of a device is recorded
+ * with a NULL pool
+ */
+typedef struct mem_pool_st
+{
+  CUmemoryPool pool;
+  int device;
+  size_t charged;
+  struct mem_pool_st *next;
+} mem_pool_t;
+
+static mem_pool_t *g_pools = NULL;
+
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t pool_limit(int device)
+{
+  if (!g_anycuda_config.valid || !g_anycuda_config.gpu_mem_limit_valid ||
+      device < 0 || device >= MAX_DEVICES)
+  {
+    return (size_t)-1;
+  }
+
+  return g_anycuda_config.gpu_mem_limit[device];
+}
+
+/**
+ * Find pool, or add it on device, with g_pool_lock held
+ */
+static mem_pool_t *pool_get(CUmemoryPool pool, int device)
+{
+  mem_pool_t *p;
+
+  for (p = g_pools; p; p = p->next)
+  {
+    if (p->pool == pool && (pool != NULL || p->device == device))
+    {
+      return p;
+    }
+  }
+  if (unlikely(device < 0 || device >= MAX_DEVICES))
+  {
+    return NULL;
+  }
+  p = calloc(1, sizeof(mem_pool_t));
+  if (unlikely(!p))
+  {
+    LOGGER(WARNING, "can't record pool %p", pool);
+    return NULL;
+  }
+  p->pool = pool;
+  p->device = device;
+  p->next = g_pools;
+  g_pools = p;
+
+  return p;
+}
+
+static int pool_attribute(mem_pool_t *p, int attr, uint64_t *value)
+{
+  if (p->pool == NULL)
+  {
+    return CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceGetGraphMemAttribute,
+                           p->device,
+                           attr == CU_MEMPOOL_ATTR_USED_MEM_CURRENT
+                               ? CU_GRAPH_MEM_ATTR_USED_MEM_CURRENT
+                               : CU_GRAPH_MEM_ATTR_RESERVED_MEM_CURRENT,
+                           value);
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolGetAttribute, p->pool,
+                         attr, value);
+}
+
+/**
+ * Charge the memory p keeps reserved and give back reservation, with
+ * g_pool_lock held
+ */
+static void pool_charge(mem_pool_t *p, size_t reservation)
+{
+  uint64_t reserved;
+  int64_t delta = 0;
+
+  if (pool_attribute(p, CU_MEMPOOL_ATTR_RESERVED_MEM_CURRENT, &reserved) ==
+      CUDA_SUCCESS)
+  {
+    delta = (int64_t)reserved - (int64_t)p->charged;
+    p->charged = reserved;
+  }
+  ledger_adjust(p->device, delta, reservation);
+}
+
+void mem_pool_register(CUmemoryPool pool, int device)
+{
+  pthread_mutex_lock(&g_pool_lock);
+  pool_get(pool, device);
+  pthread_mutex_unlock(&g_pool_lock);
+}
+
+void mem_pool_forget(CUmemoryPool pool)
+{
+  mem_pool_t **prev, *p = NULL;
+
+  pthread_mutex_lock(&g_pool_lock);
+  for (prev = &g_pools; *prev; prev = &(*prev)->next)
+  {
+    if ((*prev)->pool == pool)
+    {
+      p = *prev;
+      *prev = p->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_pool_lock);
+
+  if (p)
+  {
+    ledger_adjust(p->device, -(int64_t)p->charged, 0);
+    free(p);
+  }
+}
+
+int mem_pool_device(CUmemoryPool pool)
+{
+  mem_pool_t *p;
+  int device = -1;
+
+  pthread_mutex_lock(&g_pool_lock);
+  for (p = g_pools; p; p = p->next)
+  {
+    if (p->pool == pool)
+    {
+      device = p->device;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_pool_lock);
+
+  return device;
+}
+
+size_t mem_pool_trim(int device, size_t bytes)
+{
+  size_t limit = pool_limit(device);
+  size_t before, released = 0;
+  mem_pool_t *p;
+
+  pthread_mutex_lock(&g_pool_lock);
+  for (p = g_pools; p; p = p->next)
+  {
+    // other pools keep their idle memory once the request fits
+    if (ledger_used(device) + bytes <= limit)
+    {
+      break;
+    }
+    if (p->device != device)
+    {
+      continue;
+    }
+    before = p->charged;
+    if (p->pool == NULL)
+    {
+      if (CUDA_FIND_ENTRY(cuda_library_entry, cuDeviceGraphMemTrim) == NULL)
+      {
+        continue;
+      }
+      CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceGraphMemTrim, device);
+    }
+    else
+    {
+      if (CUDA_FIND_ENTRY(cuda_library_entry, cuMemPoolTrimTo) == NULL)
+      {
+        continue;
+      }
+      CUDA_ENTRY_CALL(cuda_library_entry, cuMemPoolTrimTo, p->pool, 0);
+    }
+    pool_charge(p, 0);
+    if (p->charged < before)
+    {
+      released += before - p->charged;
+    }
+  }
+  pthread_mutex_unlock(&g_pool_lock);
+
+  if (released)
+  {
+    LOGGER(VERBOSE, "trimmed %zu bytes of pools on device %d", released,
+           device);
+  }
+
+  return released;
+}
+
+int mem_pool_reserve(CUmemoryPool pool, int device, size_t bytesize,
+                     size_t *reservation)
+{
+  size_t bytes = ROUND_UP(bytesize, POOL_ALIGN);
+  uint64_t reserved = 0, used = 0;
+  size_t limit;
+  mem_pool_t *p;
+
+  *reservation = 0;
+  pthread_mutex_lock(&g_pool_lock);
+  p = pool_get(pool, device);
+  if (p)
+  {
+    device = p->device;
+    pool_charge(p, 0);
+    pool_attribute(p, CU_MEMPOOL_ATTR_RESERVED_MEM_CURRENT, &reserved);
+    pool_attribute(p, CU_MEMPOOL_ATTR_USED_MEM_CURRENT, &used);
+  }
+  pthread_mutex_unlock(&g_pool_lock);
+
+  // served from memory the pool already keeps, which is charged
+  if (reserved >= used + bytesize)
+  {
+    return 0;
+  }
+
+  limit = pool_limit(device);
+  if (ledger_reserve_or_trim(device, bytes, limit) != 0)
+  {
+    return 1;
+  }
+  *reservation = bytes;
+
+  return 0;
+}
+
+void mem_pool_commit(CUmemoryPool pool, int device, size_t reservation)
+{
+  mem_pool_t *p;
+
+  pthread_mutex_lock(&g_pool_lock);
+  p = pool_get(pool, device);
+  if (p)
+  {
+    pool_charge(p, reservation);
+  }
+  else
+  {
+    ledger_adjust(device, 0, reservation);
+  }
+  pthread_mutex_unlock(&g_pool_lock);
+}
+
+int mem_pool_graph_reserve(int device, size_t bytesize, size_t *reservation)
+{
+  size_t bytes = ROUND_UP(bytesize, POOL_ALIGN);
+  size_t limit = pool_limit(device);
+
+  *reservation = 0;
+  mem_pool_commit(NULL, device, 0);
+  // nothing to check, an unknown device is left to the driver
+  if (limit == (size_t)-1)
+  {
+    return 0;
+  }
+  if (ledger_reserve_or_trim(device, bytes, limit) != 0)
+  {
+    return 1;
+  }
+  *reservation = bytes;
+
+  return 0;
+}
+
+void mem_pool_sync()
+{
+  mem_pool_t *p;
+
+  pthread_mutex_lock(&g_pool_lock);
+  for (p = g_pools; p; p = p->next)
+  {
+    pool_charge(p, 0);
+  }
+  pthread_mutex_unlock(&g_pool_lock);
+}
@@ -0,0 +1,197 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+
+extern entry_t cuda_library_entry[];
+extern resource_data_t g_anycuda_config;
+extern device_info g_devices_info[16];
+extern int g_device_count;
+
+/** performance rank of the link between two devices, -1 without access */
+static int g_peer_rank[MAX_DEVICES][MAX_DEVICES];
+
+/** primary contexts retained to allocate on peers */
+static CUcontext g_peer_ctx[MAX_DEVICES];
+
+static pthread_once_t g_peer_set = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_peer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void load_peer_ranks()
+{
+  int access, rank;
+  int i, j;
+
+  for (i = 0; i < MAX_DEVICES; i++)
+  {
+    for (j = 0; j < MAX_DEVICES; j++)
+    {
+      g_peer_rank[i][j] = -1;
+      if (i == j || i >= g_device_count || j >= g_device_count)
+      {
+        continue;
+      }
+      access = 0;
+      if (CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceGetP2PAttribute,
+                          &access, CU_DEVICE_P2P_ATTRIBUTE_ACCESS_SUPPORTED,
+                          g_devices_info[i].device,
+                          g_devices_info[j].device) != CUDA_SUCCESS ||
+          !access)
+      {
+        continue;
+      }
+      rank = 0;
+      CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceGetP2PAttribute, &rank,
+                      CU_DEVICE_P2P_ATTRIBUTE_PERFORMANCE_RANK,
+                      g_devices_info[i].device, g_devices_info[j].device);
+      g_peer_rank[i][j] = rank;
+      LOGGER(VERBOSE, "device %d reaches device %d, rank %d", i, j, rank);
+    }
+  }
+}
+
+static CUcontext peer_context(int peer)
+{
+  CUcontext ctx;
+
+  pthread_mutex_lock(&g_peer_lock);
+  if (g_peer_ctx[peer] == NULL &&
+      CUDA_ENTRY_CALL(cuda_library_entry, cuDevicePrimaryCtxRetain,
+                      &g_peer_ctx[peer],
+                      g_devices_info[peer].device) != CUDA_SUCCESS)
+  {
+    g_peer_ctx[peer] = NULL;
+  }
+  ctx = g_peer_ctx[peer];
+  pthread_mutex_unlock(&g_peer_lock);
+
+  return ctx;
+}
+
+static int64_t peer_spare(int peer)
+{
+  size_t limit = g_anycuda_config.gpu_mem_limit[peer];
+
+  if (limit >= (size_t)INT64_MAX)
+  {
+    return INT64_MAX;
+  }
+
+  return (int64_t)limit - (int64_t)ledger_used(peer);
+}
+
+/**
+ * Allocate on peer through its primary context and map the memory into
+ * the current context
+ */
+static CUresult peer_alloc(CUdeviceptr *dptr, size_t request_size, int peer)
+{
+  CUcontext ctx = peer_context(peer), popped;
+  CUresult ret;
+
+  if (ctx == NULL)
+  {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPushCurrent_v2, ctx);
+  if (ret != CUDA_SUCCESS)
+  {
+    return ret;
+  }
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc_v2, dptr,
+                        request_size);
+  CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPopCurrent_v2, &popped);
+  if (ret != CUDA_SUCCESS)
+  {
+    return ret;
+  }
+
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxEnablePeerAccess, ctx, 0);
+  if (ret == CUDA_ERROR_PEER_ACCESS_ALREADY_ENABLED)
+  {
+    ret = CUDA_SUCCESS;
+  }
+  if (ret != CUDA_SUCCESS)
+  {
+    CUDA_ENTRY_CALL(cuda_library_entry, cuMemFree_v2, *dptr);
+  }
+
+  return ret;
+}
+
+CUresult peer_spill_alloc(CUdeviceptr *dptr, size_t request_size,
+                          CUdevice ordinal, int *peer)
+{
+  int candidates[MAX_DEVICES];
+  int n = 0, i, j, p;
+
+  if (ordinal < 0 || ordinal >= MAX_DEVICES ||
+      !g_anycuda_config.gpu_mem_limit_valid)
+  {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  pthread_once(&g_peer_set, load_peer_ranks);
+
+  for (p = 0; p < g_device_count && p < MAX_DEVICES; p++)
+  {
+    if (g_peer_rank[ordinal][p] < 0 ||
+        peer_spare(p) < (int64_t)request_size)
+    {
+      continue;
+    }
+    // best link first, the peer with more room on a tie
+    for (i = n; i > 0; i--)
+    {
+      j = candidates[i - 1];
+      if (g_peer_rank[ordinal][j] < g_peer_rank[ordinal][p] ||
+          (g_peer_rank[ordinal][j] == g_peer_rank[ordinal][p] &&
+           peer_spare(j) >= peer_spare(p)))
+      {
+        break;
+      }
+      candidates[i] = j;
+    }
+    candidates[i] = p;
+    n++;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    p = candidates[i];
+    if (ledger_reserve(p, request_size, g_anycuda_config.gpu_mem_limit[p]))
+    {
+      continue;
+    }
+    if (peer_alloc(dptr, request_size, p) != CUDA_SUCCESS)
+    {
+      ledger_unreserve(p, request_size);
+      continue;
+    }
+    ledger_commit(*dptr, request_size, p);
+    *peer = p;
+    return CUDA_SUCCESS;
+  }
+
+  return CUDA_ERROR_OUT_OF_MEMORY;
+}
@@ -0,0 +1,85 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Pinned host memory quota: page locked memory can't be reclaimed by the
+// kernel, so the pod gets a budget of it like it gets one of device memory
+//
+
+#include "include/hijack.h"
+
+extern resource_data_t g_anycuda_config;
+
+/** host memory given out or registered as page locked, keyed by address */
+static ledger_table_t g_pinned_table = LEDGER_TABLE_INITIALIZER;
+
+/** page locked bytes of this process when usage is not shared */
+static size_t g_pinned = 0;
+
+int pinned_charge(size_t bytes)
+{
+  size_t limit = g_anycuda_config.pinned_limit;
+  size_t pinned;
+  int ret;
+
+  if (!g_anycuda_config.valid)
+  {
+    limit = (size_t)-1;
+  }
+  ret = pod_shm_pin(bytes, limit);
+  if (ret >= 0)
+  {
+    return ret;
+  }
+
+  do
+  {
+    pinned = g_pinned;
+    if (limit != (size_t)-1 && pinned + bytes > limit)
+    {
+      return 1;
+    }
+  } while (!CAS(&g_pinned, pinned, pinned + bytes));
+
+  return 0;
+}
+
+void pinned_uncharge(size_t bytes)
+{
+  if (pod_shm_unpin(bytes) < 0)
+  {
+    __sync_fetch_and_sub(&g_pinned, bytes);
+  }
+}
+
+int pinned_record(void *p, size_t size, int kind)
+{
+  if (unlikely(ledger_table_insert(&g_pinned_table, (uint64_t)(uintptr_t)p,
+                                   0, size, 0, kind)))
+  {
+    LOGGER(WARNING, "can't record host memory %p", p);
+    return 1;
+  }
+
+  return 0;
+}
+
+int pinned_forget(void *p, ledger_entry_t *entry)
+{
+  return ledger_table_remove(&g_pinned_table, (uint64_t)(uintptr_t)p, entry);
+}
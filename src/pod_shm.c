@@ -0,0 +1,668 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/hijack.h"
+
+/** marks a slot which is being released */
+#define SLOT_RELEASING (-1)
+
+static pod_shm_t *g_pod_shm = NULL;
+static pod_proc_slot_t *g_pod_slot = NULL;
+
+/** IPC entries this process exports, they are only searched when it has
+ * some */
+static int g_ipc_exports = 0;
+
+static int g_pod_shm_fd = -1;
+
+static pthread_mutex_t g_ipc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_reap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Take the lock of slot i, a byte of the segment file. A process holds the
+ * lock of its slot as long as it lives, which containers of the pod see
+ * whatever pid namespace they are in. Record locks are dropped when the
+ * process closes any descriptor of the file, g_pod_shm_fd is never closed
+ *
+ * @return 0 -> locked, 1 -> another process holds it
+ */
+static int slot_lock(int i)
+{
+  struct flock fl = {
+      .l_type = F_WRLCK,
+      .l_whence = SEEK_SET,
+      .l_start = i,
+      .l_len = 1,
+  };
+
+  return fcntl(g_pod_shm_fd, F_SETLK, &fl) == -1;
+}
+
+static void slot_unlock(int i)
+{
+  struct flock fl = {
+      .l_type = F_UNLCK,
+      .l_whence = SEEK_SET,
+      .l_start = i,
+      .l_len = 1,
+  };
+
+  fcntl(g_pod_shm_fd, F_SETLK, &fl);
+}
+
+/**
+ * Take ipc_lock for slot, whose lock the caller holds. Threads of a process
+ * take turns first, their record locks never conflict
+ */
+static void ipc_lock(int slot)
+{
+  int owner;
+
+  pthread_mutex_lock(&g_ipc_mutex);
+  while (!CAS(&g_pod_shm->ipc_lock, 0, slot + 1))
+  {
+    owner = g_pod_shm->ipc_lock;
+    // a process killed while holding the lock never gives it back
+    if (owner > 0 && slot_lock(owner - 1) == 0)
+    {
+      CAS(&g_pod_shm->ipc_lock, owner, 0);
+      slot_unlock(owner - 1);
+      continue;
+    }
+    sched_yield();
+  }
+}
+
+static void ipc_unlock()
+{
+  __sync_lock_release(&g_pod_shm->ipc_lock);
+  pthread_mutex_unlock(&g_ipc_mutex);
+}
+
+static int ipc_mapped(pod_ipc_entry_t *entry)
+{
+  unsigned int i;
+
+  for (i = 0; i < sizeof(entry->importers) / sizeof(entry->importers[0]);
+       i++)
+  {
+    if (entry->importers[i])
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Charge (positive) or uncharge (negative) bytes of device to the pod
+ */
+static void usage_charge(int device, int64_t bytes)
+{
+  __sync_fetch_and_add(&g_pod_shm->devices[device].used, (size_t)bytes);
+  __sync_fetch_and_add(&g_pod_shm->devices[device].total, (size_t)bytes);
+}
+
+/**
+ * The exporter of entry let go of it, with ipc_lock held. The pod keeps
+ * paying while other processes map it
+ */
+static void ipc_let_go(pod_ipc_entry_t *entry)
+{
+  if (!ipc_mapped(entry))
+  {
+    memset(entry, 0, sizeof(pod_ipc_entry_t));
+    return;
+  }
+  entry->charged = entry->size;
+  entry->exporter = -1;
+  usage_charge(entry->device, (int64_t)entry->charged);
+}
+
+/**
+ * Drop the mapping of slot from entry, with ipc_lock held. The last mapping
+ * of memory whose exporter let go gives its charge back
+ */
+static void ipc_unmap(pod_ipc_entry_t *entry, int slot)
+{
+  entry->importers[slot / 64] &= ~(1ULL << (slot % 64));
+  if (entry->exporter != -1 || ipc_mapped(entry))
+  {
+    return;
+  }
+  usage_charge(entry->device, -(int64_t)entry->charged);
+  ledger_wake(entry->device);
+  memset(entry, 0, sizeof(pod_ipc_entry_t));
+}
+
+/**
+ * Let go of what the process in slot exported or mapped
+ */
+static void ipc_release_slot(int slot)
+{
+  pod_ipc_entry_t *entry;
+  int i;
+
+  ipc_lock(slot);
+  for (i = 0; i < POD_SHM_MAX_IPC; i++)
+  {
+    entry = &g_pod_shm->ipc[i];
+    if (entry->exporter == 0)
+    {
+      continue;
+    }
+    if (entry->exporter == slot + 1)
+    {
+      ipc_let_go(entry);
+    }
+    if (entry->exporter != 0)
+    {
+      ipc_unmap(entry, slot);
+    }
+  }
+  ipc_unlock();
+}
+
+static void release_slot(pod_proc_slot_t *slot, int pid)
+{
+  size_t released;
+  int i;
+
+  if (!CAS(&slot->pid, pid, SLOT_RELEASING))
+  {
+    return;
+  }
+  ipc_release_slot(slot - g_pod_shm->procs);
+  __sync_fetch_and_sub(&g_pod_shm->pinned, slot->pinned);
+  slot->pinned = 0;
+  for (i = 0; i < MAX_DEVICES; i++)
+  {
+    released = slot->used[i] + slot->reserved[i];
+    __sync_fetch_and_sub(&g_pod_shm->devices[i].used, slot->used[i]);
+    __sync_fetch_and_sub(&g_pod_shm->devices[i].reserved, slot->reserved[i]);
+    __sync_fetch_and_sub(&g_pod_shm->devices[i].total, released);
+    slot->used[i] = 0;
+    slot->reserved[i] = 0;
+    // work a dead process queued no longer holds back the pod
+    __sync_fetch_and_sub(&g_pod_shm->devices[i].inflight_kernels,
+                         slot->inflight_kernels[i]);
+    __sync_fetch_and_sub(&g_pod_shm->devices[i].inflight_ns,
+                         slot->inflight_ns[i]);
+    slot->inflight_kernels[i] = 0;
+    slot->inflight_ns[i] = 0;
+    if (released)
+    {
+      ledger_wake(i);
+    }
+  }
+  __sync_synchronize();
+  slot->pid = 0;
+}
+
+static pod_proc_slot_t *claim_slot()
+{
+  int pid = getpid();
+  int i;
+
+  // the lock comes first, a slot claimed without it would look dead
+  for (i = 0; i < POD_SHM_MAX_PROCS; i++)
+  {
+    if (slot_lock(i))
+    {
+      continue;
+    }
+    if (CAS(&g_pod_shm->procs[i].pid, 0, pid))
+    {
+      return &g_pod_shm->procs[i];
+    }
+    slot_unlock(i);
+  }
+
+  return NULL;
+}
+
+static void pod_shm_detach()
+{
+  if (g_pod_shm && g_pod_slot)
+  {
+    release_slot(g_pod_slot, g_pod_slot->pid);
+    g_pod_slot = NULL;
+  }
+}
+
+static void pod_shm_atfork_child()
+{
+  // the slot belongs to the parent, the child starts with its own
+  if (g_pod_shm)
+  {
+    g_pod_slot = claim_slot();
+  }
+}
+
+int pod_shm_attach(const char *pod_name)
+{
+  char shm_name[FILENAME_MAX];
+  pod_shm_t *shm;
+  mode_t mask;
+  int fd;
+
+  if (g_pod_shm)
+  {
+    return 0;
+  }
+  if (pod_name == NULL || strlen(pod_name) == 0)
+  {
+    LOGGER(VERBOSE, "pod name is empty, usage is not shared");
+    return 1;
+  }
+
+  snprintf(shm_name, sizeof(shm_name), "%s%s", POD_SHM_PREFIX, pod_name);
+  mask = umask(0);
+  fd = shm_open(shm_name, O_RDWR | O_CREAT, 0666);
+  umask(mask);
+  if (fd == -1)
+  {
+    LOGGER(WARNING, "can't open %s, error %s", shm_name, strerror(errno));
+    return 1;
+  }
+  if (ftruncate(fd, sizeof(pod_shm_t)) == -1)
+  {
+    LOGGER(WARNING, "can't resize %s, error %s", shm_name, strerror(errno));
+    close(fd);
+    return 1;
+  }
+  shm = mmap(NULL, sizeof(pod_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+             0);
+  if (shm == MAP_FAILED)
+  {
+    LOGGER(WARNING, "can't map %s, error %s", shm_name, strerror(errno));
+    close(fd);
+    return 1;
+  }
+
+  // a new segment is zero filled, which is a valid empty state
+  if (CAS(&shm->magic, 0, POD_SHM_MAGIC))
+  {
+    shm->version = POD_SHM_VERSION;
+  }
+  __sync_synchronize();
+  if (shm->magic != POD_SHM_MAGIC || shm->version != POD_SHM_VERSION)
+  {
+    LOGGER(WARNING, "%s has unknown layout %x/%u", shm_name, shm->magic,
+           shm->version);
+    munmap(shm, sizeof(pod_shm_t));
+    close(fd);
+    return 1;
+  }
+
+  // the descriptor stays open, it holds the lock of the slot
+  g_pod_shm_fd = fd;
+  g_pod_shm = shm;
+  pod_shm_reap();
+  g_pod_slot = claim_slot();
+  if (g_pod_slot == NULL)
+  {
+    LOGGER(WARNING, "no free process slot in %s", shm_name);
+    g_pod_shm = NULL;
+    munmap(shm, sizeof(pod_shm_t));
+    close(fd);
+    g_pod_shm_fd = -1;
+    return 1;
+  }
+
+  pthread_atfork(NULL, NULL, pod_shm_atfork_child);
+  atexit(pod_shm_detach);
+  LOGGER(VERBOSE, "attached to %s", shm_name);
+
+  return 0;
+}
+
+void pod_shm_charge(int device, int64_t bytes)
+{
+  if (!g_pod_shm || !g_pod_slot)
+  {
+    return;
+  }
+  __sync_fetch_and_add(&g_pod_slot->used[device], (size_t)bytes);
+  usage_charge(device, bytes);
+}
+
+int pod_shm_used(int device, size_t *used)
+{
+  if (!g_pod_shm || !g_pod_slot)
+  {
+    return 1;
+  }
+  *used = __sync_fetch_and_add(&g_pod_shm->devices[device].total, 0);
+
+  return 0;
+}
+
+int pod_shm_reserve(int device, size_t bytes, int64_t headroom)
+{
+  pod_device_usage_t *usage;
+  size_t total;
+
+  if (!g_pod_shm || !g_pod_slot)
+  {
+    return -1;
+  }
+  usage = &g_pod_shm->devices[device];
+  // every charge and reservation goes through total, so the CAS fails on
+  // any change and the sum checked here is never stale. A commit charges
+  // before it gives back the reservation, it never makes room meanwhile
+  do
+  {
+    total = usage->total;
+    if ((int64_t)(total + bytes) > headroom)
+    {
+      return 1;
+    }
+  } while (!CAS(&usage->total, total, total + bytes));
+  __sync_fetch_and_add(&usage->reserved, bytes);
+  __sync_fetch_and_add(&g_pod_slot->reserved[device], bytes);
+
+  return 0;
+}
+
+int pod_shm_unreserve(int device, size_t bytes)
+{
+  if (!g_pod_shm || !g_pod_slot)
+  {
+    return -1;
+  }
+  __sync_fetch_and_sub(&g_pod_slot->reserved[device], bytes);
+  __sync_fetch_and_sub(&g_pod_shm->devices[device].reserved, bytes);
+  __sync_fetch_and_sub(&g_pod_shm->devices[device].total, bytes);
+
+  return 0;
+}
+
+int pod_shm_wait_words(int device, volatile uint32_t **seq,
+                       volatile uint32_t **waiters)
+{
+  if (!g_pod_shm || !g_pod_slot)
+  {
+    return 1;
+  }
+  *seq = &g_pod_shm->devices[device].free_seq;
+  *waiters = &g_pod_shm->devices[device].waiters;
+
+  return 0;
+}
+
+void pod_shm_reap()
+{
+  int i, pid;
+
+  if (!g_pod_shm)
+  {
+    return;
+  }
+  // threads of a process share their record locks
+  pthread_mutex_lock(&g_reap_mutex);
+  for (i = 0; i < POD_SHM_MAX_PROCS; i++)
+  {
+    pid = g_pod_shm->procs[i].pid;
+    if (pid <= 0 || &g_pod_shm->procs[i] == g_pod_slot)
+    {
+      continue;
+    }
+    // a slot whose lock is free lost its process, the pid it holds may
+    // belong to another pid namespace and can't tell
+    if (slot_lock(i))
+    {
+      continue;
+    }
+    if (g_pod_shm->procs[i].pid == pid)
+    {
+      LOGGER(VERBOSE, "reap usage of dead process %d", pid);
+      release_slot(&g_pod_shm->procs[i], pid);
+    }
+    slot_unlock(i);
+  }
+  pthread_mutex_unlock(&g_reap_mutex);
+}
+
+void pod_shm_account_policy(int policy, size_t bytes, uint64_t wait_ms,
+                            int failed)
+{
+  pod_policy_stat_t *stat;
+
+  if (!g_pod_shm || policy < 0 || policy >= OVER_LIMIT_POLICIES)
+  {
+    return;
+  }
+  stat = &g_pod_shm->policies[policy];
+  if (failed)
+  {
+    __sync_fetch_and_add(&stat->failed, 1);
+  }
+  else
+  {
+    __sync_fetch_and_add(&stat->count, 1);
+    __sync_fetch_and_add(&stat->bytes, bytes);
+  }
+  __sync_fetch_and_add(&stat->wait_ms, wait_ms);
+}
+
+int pod_shm_pin(size_t bytes, size_t limit)
+{
+  size_t pinned;
+
+  if (!g_pod_shm || !g_pod_slot)
+  {
+    return -1;
+  }
+  do
+  {
+    pinned = g_pod_shm->pinned;
+    if (limit != (size_t)-1 && pinned + bytes > limit)
+    {
+      return 1;
+    }
+  } while (!CAS(&g_pod_shm->pinned, pinned, pinned + bytes));
+  __sync_fetch_and_add(&g_pod_slot->pinned, bytes);
+
+  return 0;
+}
+
+int pod_shm_unpin(size_t bytes)
+{
+  if (!g_pod_shm || !g_pod_slot)
+  {
+    return -1;
+  }
+  __sync_fetch_and_sub(&g_pod_slot->pinned, bytes);
+  __sync_fetch_and_sub(&g_pod_shm->pinned, bytes);
+
+  return 0;
+}
+
+int pod_shm_inflight(int device, int kernels, int64_t ns)
+{
+  if (!g_pod_shm || !g_pod_slot)
+  {
+    return -1;
+  }
+  __sync_fetch_and_add(&g_pod_slot->inflight_kernels[device], kernels);
+  __sync_fetch_and_add(&g_pod_slot->inflight_ns[device], ns);
+  __sync_fetch_and_add(&g_pod_shm->devices[device].inflight_kernels, kernels);
+  __sync_fetch_and_add(&g_pod_shm->devices[device].inflight_ns, ns);
+
+  return 0;
+}
+
+int pod_shm_inflight_read(int device, int *kernels, int64_t *ns)
+{
+  if (!g_pod_shm || !g_pod_slot)
+  {
+    return 1;
+  }
+  *kernels = g_pod_shm->devices[device].inflight_kernels;
+  *ns = g_pod_shm->devices[device].inflight_ns;
+
+  return 0;
+}
+
+void pod_shm_ipc_export(const CUipcMemHandle *handle, uint64_t dptr,
+                        size_t size, int device)
+{
+  pod_ipc_entry_t *entry, *free_entry = NULL;
+  int i;
+
+  if (!g_pod_shm || !g_pod_slot || device < 0 || device >= MAX_DEVICES)
+  {
+    return;
+  }
+  ipc_lock(g_pod_slot - g_pod_shm->procs);
+  for (i = 0; i < POD_SHM_MAX_IPC; i++)
+  {
+    entry = &g_pod_shm->ipc[i];
+    if (entry->exporter == 0)
+    {
+      free_entry = free_entry ? free_entry : entry;
+      continue;
+    }
+    // the same allocation exported again gives the same handle
+    if (memcmp(entry->handle, handle->reserved, CU_IPC_HANDLE_SIZE) == 0)
+    {
+      free_entry = NULL;
+      goto DONE;
+    }
+  }
+  if (free_entry == NULL)
+  {
+    LOGGER(WARNING, "no free IPC entry for 0x%" PRIx64 ", it may be counted "
+                    "for every process mapping it", dptr);
+    goto DONE;
+  }
+  free_entry->exporter = g_pod_slot - g_pod_shm->procs + 1;
+  free_entry->device = device;
+  free_entry->dptr = dptr;
+  free_entry->size = size;
+  free_entry->charged = 0;
+  memset(free_entry->importers, 0, sizeof(free_entry->importers));
+  memcpy(free_entry->handle, handle->reserved, CU_IPC_HANDLE_SIZE);
+  g_ipc_exports++;
+DONE:
+  ipc_unlock();
+}
+
+void pod_shm_ipc_unexport(uint64_t dptr)
+{
+  int slot, i;
+
+  if (!g_pod_shm || !g_pod_slot || g_ipc_exports == 0)
+  {
+    return;
+  }
+  slot = g_pod_slot - g_pod_shm->procs;
+  ipc_lock(g_pod_slot - g_pod_shm->procs);
+  for (i = 0; i < POD_SHM_MAX_IPC; i++)
+  {
+    if (g_pod_shm->ipc[i].exporter == slot + 1 &&
+        g_pod_shm->ipc[i].dptr == dptr)
+    {
+      ipc_let_go(&g_pod_shm->ipc[i]);
+      g_ipc_exports--;
+      break;
+    }
+  }
+  ipc_unlock();
+}
+
+int pod_shm_ipc_open(const CUipcMemHandle *handle)
+{
+  int slot, i, found = -1;
+
+  if (!g_pod_shm || !g_pod_slot)
+  {
+    return -1;
+  }
+  slot = g_pod_slot - g_pod_shm->procs;
+  ipc_lock(g_pod_slot - g_pod_shm->procs);
+  for (i = 0; i < POD_SHM_MAX_IPC; i++)
+  {
+    if (g_pod_shm->ipc[i].exporter > 0 &&
+        memcmp(g_pod_shm->ipc[i].handle, handle->reserved,
+               CU_IPC_HANDLE_SIZE) == 0)
+    {
+      g_pod_shm->ipc[i].importers[slot / 64] |= 1ULL << (slot % 64);
+      found = i;
+      break;
+    }
+  }
+  ipc_unlock();
+
+  return found;
+}
+
+void pod_shm_ipc_close(int entry)
+{
+  if (!g_pod_shm || !g_pod_slot || entry < 0 || entry >= POD_SHM_MAX_IPC)
+  {
+    return;
+  }
+  ipc_lock(g_pod_slot - g_pod_shm->procs);
+  if (g_pod_shm->ipc[entry].exporter != 0)
+  {
+    ipc_unmap(&g_pod_shm->ipc[entry], g_pod_slot - g_pod_shm->procs);
+  }
+  ipc_unlock();
+}
+
+size_t pod_shm_ipc_shared(int device)
+{
+  pod_ipc_entry_t *entry;
+  size_t shared = 0;
+  unsigned int j;
+  int i;
+
+  if (!g_pod_shm)
+  {
+    return 0;
+  }
+  // a racy read is fine, the sum only tempers the NVML sample
+  for (i = 0; i < POD_SHM_MAX_IPC; i++)
+  {
+    entry = &g_pod_shm->ipc[i];
+    if (entry->exporter == 0 || entry->device != device)
+    {
+      continue;
+    }
+    for (j = 0; j < sizeof(entry->importers) / sizeof(entry->importers[0]);
+         j++)
+    {
+      shared += entry->size * __builtin_popcountll(entry->importers[j]);
+    }
+  }
+
+  return shared;
+}
@@ -0,0 +1,481 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Queue depth limiter: the kernels a thread launches on a stream are
+// gathered in a batch, closed every QUEUE_MARKER_BATCH kernels by an event
+// recorded on the stream. Until the event completes the kernels of the
+// batch, and the GPU time the cost model predicts for them, count as in
+// flight on the device for the whole pod, in the pod usage segment. A launch
+// which would take the device over the maxInflightKernels or maxInflightMs
+// of the podconf waits for markers of its process to complete, so the
+// hardware queue never holds more of the pod's work than that ahead of a
+// neighbour. Each process only sees its own markers complete, one with
+// nothing in flight launches whatever the others queued
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+
+extern entry_t cuda_library_entry[];
+extern resource_data_t g_anycuda_config;
+
+/**
+ * Kernels launched by a thread on a stream since its last marker
+ */
+struct queue_batch_st
+{
+  CUcontext ctx;
+  CUstream stream;
+  int per_thread;
+  CUdevice device;
+  int kernels;
+  int64_t ns;
+  int64_t launch_ns; /**< predicted time of the launch in progress */
+};
+
+/**
+ * Event closing a batch, what it closed is in flight until it completes
+ */
+typedef struct queue_marker_st
+{
+  CUevent event;
+  CUcontext ctx;
+  CUdevice device;
+  int kernels;
+  int64_t ns;
+  int waiters; /**< threads synchronizing on the event */
+  struct queue_marker_st *next;
+} queue_marker_t;
+
+/**
+ * In-flight work of this process, counted here only when the pod usage
+ * segment is not attached
+ */
+typedef struct
+{
+  volatile int kernels;
+  volatile int64_t ns;
+} queue_depth_t;
+
+static queue_depth_t g_depths[MAX_DEVICES];
+
+/** events ready to be recorded, and recorded ones not completed yet */
+static queue_marker_t *g_idle = NULL;
+static queue_marker_t *g_pending = NULL;
+static int g_marker_count = 0;
+
+static pthread_mutex_t g_marker_lock = PTHREAD_MUTEX_INITIALIZER;
+/** signaled when the last waiter of a marker is done with it */
+static pthread_cond_t g_marker_cond = PTHREAD_COND_INITIALIZER;
+
+static __thread queue_batch_t t_batches[QUEUE_BATCH_STREAMS];
+
+static int queue_limited()
+{
+  return g_anycuda_config.valid && (g_anycuda_config.max_inflight_kernels > 0 ||
+                                    g_anycuda_config.max_inflight_ms > 0);
+}
+
+static void marker_destroy(queue_marker_t *m)
+{
+  CUDA_ENTRY_CALL(cuda_library_entry, cuEventDestroy_v2, m->event);
+  free(m);
+  __sync_fetch_and_sub(&g_marker_count, 1);
+}
+
+/**
+ * Destroy markers taken off the lists, once no thread synchronizes on them
+ * anymore
+ */
+static void markers_destroy(queue_marker_t *dead)
+{
+  queue_marker_t *m;
+
+  pthread_mutex_lock(&g_marker_lock);
+  for (m = dead; m; m = m->next)
+  {
+    while (m->waiters > 0)
+    {
+      pthread_cond_wait(&g_marker_cond, &g_marker_lock);
+    }
+  }
+  pthread_mutex_unlock(&g_marker_lock);
+
+  while (dead)
+  {
+    m = dead;
+    dead = m->next;
+    marker_destroy(m);
+  }
+}
+
+/**
+ * Let go of a marker queue_retire gave to wait on
+ */
+static void marker_unwait(queue_marker_t *m)
+{
+  pthread_mutex_lock(&g_marker_lock);
+  if (--m->waiters == 0)
+  {
+    pthread_cond_broadcast(&g_marker_cond);
+  }
+  pthread_mutex_unlock(&g_marker_lock);
+}
+
+/**
+ * Take an event of ctx from the pool, or create one while fewer than
+ * QUEUE_MARKER_EVENTS exist
+ */
+static queue_marker_t *marker_get(CUcontext ctx)
+{
+  queue_marker_t **prev, *m = NULL;
+
+  pthread_mutex_lock(&g_marker_lock);
+  for (prev = &g_idle; *prev; prev = &(*prev)->next)
+  {
+    if ((*prev)->ctx == ctx)
+    {
+      m = *prev;
+      *prev = m->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_marker_lock);
+  if (m)
+  {
+    return m;
+  }
+
+  if (__sync_fetch_and_add(&g_marker_count, 1) >= QUEUE_MARKER_EVENTS)
+  {
+    __sync_fetch_and_sub(&g_marker_count, 1);
+    return NULL;
+  }
+  m = calloc(1, sizeof(queue_marker_t));
+  if (unlikely(!m))
+  {
+    __sync_fetch_and_sub(&g_marker_count, 1);
+    return NULL;
+  }
+  // waiters sleep on the event instead of spinning on it
+  if (CUDA_ENTRY_CALL(cuda_library_entry, cuEventCreate, &m->event,
+                      CU_EVENT_DISABLE_TIMING | CU_EVENT_BLOCKING_SYNC) !=
+      CUDA_SUCCESS)
+  {
+    free(m);
+    __sync_fetch_and_sub(&g_marker_count, 1);
+    return NULL;
+  }
+  m->ctx = ctx;
+
+  return m;
+}
+
+static void marker_put(queue_marker_t *m)
+{
+  pthread_mutex_lock(&g_marker_lock);
+  m->next = g_idle;
+  g_idle = m;
+  pthread_mutex_unlock(&g_marker_lock);
+}
+
+/**
+ * Count the work m closed in flight (sign 1) or done (sign -1)
+ */
+static void depth_charge(queue_marker_t *m, int sign)
+{
+  if (pod_shm_inflight(m->device, sign * m->kernels, sign * m->ns) < 0)
+  {
+    __sync_fetch_and_add(&g_depths[m->device].kernels, sign * m->kernels);
+    __sync_fetch_and_add(&g_depths[m->device].ns, sign * m->ns);
+  }
+}
+
+static void batch_reset(queue_batch_t *b)
+{
+  b->kernels = 0;
+  b->ns = 0;
+}
+
+/**
+ * Record a marker closing b on its stream, b must belong to the current
+ * context. A batch which can't be marked is dropped, but it stays open
+ * while all the events are in flight
+ *
+ * @return 0 -> marked or dropped, 1 -> no event left
+ */
+static int batch_mark(queue_batch_t *b)
+{
+  CUstreamCaptureStatus status = CU_STREAM_CAPTURE_STATUS_NONE;
+  queue_marker_t *m;
+  CUresult ret;
+
+  if (b->kernels == 0)
+  {
+    return 0;
+  }
+  // launches captured into a graph don't run, and an event recorded now
+  // would become a node of the graph
+  if (b->per_thread)
+  {
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuStreamIsCapturing_ptsz,
+                          b->stream, &status);
+  }
+  else
+  {
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuStreamIsCapturing, b->stream,
+                          &status);
+  }
+  if (ret != CUDA_SUCCESS || status != CU_STREAM_CAPTURE_STATUS_NONE)
+  {
+    batch_reset(b);
+    return 0;
+  }
+
+  m = marker_get(b->ctx);
+  if (m == NULL)
+  {
+    return 1;
+  }
+  if (b->per_thread)
+  {
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuEventRecord_ptsz, m->event,
+                          b->stream);
+  }
+  else
+  {
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuEventRecord, m->event,
+                          b->stream);
+  }
+  if (ret != CUDA_SUCCESS)
+  {
+    marker_put(m);
+    batch_reset(b);
+    return 0;
+  }
+
+  m->device = b->device;
+  m->kernels = b->kernels;
+  m->ns = b->ns;
+  depth_charge(m, 1);
+  pthread_mutex_lock(&g_marker_lock);
+  m->next = g_pending;
+  g_pending = m;
+  pthread_mutex_unlock(&g_marker_lock);
+  batch_reset(b);
+
+  return 0;
+}
+
+/**
+ * Open batch of the calling thread for hStream in ctx. The batch of another
+ * stream in the slot is marked first, or dropped when it belongs to another
+ * context
+ */
+static queue_batch_t *batch_get(CUcontext ctx, CUdevice device,
+                                CUstream hStream, int per_thread)
+{
+  unsigned int slot = ((uintptr_t)hStream >> 4) & (QUEUE_BATCH_STREAMS - 1);
+  queue_batch_t *b = &t_batches[slot];
+
+  if (b->ctx == ctx && b->stream == hStream && b->per_thread == per_thread)
+  {
+    return b;
+  }
+  if (b->ctx != ctx || batch_mark(b))
+  {
+    batch_reset(b);
+  }
+  b->ctx = ctx;
+  b->stream = hStream;
+  b->per_thread = per_thread;
+  b->device = device;
+
+  return b;
+}
+
+/**
+ * Take the markers of device which completed off the in-flight work
+ *
+ * @return a marker of device still in flight, to give to marker_unwait once
+ * done waiting on it, NULL when none is
+ */
+static queue_marker_t *queue_retire(CUdevice device)
+{
+  queue_marker_t **prev, *m, *oldest = NULL, *dead = NULL;
+  CUresult ret;
+
+  pthread_mutex_lock(&g_marker_lock);
+  prev = &g_pending;
+  while (*prev)
+  {
+    m = *prev;
+    if (m->device != device)
+    {
+      prev = &m->next;
+      continue;
+    }
+    ret = CUDA_ENTRY_CALL(cuda_library_entry, cuEventQuery, m->event);
+    if (ret == CUDA_ERROR_NOT_READY)
+    {
+      // pending markers are pushed in front, the last one is the oldest
+      oldest = m;
+      prev = &m->next;
+      continue;
+    }
+    *prev = m->next;
+    depth_charge(m, -1);
+    if (ret == CUDA_SUCCESS)
+    {
+      m->next = g_idle;
+      g_idle = m;
+    }
+    else
+    {
+      m->next = dead;
+      dead = m;
+    }
+  }
+  // it can't be destroyed while this thread waits on its event, only
+  // recycled, then the wait is a bit longer
+  if (oldest)
+  {
+    oldest->waiters++;
+  }
+  pthread_mutex_unlock(&g_marker_lock);
+
+  markers_destroy(dead);
+
+  return oldest;
+}
+
+/**
+ * Whether a launch of ns more on top of b takes its device over a limit
+ */
+static int queue_full(queue_batch_t *b, int64_t ns)
+{
+  int max_kernels = g_anycuda_config.max_inflight_kernels;
+  int max_ms = g_anycuda_config.max_inflight_ms;
+  int64_t inflight_ns;
+  int kernels;
+
+  if (pod_shm_inflight_read(b->device, &kernels, &inflight_ns) != 0)
+  {
+    kernels = g_depths[b->device].kernels;
+    inflight_ns = g_depths[b->device].ns;
+  }
+
+  return (max_kernels > 0 && kernels + b->kernels + 1 > max_kernels) ||
+         (max_ms > 0 &&
+          inflight_ns + b->ns + ns > (int64_t)max_ms * (int64_t)MILLISEC);
+}
+
+queue_batch_t *queue_depth_enter(CUfunction f, unsigned int blocks,
+                                 unsigned int threads, CUstream hStream,
+                                 int per_thread)
+{
+  CUcontext ctx = NULL;
+  queue_marker_t *oldest;
+  queue_batch_t *b;
+  CUdevice device;
+  int64_t ns;
+
+  if (!queue_limited() ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetCurrent, &ctx) !=
+          CUDA_SUCCESS ||
+      ctx == NULL ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device) !=
+          CUDA_SUCCESS ||
+      device < 0 || device >= MAX_DEVICES)
+  {
+    return NULL;
+  }
+  b = batch_get(ctx, device, hStream, per_thread);
+  ns = f ? kernel_cost_predict(f, blocks, threads) : 0;
+
+  while (queue_full(b, ns))
+  {
+    // the kernels of this thread only drain from the count once marked
+    batch_mark(b);
+    oldest = queue_retire(device);
+    // nothing left to wait for, a launch alone over the limit still runs
+    if (oldest == NULL)
+    {
+      break;
+    }
+    if (queue_full(b, ns))
+    {
+      CUDA_ENTRY_CALL(cuda_library_entry, cuEventSynchronize, oldest->event);
+    }
+    marker_unwait(oldest);
+  }
+  b->launch_ns = ns;
+
+  return b;
+}
+
+void queue_depth_leave(queue_batch_t *batch, CUresult launched)
+{
+  if (batch == NULL || launched != CUDA_SUCCESS)
+  {
+    return;
+  }
+  batch->kernels++;
+  batch->ns += batch->launch_ns;
+  if (batch->kernels >= QUEUE_MARKER_BATCH)
+  {
+    batch_mark(batch);
+  }
+}
+
+void queue_depth_forget_context(CUcontext ctx)
+{
+  queue_marker_t **lists[] = {&g_idle, &g_pending};
+  queue_marker_t **prev, *m, *dead = NULL;
+  unsigned int i;
+
+  pthread_mutex_lock(&g_marker_lock);
+  for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++)
+  {
+    prev = lists[i];
+    while (*prev)
+    {
+      m = *prev;
+      if (m->ctx != ctx)
+      {
+        prev = &m->next;
+        continue;
+      }
+      *prev = m->next;
+      if (lists[i] == &g_pending)
+      {
+        depth_charge(m, -1);
+      }
+      m->next = dead;
+      dead = m;
+    }
+  }
+  pthread_mutex_unlock(&g_marker_lock);
+
+  // threads waiting on them are done before the context goes
+  markers_destroy(dead);
+}
@@ -0,0 +1,640 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+
+extern entry_t cuda_library_entry[];
+extern resource_data_t g_anycuda_config;
+
+/**
+ * Advice applied to a range from its access pattern
+ */
+typedef enum
+{
+  ADVICE_NONE = 0,
+  ADVICE_READ_MOSTLY = 1,
+  ADVICE_ACCESSED_BY = 2,
+  ADVICES,
+} residency_advice_t;
+
+/**
+ * Managed range handed out because the pod was over its limit, last_use is
+ * the monotonic time in ms of the last launch or copy touching it
+ */
+typedef struct
+{
+  CUdeviceptr base;
+  size_t size;
+  int device;
+  CUcontext ctx;
+  volatile int resident;
+  volatile uint64_t last_use;
+
+  /** access pattern, a launch reads and a copy or memset to it writes */
+  uint64_t last_launch;
+  uint64_t reads;
+  uint64_t writes;
+  uint32_t reads_since_write;
+  uint32_t flips;
+  int advice;
+  uint32_t advised[ADVICES];
+} residency_range_t;
+
+/**
+ * Change of advice to apply outside g_range_lock
+ */
+typedef struct
+{
+  CUdeviceptr base;
+  size_t size;
+  int device;
+  int from;
+  int to;
+} residency_change_t;
+
+/**
+ * Pointer sized parameters of a kernel, count is -1 when the driver can't
+ * describe the parameters
+ */
+typedef struct
+{
+  CUfunction func;
+  int count;
+  uint64_t ptr_mask;
+} residency_func_t;
+
+/** ranges sorted by base address */
+static residency_range_t *g_ranges = NULL;
+static size_t g_range_count = 0;
+static size_t g_range_capacity = 0;
+static pthread_rwlock_t g_range_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/** bytes of the ranges kept on each device, guarded by g_range_lock */
+static size_t g_resident_bytes[MAX_DEVICES];
+
+/** launches seen, guarded by g_range_lock */
+static uint64_t g_launch_seq = 0;
+
+static const char *g_advice_names[ADVICES] = {
+    [ADVICE_NONE] = "none",
+    [ADVICE_READ_MOSTLY] = "read mostly",
+    [ADVICE_ACCESSED_BY] = "accessed by",
+};
+
+static residency_func_t g_funcs[RESIDENCY_FUNC_CACHE];
+static pthread_mutex_t g_func_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Index of the first range with base above addr
+ */
+static size_t range_upper_bound(CUdeviceptr addr)
+{
+  size_t lo = 0, hi = g_range_count, mid;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (g_ranges[mid].base <= addr)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+static residency_range_t *range_find(CUdeviceptr addr)
+{
+  size_t i = range_upper_bound(addr);
+
+  if (i == 0)
+  {
+    return NULL;
+  }
+  if (addr - g_ranges[i - 1].base < g_ranges[i - 1].size)
+  {
+    return &g_ranges[i - 1];
+  }
+
+  return NULL;
+}
+
+/**
+ * Whether bytes more can be kept on device without the pod going over its
+ * limit, called with g_range_lock held
+ */
+static int range_fits(int device, size_t bytes)
+{
+  size_t limit = g_anycuda_config.gpu_mem_limit[device];
+
+  if (!g_anycuda_config.valid || !g_anycuda_config.gpu_mem_limit_valid ||
+      limit >= (size_t)INT64_MAX)
+  {
+    return 1;
+  }
+
+  return ledger_used(device) + g_resident_bytes[device] + bytes <= limit;
+}
+
+/**
+ * Take the coldest ranges of device off the device until bytes fit, ranges
+ * used at or after hot are kept. The victims are copied to victims, called
+ * with g_range_lock held for writing
+ *
+ * @return number of victims
+ */
+static int range_evict(int device, size_t bytes, uint64_t hot,
+                       residency_range_t *victims, int max_victims)
+{
+  residency_range_t *coldest;
+  size_t i;
+  int n = 0;
+
+  while (n < max_victims && !range_fits(device, bytes))
+  {
+    coldest = NULL;
+    for (i = 0; i < g_range_count; i++)
+    {
+      if (g_ranges[i].device == device && g_ranges[i].resident &&
+          g_ranges[i].last_use < hot &&
+          (!coldest || g_ranges[i].last_use < coldest->last_use))
+      {
+        coldest = &g_ranges[i];
+      }
+    }
+    if (!coldest)
+    {
+      break;
+    }
+    coldest->resident = 0;
+    g_resident_bytes[device] -= coldest->size;
+    victims[n++] = *coldest;
+  }
+
+  return n;
+}
+
+static CUresult range_prefetch(residency_range_t *range, CUdevice target,
+                               CUstream hStream, int per_thread)
+{
+  if (per_thread)
+  {
+    return CUDA_ENTRY_CALL(cuda_library_entry, cuMemPrefetchAsync_ptsz,
+                           range->base, range->size, target, hStream);
+  }
+
+  return CUDA_ENTRY_CALL(cuda_library_entry, cuMemPrefetchAsync, range->base,
+                         range->size, target, hStream);
+}
+
+/**
+ * Pin a range to the host and move it there, faults from the device are
+ * then served remotely instead of migrating the pages back
+ */
+static void range_demote(residency_range_t *range, CUstream hStream,
+                         int per_thread)
+{
+  CUresult ret;
+
+  CUDA_ENTRY_CALL(cuda_library_entry, cuMemAdvise, range->base, range->size,
+                  CU_MEM_ADVISE_SET_PREFERRED_LOCATION, CU_DEVICE_CPU);
+  ret = range_prefetch(range, CU_DEVICE_CPU, hStream, per_thread);
+  LOGGER(VERBOSE, "demote 0x%llx+%zu from device %d, ret is %d", range->base,
+         range->size, range->device, ret);
+}
+
+/**
+ * Prefer the device for a range and move it there
+ *
+ * @return CUDA_SUCCESS when the migration is queued
+ */
+static CUresult range_promote(residency_range_t *range, CUstream hStream,
+                              int per_thread)
+{
+  CUresult ret;
+
+  CUDA_ENTRY_CALL(cuda_library_entry, cuMemAdvise, range->base, range->size,
+                  CU_MEM_ADVISE_SET_PREFERRED_LOCATION, range->device);
+  ret = range_prefetch(range, range->device, hStream, per_thread);
+  LOGGER(VERBOSE, "promote 0x%llx+%zu to device %d, ret is %d", range->base,
+         range->size, range->device, ret);
+
+  return ret;
+}
+
+/**
+ * Forget that a range is on its device, a failed promotion
+ */
+static void range_unpromote(CUdeviceptr base)
+{
+  residency_range_t *range;
+
+  pthread_rwlock_wrlock(&g_range_lock);
+  range = range_find(base);
+  if (range && range->resident)
+  {
+    range->resident = 0;
+    g_resident_bytes[range->device] -= range->size;
+  }
+  pthread_rwlock_unlock(&g_range_lock);
+}
+
+/**
+ * Account an access to a range and pick the advice its pattern calls for,
+ * called with g_range_lock held for writing
+ *
+ * @return 1 -> the advice changed, change is filled
+ */
+static int range_access(residency_range_t *range, int write,
+                        residency_change_t *change)
+{
+  int advice = range->advice;
+
+  if (write)
+  {
+    range->writes++;
+    if (range->reads_since_write)
+    {
+      range->flips++;
+    }
+    range->reads_since_write = 0;
+    // a write to read mostly pages collapses every copy of them
+    if (advice == ADVICE_READ_MOSTLY)
+    {
+      advice = ADVICE_NONE;
+    }
+    // written and read in turns, map it instead of migrating it
+    if (advice == ADVICE_NONE && range->flips >= ADVISE_ACCESSED_BY_FLIPS)
+    {
+      advice = ADVICE_ACCESSED_BY;
+    }
+  }
+  else
+  {
+    range->reads++;
+    range->reads_since_write++;
+    if (advice != ADVICE_READ_MOSTLY &&
+        range->reads_since_write >= ADVISE_READ_MOSTLY_READS)
+    {
+      advice = ADVICE_READ_MOSTLY;
+      range->flips = 0;
+    }
+  }
+
+  if (advice == range->advice)
+  {
+    return 0;
+  }
+  change->base = range->base;
+  change->size = range->size;
+  change->device = range->device;
+  change->from = range->advice;
+  change->to = advice;
+  range->advice = advice;
+  range->advised[advice]++;
+
+  return 1;
+}
+
+static void range_advise(residency_change_t *change)
+{
+  static const CUmem_advise unset[ADVICES] = {
+      [ADVICE_READ_MOSTLY] = CU_MEM_ADVISE_UNSET_READ_MOSTLY,
+      [ADVICE_ACCESSED_BY] = CU_MEM_ADVISE_UNSET_ACCESSED_BY,
+  };
+  static const CUmem_advise set[ADVICES] = {
+      [ADVICE_READ_MOSTLY] = CU_MEM_ADVISE_SET_READ_MOSTLY,
+      [ADVICE_ACCESSED_BY] = CU_MEM_ADVISE_SET_ACCESSED_BY,
+  };
+
+  if (change->from != ADVICE_NONE)
+  {
+    CUDA_ENTRY_CALL(cuda_library_entry, cuMemAdvise, change->base,
+                    change->size, unset[change->from], change->device);
+  }
+  if (change->to != ADVICE_NONE)
+  {
+    CUDA_ENTRY_CALL(cuda_library_entry, cuMemAdvise, change->base,
+                    change->size, set[change->to], change->device);
+  }
+  LOGGER(VERBOSE, "advise 0x%llx+%zu %s -> %s", change->base, change->size,
+         g_advice_names[change->from], g_advice_names[change->to]);
+}
+
+void residency_track(CUdeviceptr base, size_t size, int device)
+{
+  residency_range_t *ranges;
+  CUcontext ctx = NULL;
+  size_t i;
+
+  // needed to demote the range from threads without a context
+  CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetCurrent, &ctx);
+
+  pthread_rwlock_wrlock(&g_range_lock);
+  if (g_range_count == g_range_capacity)
+  {
+    ranges = realloc(g_ranges, sizeof(residency_range_t) *
+                                   (g_range_capacity ? g_range_capacity * 2
+                                                     : 64));
+    if (unlikely(!ranges))
+    {
+      pthread_rwlock_unlock(&g_range_lock);
+      LOGGER(WARNING, "can't track range 0x%llx", base);
+      return;
+    }
+    g_ranges = ranges;
+    g_range_capacity = g_range_capacity ? g_range_capacity * 2 : 64;
+  }
+  i = range_upper_bound(base);
+  memmove(&g_ranges[i + 1], &g_ranges[i],
+          sizeof(residency_range_t) * (g_range_count - i));
+  memset(&g_ranges[i], 0, sizeof(residency_range_t));
+  g_ranges[i].base = base;
+  g_ranges[i].size = size;
+  g_ranges[i].device = device;
+  g_ranges[i].ctx = ctx;
+  g_ranges[i].last_use = monotonic_ms();
+  __sync_fetch_and_add(&g_range_count, 1);
+  pthread_rwlock_unlock(&g_range_lock);
+}
+
+void residency_untrack(CUdeviceptr base)
+{
+  residency_range_t *range;
+  size_t i;
+
+  if (__sync_fetch_and_add(&g_range_count, 0) == 0)
+  {
+    return;
+  }
+  pthread_rwlock_wrlock(&g_range_lock);
+  i = range_upper_bound(base);
+  if (i > 0 && g_ranges[i - 1].base == base)
+  {
+    range = &g_ranges[i - 1];
+    LOGGER(VERBOSE, "range 0x%llx+%zu: %" PRIu64 " reads, %" PRIu64
+           " writes, advised read mostly %u, accessed by %u, none %u",
+           range->base, range->size, range->reads, range->writes,
+           range->advised[ADVICE_READ_MOSTLY],
+           range->advised[ADVICE_ACCESSED_BY], range->advised[ADVICE_NONE]);
+    if (range->resident)
+    {
+      g_resident_bytes[range->device] -= range->size;
+    }
+    memmove(&g_ranges[i - 1], &g_ranges[i],
+            sizeof(residency_range_t) * (g_range_count - i));
+    __sync_fetch_and_sub(&g_range_count, 1);
+  }
+  pthread_rwlock_unlock(&g_range_lock);
+}
+
+/**
+ * Describe the parameters of func once with cuFuncGetParamInfo
+ */
+static residency_func_t *func_params(CUfunction func)
+{
+  size_t slot = ((uintptr_t)func >> 4) & (RESIDENCY_FUNC_CACHE - 1);
+  size_t offset, size, i;
+  residency_func_t *entry;
+
+  pthread_mutex_lock(&g_func_lock);
+  entry = &g_funcs[slot];
+  if (entry->func == func)
+  {
+    goto DONE;
+  }
+
+  // a collision just evicts the previous function
+  entry->func = func;
+  entry->count = -1;
+  entry->ptr_mask = 0;
+  if (CUDA_FIND_ENTRY(cuda_library_entry, cuFuncGetParamInfo) == NULL)
+  {
+    goto DONE;
+  }
+  for (i = 0; i < RESIDENCY_MAX_PARAMS; i++)
+  {
+    if (CUDA_ENTRY_CALL(cuda_library_entry, cuFuncGetParamInfo, func, i,
+                        &offset, &size) != CUDA_SUCCESS)
+    {
+      break;
+    }
+    if (size == sizeof(CUdeviceptr))
+    {
+      entry->ptr_mask |= 1ULL << i;
+    }
+  }
+  entry->count = i;
+DONE:
+  pthread_mutex_unlock(&g_func_lock);
+
+  return entry;
+}
+
+/**
+ * Collect pointer values passed to a launch, either the pointer sized
+ * parameters or every aligned word of the extra buffer
+ *
+ * @return number of values
+ */
+static int collect_pointers(CUfunction func, void **kernelParams,
+                            void **extra, CUdeviceptr *values)
+{
+  residency_func_t *params;
+  void *buffer = NULL;
+  size_t buffer_size = 0, i;
+  int n = 0;
+
+  if (kernelParams)
+  {
+    params = func_params(func);
+    for (i = 0; params->count > 0 && i < (size_t)params->count; i++)
+    {
+      if (params->ptr_mask & (1ULL << i))
+      {
+        values[n++] = *(CUdeviceptr *)kernelParams[i];
+      }
+    }
+  }
+
+  if (extra)
+  {
+    for (i = 0; extra[i] != CU_LAUNCH_PARAM_END; i += 2)
+    {
+      if (extra[i] == CU_LAUNCH_PARAM_BUFFER_POINTER)
+      {
+        buffer = extra[i + 1];
+      }
+      else if (extra[i] == CU_LAUNCH_PARAM_BUFFER_SIZE)
+      {
+        buffer_size = *(size_t *)extra[i + 1];
+      }
+    }
+    // the layout is unknown, every aligned word may be a pointer
+    for (i = 0; buffer && i + sizeof(CUdeviceptr) <= buffer_size &&
+                n < RESIDENCY_MAX_PARAMS;
+         i += sizeof(CUdeviceptr))
+    {
+      values[n++] = *(CUdeviceptr *)((char *)buffer + i);
+    }
+  }
+
+  return n;
+}
+
+void residency_touch(CUdeviceptr addr, int write)
+{
+  residency_range_t *range;
+  residency_change_t change;
+  int changed = 0;
+
+  if (likely(__sync_fetch_and_add(&g_range_count, 0) == 0))
+  {
+    return;
+  }
+
+  pthread_rwlock_wrlock(&g_range_lock);
+  range = range_find(addr);
+  if (range)
+  {
+    range->last_use = monotonic_ms();
+    changed = range_access(range, write, &change);
+  }
+  pthread_rwlock_unlock(&g_range_lock);
+
+  if (changed)
+  {
+    range_advise(&change);
+  }
+}
+
+void residency_prefetch(CUfunction func, void **kernelParams, void **extra,
+                        CUstream hStream, int per_thread)
+{
+  CUdeviceptr values[RESIDENCY_MAX_PARAMS];
+  residency_range_t promoted[RESIDENCY_MAX_PARAMS];
+  residency_range_t victims[RESIDENCY_MAX_PARAMS];
+  residency_change_t changes[RESIDENCY_MAX_PARAMS];
+  residency_range_t *range;
+  int count, np = 0, nv = 0, nc = 0, i;
+  uint64_t now;
+
+  if (likely(__sync_fetch_and_add(&g_range_count, 0) == 0))
+  {
+    return;
+  }
+
+  count = collect_pointers(func, kernelParams, extra, values);
+  if (count == 0)
+  {
+    return;
+  }
+
+  // everything this launch uses is hot, so it is never its own victim
+  now = monotonic_ms();
+  pthread_rwlock_wrlock(&g_range_lock);
+  g_launch_seq++;
+  for (i = 0; i < count; i++)
+  {
+    range = range_find(values[i]);
+    if (!range || range->last_launch == g_launch_seq)
+    {
+      continue;
+    }
+    range->last_use = now;
+    range->last_launch = g_launch_seq;
+    nc += range_access(range, 0, &changes[nc]);
+  }
+  for (i = 0; i < count; i++)
+  {
+    range = range_find(values[i]);
+    if (!range || range->resident)
+    {
+      continue;
+    }
+    nv += range_evict(range->device, range->size, now, victims + nv,
+                      RESIDENCY_MAX_PARAMS - nv);
+    if (!range_fits(range->device, range->size))
+    {
+      // left to demand paging, the pod has no room for it
+      continue;
+    }
+    range->resident = 1;
+    g_resident_bytes[range->device] += range->size;
+    promoted[np++] = *range;
+  }
+  pthread_rwlock_unlock(&g_range_lock);
+
+  for (i = 0; i < nc; i++)
+  {
+    range_advise(&changes[i]);
+  }
+  // bulk migration on the launch stream, ahead of the kernel
+  for (i = 0; i < nv; i++)
+  {
+    range_demote(&victims[i], hStream, per_thread);
+  }
+  for (i = 0; i < np; i++)
+  {
+    if (range_promote(&promoted[i], hStream, per_thread) != CUDA_SUCCESS)
+    {
+      range_unpromote(promoted[i].base);
+    }
+  }
+}
+
+void residency_enforce()
+{
+  residency_range_t victims[RESIDENCY_MAX_PARAMS];
+  CUcontext ctx;
+  int device, n, i;
+
+  if (likely(__sync_fetch_and_add(&g_range_count, 0) == 0))
+  {
+    return;
+  }
+
+  for (device = 0; device < MAX_DEVICES; device++)
+  {
+    // device allocations may have grown since the ranges were promoted
+    pthread_rwlock_wrlock(&g_range_lock);
+    n = range_evict(device, 0, UINT64_MAX, victims, RESIDENCY_MAX_PARAMS);
+    pthread_rwlock_unlock(&g_range_lock);
+
+    for (i = 0; i < n; i++)
+    {
+      if (victims[i].ctx == NULL ||
+          CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPushCurrent_v2,
+                          victims[i].ctx) != CUDA_SUCCESS)
+      {
+        continue;
+      }
+      range_demote(&victims[i], NULL, 0);
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPopCurrent_v2, &ctx);
+    }
+  }
+}
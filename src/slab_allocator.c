@@ -0,0 +1,453 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+
+#define SLAB_BITMAP_WORDS ((SLAB_CHUNK_SIZE >> SLAB_MIN_SHIFT) / 64)
+
+extern entry_t cuda_library_entry[];
+extern resource_data_t g_anycuda_config;
+
+/**
+ * A device chunk serving one size class, a set bit is a used slot
+ */
+typedef struct slab_chunk_st
+{
+  CUdeviceptr base;
+  CUcontext ctx;
+  int device;
+  int klass;
+  unsigned int slots;
+  unsigned int free_count;
+  uint64_t idle_since;
+  uint64_t bitmap[SLAB_BITMAP_WORDS];
+  struct slab_chunk_st *next;
+} slab_chunk_t;
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  slab_chunk_t *chunks;
+} slab_class_t;
+
+static slab_class_t g_slab_classes[SLAB_CLASSES] = {
+    [0 ... SLAB_CLASSES - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                                .chunks = NULL},
+};
+
+/** chunks sorted by base address, to find the chunk of a freed pointer */
+static pthread_rwlock_t g_chunk_index_lock = PTHREAD_RWLOCK_INITIALIZER;
+static slab_chunk_t **g_chunk_index = NULL;
+static int g_chunk_count = 0;
+static int g_chunk_capacity = 0;
+
+static int slab_class(size_t bytesize)
+{
+  int shift = SLAB_MIN_SHIFT;
+
+  while (((size_t)1 << shift) < bytesize)
+  {
+    shift++;
+  }
+
+  return shift - SLAB_MIN_SHIFT;
+}
+
+static int index_position(CUdeviceptr dptr)
+{
+  int lo = 0, hi = g_chunk_count;
+
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+
+    if (g_chunk_index[mid]->base <= dptr)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+static int index_insert(slab_chunk_t *chunk)
+{
+  int pos;
+
+  pthread_rwlock_wrlock(&g_chunk_index_lock);
+  if (g_chunk_count == g_chunk_capacity)
+  {
+    int capacity = g_chunk_capacity ? g_chunk_capacity * 2 : 64;
+    slab_chunk_t **grown =
+        realloc(g_chunk_index, capacity * sizeof(slab_chunk_t *));
+
+    if (unlikely(!grown))
+    {
+      pthread_rwlock_unlock(&g_chunk_index_lock);
+      return 1;
+    }
+    g_chunk_index = grown;
+    g_chunk_capacity = capacity;
+  }
+  pos = index_position(chunk->base);
+  memmove(&g_chunk_index[pos + 1], &g_chunk_index[pos],
+          (g_chunk_count - pos) * sizeof(slab_chunk_t *));
+  g_chunk_index[pos] = chunk;
+  g_chunk_count++;
+  pthread_rwlock_unlock(&g_chunk_index_lock);
+
+  return 0;
+}
+
+static void index_remove(slab_chunk_t *chunk)
+{
+  int pos;
+
+  pthread_rwlock_wrlock(&g_chunk_index_lock);
+  pos = index_position(chunk->base) - 1;
+  if (pos >= 0 && g_chunk_index[pos] == chunk)
+  {
+    memmove(&g_chunk_index[pos], &g_chunk_index[pos + 1],
+            (g_chunk_count - pos - 1) * sizeof(slab_chunk_t *));
+    g_chunk_count--;
+  }
+  pthread_rwlock_unlock(&g_chunk_index_lock);
+}
+
+static slab_chunk_t *index_lookup(CUdeviceptr dptr)
+{
+  slab_chunk_t *chunk = NULL;
+  int pos;
+
+  pthread_rwlock_rdlock(&g_chunk_index_lock);
+  pos = index_position(dptr) - 1;
+  if (pos >= 0 && dptr < g_chunk_index[pos]->base + SLAB_CHUNK_SIZE)
+  {
+    chunk = g_chunk_index[pos];
+  }
+  pthread_rwlock_unlock(&g_chunk_index_lock);
+
+  return chunk;
+}
+
+/**
+ * Allocate a new chunk from the driver, the whole chunk is charged to the
+ * pod quota once
+ */
+static slab_chunk_t *slab_new_chunk(CUcontext ctx, CUdevice device, int klass)
+{
+  slab_chunk_t *chunk;
+  unsigned int i;
+  CUresult ret;
+
+  if (g_anycuda_config.valid && !g_anycuda_config.gpu_mem_limit_valid)
+  {
+    return NULL;
+  }
+  if (ledger_reserve(device, SLAB_CHUNK_SIZE,
+                     g_anycuda_config.valid
+                         ? g_anycuda_config.gpu_mem_limit[device]
+                         : (size_t)-1))
+  {
+    return NULL;
+  }
+
+  chunk = calloc(1, sizeof(slab_chunk_t));
+  if (unlikely(!chunk))
+  {
+    ledger_unreserve(device, SLAB_CHUNK_SIZE);
+    return NULL;
+  }
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuMemAlloc_v2, &chunk->base,
+                        SLAB_CHUNK_SIZE);
+  if (ret != CUDA_SUCCESS)
+  {
+    LOGGER(VERBOSE, "can't allocate slab chunk, ret is %d", ret);
+    ledger_unreserve(device, SLAB_CHUNK_SIZE);
+    free(chunk);
+    return NULL;
+  }
+  if (index_insert(chunk))
+  {
+    CUDA_ENTRY_CALL(cuda_library_entry, cuMemFree_v2, chunk->base);
+    ledger_unreserve(device, SLAB_CHUNK_SIZE);
+    free(chunk);
+    return NULL;
+  }
+  ledger_commit(chunk->base, SLAB_CHUNK_SIZE, device);
+
+  chunk->ctx = ctx;
+  chunk->device = device;
+  chunk->klass = klass;
+  chunk->slots = SLAB_CHUNK_SIZE >> (klass + SLAB_MIN_SHIFT);
+  chunk->free_count = chunk->slots;
+  chunk->idle_since = monotonic_ms();
+  // slots past the end of the chunk are never handed out
+  for (i = chunk->slots; i < SLAB_BITMAP_WORDS * 64; i++)
+  {
+    chunk->bitmap[i / 64] |= 1ULL << (i % 64);
+  }
+  LOGGER(VERBOSE, "new slab chunk 0x%llx for %u B slots on device %d",
+         chunk->base, 1U << (klass + SLAB_MIN_SHIFT), device);
+
+  return chunk;
+}
+
+static CUdeviceptr slab_take(slab_chunk_t *chunk)
+{
+  unsigned int i;
+  int bit;
+
+  for (i = 0; i < SLAB_BITMAP_WORDS; i++)
+  {
+    if (chunk->bitmap[i] != ~0ULL)
+    {
+      bit = __builtin_ctzll(~chunk->bitmap[i]);
+      chunk->bitmap[i] |= 1ULL << bit;
+      chunk->free_count--;
+      return chunk->base +
+             ((CUdeviceptr)(i * 64 + bit) << (chunk->klass + SLAB_MIN_SHIFT));
+    }
+  }
+
+  return 0;
+}
+
+static slab_chunk_t *slab_find(slab_class_t *cls, CUcontext ctx)
+{
+  slab_chunk_t *chunk;
+
+  for (chunk = cls->chunks; chunk; chunk = chunk->next)
+  {
+    if (chunk->ctx == ctx && chunk->free_count > 0)
+    {
+      break;
+    }
+  }
+
+  return chunk;
+}
+
+CUresult slab_alloc(CUdeviceptr *dptr, size_t bytesize, CUdevice device)
+{
+  slab_class_t *cls;
+  slab_chunk_t *chunk;
+  CUcontext ctx;
+  CUresult ret;
+
+  if (bytesize == 0 || bytesize > SLAB_MAX_SIZE)
+  {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  ret = CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetCurrent, &ctx);
+  if (ret != CUDA_SUCCESS || ctx == NULL)
+  {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  cls = &g_slab_classes[slab_class(bytesize)];
+
+  pthread_mutex_lock(&cls->lock);
+  chunk = slab_find(cls, ctx);
+  if (chunk)
+  {
+    *dptr = slab_take(chunk);
+    pthread_mutex_unlock(&cls->lock);
+    return CUDA_SUCCESS;
+  }
+  pthread_mutex_unlock(&cls->lock);
+
+  // the driver is called without holding the class lock
+  chunk = slab_new_chunk(ctx, device, slab_class(bytesize));
+  if (chunk == NULL)
+  {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  *dptr = slab_take(chunk);
+
+  pthread_mutex_lock(&cls->lock);
+  chunk->next = cls->chunks;
+  cls->chunks = chunk;
+  pthread_mutex_unlock(&cls->lock);
+
+  return CUDA_SUCCESS;
+}
+
+int slab_free(CUdeviceptr dptr)
+{
+  slab_chunk_t *chunk;
+  slab_class_t *cls;
+  unsigned int slot;
+  CUcontext ctx;
+
+  if (g_chunk_count == 0)
+  {
+    return 1;
+  }
+  chunk = index_lookup(dptr);
+  if (chunk == NULL)
+  {
+    return 1;
+  }
+  cls = &g_slab_classes[chunk->klass];
+  slot = (dptr - chunk->base) >> (chunk->klass + SLAB_MIN_SHIFT);
+
+  // like cuMemFree, work still in flight on the slot completes before it
+  // can be handed out again
+  if (CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPushCurrent_v2, chunk->ctx) ==
+      CUDA_SUCCESS)
+  {
+    CUDA_ENTRY_CALL(cuda_library_entry, cuCtxSynchronize);
+    CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPopCurrent_v2, &ctx);
+  }
+
+  pthread_mutex_lock(&cls->lock);
+  if (chunk->bitmap[slot / 64] & (1ULL << (slot % 64)))
+  {
+    chunk->bitmap[slot / 64] &= ~(1ULL << (slot % 64));
+    if (++chunk->free_count == chunk->slots)
+    {
+      chunk->idle_since = monotonic_ms();
+    }
+  }
+  pthread_mutex_unlock(&cls->lock);
+
+  return 0;
+}
+
+int slab_range(CUdeviceptr dptr, CUdeviceptr *base, size_t *size)
+{
+  slab_chunk_t *chunk;
+  unsigned int slot;
+  int ret = 1;
+
+  if (g_chunk_count == 0)
+  {
+    return 1;
+  }
+  chunk = index_lookup(dptr);
+  if (chunk == NULL)
+  {
+    return 1;
+  }
+  slot = (dptr - chunk->base) >> (chunk->klass + SLAB_MIN_SHIFT);
+
+  pthread_mutex_lock(&g_slab_classes[chunk->klass].lock);
+  if (slot < chunk->slots &&
+      (chunk->bitmap[slot / 64] & (1ULL << (slot % 64))))
+  {
+    *size = (size_t)1 << (chunk->klass + SLAB_MIN_SHIFT);
+    *base = chunk->base + (CUdeviceptr)slot * *size;
+    ret = 0;
+  }
+  pthread_mutex_unlock(&g_slab_classes[chunk->klass].lock);
+
+  return ret;
+}
+
+size_t slab_trim(int device, int force)
+{
+  slab_chunk_t **prev, *chunk, *released = NULL;
+  uint64_t now = monotonic_ms();
+  size_t bytes = 0;
+  CUcontext ctx;
+  int i;
+
+  for (i = 0; i < SLAB_CLASSES; i++)
+  {
+    pthread_mutex_lock(&g_slab_classes[i].lock);
+    prev = &g_slab_classes[i].chunks;
+    while ((chunk = *prev) != NULL)
+    {
+      if (chunk->free_count == chunk->slots &&
+          (device < 0 || chunk->device == device) &&
+          (force || now - chunk->idle_since >= SLAB_IDLE_TRIM * 1000))
+      {
+        *prev = chunk->next;
+        chunk->next = released;
+        released = chunk;
+        continue;
+      }
+      prev = &chunk->next;
+    }
+    pthread_mutex_unlock(&g_slab_classes[i].lock);
+  }
+
+  while ((chunk = released) != NULL)
+  {
+    released = chunk->next;
+    index_remove(chunk);
+    if (CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPushCurrent_v2, chunk->ctx) ==
+        CUDA_SUCCESS)
+    {
+      CUDA_ENTRY_CALL(cuda_library_entry, cuMemFree_v2, chunk->base);
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxPopCurrent_v2, &ctx);
+    }
+    ledger_del(chunk->base, NULL);
+    bytes += SLAB_CHUNK_SIZE;
+    free(chunk);
+  }
+  if (bytes)
+  {
+    LOGGER(VERBOSE, "released %zu bytes of slab chunks", bytes);
+  }
+
+  return bytes;
+}
+
+void slab_forget_context(CUcontext ctx)
+{
+  slab_chunk_t **prev, *chunk, *dead = NULL;
+  int i;
+
+  for (i = 0; i < SLAB_CLASSES; i++)
+  {
+    pthread_mutex_lock(&g_slab_classes[i].lock);
+    prev = &g_slab_classes[i].chunks;
+    while ((chunk = *prev) != NULL)
+    {
+      if (chunk->ctx == ctx)
+      {
+        *prev = chunk->next;
+        chunk->next = dead;
+        dead = chunk;
+        continue;
+      }
+      prev = &chunk->next;
+    }
+    pthread_mutex_unlock(&g_slab_classes[i].lock);
+  }
+
+  // a later context may get the same handle, its buffers must not come
+  // from memory freed with this one
+  while ((chunk = dead) != NULL)
+  {
+    dead = chunk->next;
+    index_remove(chunk);
+    ledger_del(chunk->base, NULL);
+    free(chunk);
+  }
+}
@@ -0,0 +1,413 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Compute limiter: a launch spends the GPU time it's predicted to take from
+// a token bucket of its device, refilled every TIME_TICK ms by a watcher thread which
+// moves the refill toward the utilization of the podconf from what NVML
+// reports for the pids of the pod.
+//
+// The pod is guaranteed its utilization and may burst up to its
+// utilizationLimit while nobody else uses the device. Under its guarantee
+// the bucket saves the refills it doesn't spend as burst credits, which are
+// dropped with the burst as soon as another process competes
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "include/cuda-helper.h"
+#include "include/hijack.h"
+#include "include/nvml-helper.h"
+
+extern entry_t cuda_library_entry[];
+extern entry_t nvml_library_entry[];
+extern resource_data_t g_anycuda_config;
+extern device_info g_devices_info[16];
+extern int g_device_count;
+
+void get_uuid_str(char *dest, CUuuid *src);
+
+/** dynamic rate control */
+typedef struct
+{
+  int user_current;
+  int sys_current;
+  int device_current;
+  int valid;
+  uint64_t checktime;
+  int sys_process_num;
+} utilization_t;
+
+/**
+ * Token bucket of a device, a token is a thread of a full wave of the device
+ * kept for a tick. A launch may leave it negative, the next ones wait until
+ * the refills paid the debt back
+ */
+typedef struct
+{
+  volatile int64_t tokens;
+  int64_t share;
+  int64_t total;
+  int sm_num;
+  int threads_per_sm;
+  utilization_t util;
+} sm_bucket_t;
+
+static sm_bucket_t g_buckets[MAX_DEVICES];
+
+static pthread_mutex_t g_bucket_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** threads per block set by cuFuncSetBlockShape for the legacy launches */
+static struct
+{
+  CUfunction f;
+  int threads;
+} g_shapes[IMPLICIT_FUNC_CACHE];
+
+static const struct timespec g_tick = {
+    .tv_sec = 0,
+    .tv_nsec = TIME_TICK * MILLISEC,
+};
+
+static int sm_limited()
+{
+  return g_anycuda_config.valid && g_anycuda_config.utilization > 0 &&
+         g_anycuda_config.utilization < MAX_UTILIZATION;
+}
+
+/**
+ * Utilization the pod may burst to, its guarantee when no limit is set
+ */
+static int sm_burst_limit()
+{
+  return g_anycuda_config.utilization_limit > g_anycuda_config.utilization
+             ? g_anycuda_config.utilization_limit
+             : g_anycuda_config.utilization;
+}
+
+/**
+ * Bucket of device, sized from its attributes the first time it's used
+ *
+ * @return NULL when device can't be limited
+ */
+static sm_bucket_t *bucket_get(CUdevice device)
+{
+  sm_bucket_t *b;
+
+  if (device < 0 || device >= MAX_DEVICES)
+  {
+    return NULL;
+  }
+  b = &g_buckets[device];
+  if (likely(b->total))
+  {
+    return b;
+  }
+
+  pthread_mutex_lock(&g_bucket_lock);
+  if (b->total == 0 &&
+      CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceGetAttribute, &b->sm_num,
+                      CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT,
+                      device) == CUDA_SUCCESS &&
+      CUDA_ENTRY_CALL(cuda_library_entry, cuDeviceGetAttribute,
+                      &b->threads_per_sm,
+                      CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_MULTIPROCESSOR,
+                      device) == CUDA_SUCCESS)
+  {
+    // a full bucket holds FACTOR waves of the whole device, the refill
+    // starts at the utilization's part of a wave and is tuned from there
+    b->share = (int64_t)b->sm_num * b->threads_per_sm *
+               g_anycuda_config.utilization / MAX_UTILIZATION;
+    b->tokens = b->share;
+    __sync_synchronize();
+    b->total = (int64_t)b->sm_num * b->threads_per_sm * FACTOR;
+    LOGGER(VERBOSE, "device %d limited to %d%% of %" PRId64 " threads", device,
+           g_anycuda_config.utilization, b->total);
+  }
+  pthread_mutex_unlock(&g_bucket_lock);
+
+  return b->total ? b : NULL;
+}
+
+/**
+ * Tokens a launch costs: the wave of the device for as long as the launch is
+ * predicted to take, its threads until it was timed
+ */
+static int64_t launch_cost(sm_bucket_t *b, CUfunction f, unsigned int blocks,
+                           unsigned int threads)
+{
+  int64_t ns = kernel_cost_predict(f, blocks, threads);
+
+  if (ns <= 0)
+  {
+    return (int64_t)blocks * threads;
+  }
+
+  return ns * b->sm_num * b->threads_per_sm / (TIME_TICK * MILLISEC) + 1;
+}
+
+kernel_sample_t *sm_limiter_launch(CUfunction f, unsigned int blocks,
+                                   unsigned int threads, CUstream hStream,
+                                   int per_thread)
+{
+  int64_t cost, before;
+  CUdevice device;
+  sm_bucket_t *b;
+
+  if (!sm_limited() ||
+      CUDA_ENTRY_CALL(cuda_library_entry, cuCtxGetDevice, &device) !=
+          CUDA_SUCCESS ||
+      (b = bucket_get(device)) == NULL)
+  {
+    return NULL;
+  }
+  cost = launch_cost(b, f, blocks, threads);
+
+  do
+  {
+    before = b->tokens;
+    // only an empty bucket blocks, the limit may be lifted meanwhile
+    if (before <= 0)
+    {
+      if (!sm_limited())
+      {
+        return NULL;
+      }
+      nanosleep(&g_tick, NULL);
+      continue;
+    }
+  } while (before <= 0 || !CAS(&b->tokens, before, before - cost));
+
+  return kernel_cost_begin(f, blocks, threads, hStream, per_thread);
+}
+
+void sm_limiter_set_shape(CUfunction f, int threads)
+{
+  unsigned int slot = ((uintptr_t)f >> 4) & (IMPLICIT_FUNC_CACHE - 1);
+
+  g_shapes[slot].threads = threads;
+  g_shapes[slot].f = f;
+}
+
+int sm_limiter_shape(CUfunction f)
+{
+  unsigned int slot = ((uintptr_t)f >> 4) & (IMPLICIT_FUNC_CACHE - 1);
+
+  // another function in the slot, a single thread is the least it can be
+  return g_shapes[slot].f == f && g_shapes[slot].threads > 0
+             ? g_shapes[slot].threads
+             : 1;
+}
+
+/**
+ * SM utilization of device since the last sample, of the whole device and
+ * of the pids of the pod
+ */
+static void sample_utilization(CUdevice device, utilization_t *util)
+{
+  static nvmlProcessUtilizationSample_t samples[MAX_PIDS];
+  unsigned int count = MAX_PIDS, i;
+  char uuid_str[48] = "";
+  int in_pod = check_in_pod() == 0;
+  nvmlUtilization_t rates;
+  struct timeval cur;
+  nvmlDevice_t dev;
+  uint64_t now;
+  int used;
+
+  // NVML stamps samples with the CPU time in microseconds
+  gettimeofday(&cur, NULL);
+  now = (uint64_t)cur.tv_sec * 1000 * 1000 + cur.tv_usec;
+  util->valid = 0;
+  util->user_current = 0;
+  util->sys_current = 0;
+  util->device_current = 0;
+  util->sys_process_num = 0;
+
+  get_uuid_str(uuid_str, &g_devices_info[device].uuid);
+  if (NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetHandleByUUID, uuid_str,
+                      &dev) != NVML_SUCCESS ||
+      NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetProcessUtilization, dev,
+                      samples, &count, util->checktime) != NVML_SUCCESS)
+  {
+    util->checktime = now;
+    return;
+  }
+  // without it the device is taken as busy, no burst is allowed
+  util->device_current =
+      NVML_ENTRY_CALL(nvml_library_entry, nvmlDeviceGetUtilizationRates, dev,
+                      &rates) == NVML_SUCCESS
+          ? GET_VALID_VALUE(rates.gpu)
+          : MAX_UTILIZATION;
+
+  for (i = 0; i < count; i++)
+  {
+    if (samples[i].timeStamp < util->checktime)
+    {
+      continue;
+    }
+    used = GET_VALID_VALUE(samples[i].smUtil) +
+           CODEC_NORMALIZE(GET_VALID_VALUE(samples[i].encUtil) +
+                           GET_VALID_VALUE(samples[i].decUtil));
+    util->valid = 1;
+    util->sys_current += used;
+    util->sys_process_num++;
+    if (!in_pod || check_pod_pid(samples[i].pid) == 0)
+    {
+      util->user_current += used;
+    }
+  }
+  util->checktime = now;
+}
+
+/**
+ * Move the refill of b toward the utilization asked for, in steps as large
+ * as the gap to it, USAGE_THRESHOLD points at least
+ */
+static void adjust_share(sm_bucket_t *b, int up_limit, int current)
+{
+  int diff = abs(up_limit - current);
+  int64_t increment;
+
+  if (diff < USAGE_THRESHOLD)
+  {
+    diff = USAGE_THRESHOLD;
+  }
+  increment = (int64_t)b->sm_num * b->sm_num * b->threads_per_sm / 256 * diff /
+              10;
+  // far from the target, close the gap faster
+  if (diff > up_limit / 2)
+  {
+    increment = increment * diff * 2 / (up_limit + 1);
+  }
+
+  if (current <= up_limit)
+  {
+    b->share = b->share + increment > b->total ? b->total : b->share + increment;
+  }
+  else
+  {
+    b->share = b->share - increment < 0 ? 0 : b->share - increment;
+  }
+}
+
+/**
+ * Utilization b is steered to: the burst limit while the device has
+ * headroom or the pod is alone on it, the guarantee once other processes
+ * compete for a busy device. Then the refill of a burst is cut in proportion
+ * and the credits left are dropped, so the pod is back at its guarantee by
+ * the next sample
+ */
+static int sm_target(sm_bucket_t *b)
+{
+  int guaranteed = g_anycuda_config.utilization;
+  int others = b->util.sys_current - b->util.user_current;
+  int64_t before, after;
+
+  if (others < USAGE_THRESHOLD ||
+      b->util.device_current < MAX_UTILIZATION - USAGE_THRESHOLD)
+  {
+    return sm_burst_limit();
+  }
+  if (b->util.user_current > guaranteed)
+  {
+    b->share = b->share * guaranteed / b->util.user_current;
+    do
+    {
+      before = b->tokens;
+      after = before > b->share ? b->share : before;
+    } while (!CAS(&b->tokens, before, after));
+    LOGGER(VERBOSE, "contention at %d%%, pod back to %d%%", others, guaranteed);
+  }
+
+  return guaranteed;
+}
+
+/**
+ * Add the refill of b. Below its guarantee the pod saves credits up to
+ * total, otherwise the bucket holds no more than a refill
+ */
+static void refill(sm_bucket_t *b)
+{
+  int64_t before, after, cap;
+
+  cap = b->util.user_current < g_anycuda_config.utilization ? b->total
+                                                            : b->share;
+  do
+  {
+    before = b->tokens;
+    after = before + b->share > cap ? (before > cap ? before : cap)
+                                     : before + b->share;
+  } while (!CAS(&b->tokens, before, after));
+}
+
+static void *sm_watcher(void *arg UNUSED)
+{
+  unsigned int ticks = 0;
+  sm_bucket_t *b;
+  int target;
+  int i;
+
+  LOGGER(5, "start %s", __FUNCTION__);
+  while (1)
+  {
+    nanosleep(&g_tick, NULL);
+    kernel_cost_harvest();
+    if (!sm_limited())
+    {
+      continue;
+    }
+    ticks++;
+    for (i = 0; i < g_device_count && i < MAX_DEVICES; i++)
+    {
+      b = &g_buckets[i];
+      if (b->total == 0)
+      {
+        continue;
+      }
+      // NVML aggregates utilization over much longer than a tick
+      if (ticks % CHANGE_LIMIT_INTERVAL == 0)
+      {
+        sample_utilization(i, &b->util);
+        if (b->util.valid)
+        {
+          target = sm_target(b);
+          adjust_share(b, target, b->util.user_current);
+          LOGGER(VERBOSE,
+                 "device %d pod at %d%% of %d%%, device at %d%%, share %" PRId64,
+                 i, b->util.user_current, target, b->util.device_current,
+                 b->share);
+        }
+      }
+      refill(b);
+    }
+  }
+
+  return NULL;
+}
+
+void sm_limiter_start()
+{
+  pthread_t tid;
+
+  pthread_create(&tid, NULL, sm_watcher, NULL);
+  pthread_setname_np(tid, "sm_watcher");
+}
@@ -0,0 +1,314 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Scheduling decisions of the node arbiter driven by a fake clock. Grants
+// and revokes are recorded instead of sent, clients which are revoked
+// release at once
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "include/arbiter.h"
+
+#define TEST_DEVICE "GPU-test"
+#define TEST_CLIENTS (4)
+
+static int g_failed = 0;
+
+#define CHECK(cond)                                                    \
+  ({                                                                   \
+    if (!(cond))                                                       \
+    {                                                                  \
+      fprintf(stderr, "%s:%d check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                  \
+      g_failed = 1;                                                    \
+    }                                                                  \
+  })
+
+/**
+ * What the scheduler told each client
+ */
+typedef struct
+{
+  int grants[TEST_CLIENTS];
+  int revokes[TEST_CLIENTS];
+  int revoked[TEST_CLIENTS]; /**< a revoke not answered yet */
+  int holder;
+} test_record_t;
+
+static arbiter_t g_arb;
+static test_record_t g_record;
+
+static void record_grant(void *opaque, int client, const char *uuid,
+                         uint32_t slice_ms)
+{
+  test_record_t *r = opaque;
+
+  CHECK(strcmp(uuid, TEST_DEVICE) == 0);
+  CHECK(slice_ms == ARBITER_SLICE_MS);
+  r->grants[client]++;
+  r->holder = client;
+}
+
+static void record_revoke(void *opaque, int client, const char *uuid)
+{
+  test_record_t *r = opaque;
+
+  CHECK(strcmp(uuid, TEST_DEVICE) == 0);
+  r->revokes[client]++;
+  r->revoked[client] = 1;
+}
+
+static void setup()
+{
+  arbiter_ops_t ops = {
+      .opaque = &g_record,
+      .grant = record_grant,
+      .revoke = record_revoke,
+  };
+
+  memset(&g_record, 0, sizeof(g_record));
+  g_record.holder = -1;
+  arbiter_init(&g_arb, &ops, 0);
+}
+
+static uint64_t vtime(int client)
+{
+  return g_arb.pods[g_arb.clients[client].pod].vtime[0];
+}
+
+/**
+ * Run every client in clients wanting the device all the time from now to
+ * end, one millisecond after the other
+ *
+ * @param held milliseconds each client held the device, added to
+ */
+static void contend(const int *clients, int count, uint64_t now, uint64_t end,
+                    uint64_t *held)
+{
+  int i, c;
+
+  for (; now < end; now++)
+  {
+    arbiter_tick(&g_arb, now);
+    for (i = 0; i < count; i++)
+    {
+      c = clients[i];
+      if (g_record.revoked[c])
+      {
+        g_record.revoked[c] = 0;
+        if (g_record.holder == c)
+        {
+          g_record.holder = -1;
+        }
+        arbiter_release(&g_arb, c, TEST_DEVICE, now);
+        arbiter_acquire(&g_arb, c, TEST_DEVICE, now);
+      }
+    }
+    for (i = 0; i < count; i++)
+    {
+      if (g_record.holder == clients[i])
+      {
+        held[i]++;
+      }
+    }
+  }
+}
+
+/**
+ * Pods get the device in the ratio of their weights
+ */
+static void test_weight()
+{
+  int clients[] = {0, 1};
+  uint64_t held[2] = {0, 0};
+
+  setup();
+  CHECK(arbiter_hello(&g_arb, 0, "pod-a", 75) == 0);
+  CHECK(arbiter_hello(&g_arb, 1, "pod-b", 25) == 0);
+  CHECK(arbiter_acquire(&g_arb, 0, TEST_DEVICE, 0) == 0);
+  CHECK(arbiter_acquire(&g_arb, 1, TEST_DEVICE, 0) == 0);
+
+  contend(clients, 2, 0, 20000, held);
+  CHECK(held[0] + held[1] >= 19000);
+  // 3:1, within a slice or two of rounding
+  CHECK(held[0] > held[1] * 27 / 10 && held[0] < held[1] * 33 / 10);
+}
+
+/**
+ * The holder keeps the device while nobody else waits, it's revoked once
+ * its slice is over while another pod waits, and the waiter gets it when
+ * the holder lets go
+ */
+static void test_revoke()
+{
+  setup();
+  CHECK(arbiter_hello(&g_arb, 0, "pod-a", 1) == 0);
+  CHECK(arbiter_hello(&g_arb, 1, "pod-b", 1) == 0);
+  CHECK(arbiter_acquire(&g_arb, 0, TEST_DEVICE, 0) == 0);
+  CHECK(g_record.grants[0] == 1);
+  CHECK(arbiter_tick(&g_arb, 100) == -1);
+  CHECK(g_record.revokes[0] == 0);
+
+  CHECK(arbiter_acquire(&g_arb, 1, TEST_DEVICE, 100) == 0);
+  CHECK(g_record.grants[1] == 0);
+  CHECK(arbiter_tick(&g_arb, 110) == ARBITER_SLICE_MS - 10);
+  CHECK(g_record.revokes[0] == 0);
+  arbiter_tick(&g_arb, 100 + ARBITER_SLICE_MS);
+  CHECK(g_record.revokes[0] == 1);
+  // told once, however long it takes to drain
+  arbiter_tick(&g_arb, 200);
+  CHECK(g_record.revokes[0] == 1);
+  CHECK(g_record.grants[1] == 0);
+
+  arbiter_release(&g_arb, 0, TEST_DEVICE, 201);
+  CHECK(g_record.grants[1] == 1);
+  CHECK(g_record.holder == 1);
+}
+
+/**
+ * Holding the device alone for an hour costs nothing, a pod arriving then
+ * gets it within a slice
+ */
+static void test_uncontended()
+{
+  uint64_t hour = 3600ull * 1000;
+
+  setup();
+  CHECK(arbiter_hello(&g_arb, 0, "pod-a", 1) == 0);
+  CHECK(arbiter_hello(&g_arb, 1, "pod-b", 1) == 0);
+  CHECK(arbiter_acquire(&g_arb, 0, TEST_DEVICE, 0) == 0);
+  CHECK(arbiter_tick(&g_arb, hour / 2) == -1);
+
+  CHECK(arbiter_acquire(&g_arb, 1, TEST_DEVICE, hour) == 0);
+  arbiter_tick(&g_arb, hour + ARBITER_SLICE_MS);
+  CHECK(g_record.revokes[0] == 1);
+  CHECK(vtime(0) <= 2 * ARBITER_SLICE_MS * ARBITER_WEIGHT_SCALE);
+  arbiter_release(&g_arb, 0, TEST_DEVICE, hour + ARBITER_SLICE_MS);
+  CHECK(g_record.holder == 1);
+
+  // a release after time alone is free too
+  arbiter_release(&g_arb, 1, TEST_DEVICE, hour + ARBITER_SLICE_MS + 1);
+  CHECK(arbiter_acquire(&g_arb, 1, TEST_DEVICE, hour + 100) == 0);
+  arbiter_release(&g_arb, 1, TEST_DEVICE, 2 * hour);
+  CHECK(vtime(1) <= 2 * ARBITER_SLICE_MS * ARBITER_WEIGHT_SCALE);
+}
+
+/**
+ * A pod which was idle comes back at the clock of the device, instead of
+ * holding it until it caught up with the pods which kept working
+ */
+static void test_idle()
+{
+  int clients[] = {0, 1, 2};
+  uint64_t held[3] = {0, 0, 0};
+
+  setup();
+  CHECK(arbiter_hello(&g_arb, 0, "pod-a", 1) == 0);
+  CHECK(arbiter_hello(&g_arb, 1, "pod-b", 1) == 0);
+  CHECK(arbiter_hello(&g_arb, 2, "pod-c", 1) == 0);
+  CHECK(arbiter_acquire(&g_arb, 0, TEST_DEVICE, 0) == 0);
+  CHECK(arbiter_acquire(&g_arb, 1, TEST_DEVICE, 0) == 0);
+  contend(clients, 2, 0, 10000, held);
+  CHECK(g_arb.devices[0].vclock > 0);
+
+  CHECK(arbiter_acquire(&g_arb, 2, TEST_DEVICE, 10000) == 0);
+  CHECK(vtime(2) == g_arb.devices[0].vclock);
+
+  memset(held, 0, sizeof(held));
+  contend(clients, 3, 10000, 13000, held);
+  CHECK(held[0] > 800 && held[1] > 800 && held[2] > 800);
+  CHECK(held[2] < 1200);
+}
+
+/**
+ * A holder which goes away hands the device to the next waiter, and its
+ * pod slot is free again
+ */
+static void test_disconnect()
+{
+  setup();
+  CHECK(arbiter_hello(&g_arb, 0, "pod-a", 1) == 0);
+  CHECK(arbiter_hello(&g_arb, 1, "pod-b", 1) == 0);
+  CHECK(arbiter_acquire(&g_arb, 0, TEST_DEVICE, 0) == 0);
+  CHECK(arbiter_acquire(&g_arb, 1, TEST_DEVICE, 5) == 0);
+  CHECK(g_record.holder == 0);
+
+  arbiter_disconnect(&g_arb, 0, 10);
+  CHECK(g_record.holder == 1);
+  CHECK(g_record.grants[1] == 1);
+  CHECK(g_arb.clients[0].pod == -1);
+  CHECK(g_arb.pods[0].clients == 0);
+  // nobody is left to take it from
+  CHECK(arbiter_tick(&g_arb, 1000) == -1);
+  CHECK(g_record.revokes[1] == 0);
+  // the client slot can say hello again
+  CHECK(arbiter_hello(&g_arb, 0, "pod-c", 1) == 0);
+  CHECK(arbiter_acquire(&g_arb, 3, TEST_DEVICE, 1000) == 1);
+}
+
+/**
+ * Processes of one pod take turns with the device, slice by slice
+ */
+static void test_same_pod()
+{
+  int clients[] = {0, 1};
+  uint64_t held[2] = {0, 0};
+
+  setup();
+  CHECK(arbiter_hello(&g_arb, 0, "pod-a", 1) == 0);
+  CHECK(arbiter_hello(&g_arb, 1, "pod-a", 1) == 0);
+  CHECK(arbiter_acquire(&g_arb, 0, TEST_DEVICE, 0) == 0);
+  CHECK(arbiter_acquire(&g_arb, 1, TEST_DEVICE, 0) == 0);
+  CHECK(g_record.holder == 0);
+
+  arbiter_tick(&g_arb, ARBITER_SLICE_MS);
+  CHECK(g_record.revokes[0] == 1);
+
+  contend(clients, 2, 0, 10000, held);
+  CHECK(g_record.grants[1] > 0);
+  CHECK(held[0] > 4500 && held[1] > 4500);
+}
+
+static int run(const char *name, void (*test)())
+{
+  int failed;
+
+  g_failed = 0;
+  test();
+  failed = g_failed;
+  fprintf(stderr, "%s %s\n", name, failed ? "FAILED" : "ok");
+
+  return failed;
+}
+
+int main()
+{
+  int failed = 0;
+
+  failed |= run("weight", test_weight);
+  failed |= run("revoke", test_revoke);
+  failed |= run("uncontended", test_uncontended);
+  failed |= run("idle", test_idle);
+  failed |= run("disconnect", test_disconnect);
+  failed |= run("same_pod", test_same_pod);
+
+  return failed;
+}
@@ -0,0 +1,214 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Pod membership of pids checked against fake proc trees. Each scenario runs
+// in a child process, the pod cgroup is only read once per process
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "include/hijack.h"
+
+static char g_root[FILENAME_MAX];
+static int g_failed = 0;
+
+#define CHECK(cond)                                                    \
+  ({                                                                   \
+    if (!(cond))                                                       \
+    {                                                                  \
+      fprintf(stderr, "%s:%d check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                  \
+      g_failed = 1;                                                    \
+    }                                                                  \
+  })
+
+/**
+ * Write content to <g_root>/<tree>/<pid>/<name>
+ */
+static void write_proc(const char *tree, unsigned int pid, const char *name,
+                       const char *content)
+{
+  char path[FILENAME_MAX];
+  FILE *f;
+
+  snprintf(path, sizeof(path), "%s/%s", g_root, tree);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/%s/%u", g_root, tree, pid);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/%s/%u/%s", g_root, tree, pid, name);
+  f = fopen(path, "w");
+  if (f == NULL)
+  {
+    LOGGER(FATAL, "can't write %s", path);
+  }
+  fputs(content, f);
+  fclose(f);
+}
+
+/**
+ * A stat line whose 22nd field, the start time, is start_time
+ */
+static void write_stat(unsigned int pid, uint64_t start_time)
+{
+  char stat[256];
+
+  snprintf(stat, sizeof(stat),
+           "%u (a (b) c) S 1 1 1 0 -1 0 0 0 0 0 0 0 0 0 20 0 1 0 %" PRIu64
+           " 0 0\n",
+           pid, start_time);
+  write_proc("host_proc", pid, "stat", stat);
+}
+
+static void use_trees()
+{
+  char path[FILENAME_MAX];
+
+  snprintf(path, sizeof(path), "%s/host_proc", g_root);
+  setenv(HOST_PROC_PATH_ENV, path, 1);
+  snprintf(path, sizeof(path), "%s/proc", g_root);
+  setenv(PROC_PATH_ENV, path, 1);
+}
+
+/**
+ * cgroup v1: the memory controller line names the cgroup, the unified line
+ * is the fallback
+ */
+static void test_v1()
+{
+  write_proc("proc", 1, "cgroup",
+             "12:cpu,cpuacct:/kubepods/poda/c1\n"
+             "11:memory:/kubepods/poda/c1\n"
+             "0::/\n");
+  write_proc("host_proc", 100, "cgroup",
+             "12:cpu,cpuacct:/kubepods/poda/c1\n"
+             "11:memory:/kubepods/poda/c1\n");
+  write_stat(100, 1000);
+  write_proc("host_proc", 101, "cgroup", "11:memory:/kubepods/podb/c1\n");
+  write_stat(101, 1000);
+  write_proc("host_proc", 102, "cgroup",
+             "12:cpu:/elsewhere\n"
+             "0::/kubepods/poda/c1/sub\n");
+  write_stat(102, 1000);
+  write_proc("host_proc", 103, "cgroup", "11:memory:/../kubepods/poda/c1\n");
+  write_stat(103, 1000);
+  use_trees();
+
+  CHECK(check_in_pod() == 0);
+  CHECK(check_pod_pid(0) == 1);
+  CHECK(check_pod_pid(100) == 0);
+  CHECK(check_pod_pid(101) == 1);
+  CHECK(check_pod_pid(102) == 0);
+  CHECK(check_pod_pid(103) == 1);
+  // no such process
+  CHECK(check_pod_pid(104) == 1);
+
+  // same process, the cached answer holds
+  write_proc("host_proc", 100, "cgroup", "11:memory:/kubepods/podb/c1\n");
+  CHECK(check_pod_pid(100) == 0);
+  // the pid was reused, it's looked up again
+  write_stat(100, 2000);
+  CHECK(check_pod_pid(100) == 1);
+}
+
+/**
+ * cgroup v2 in a cgroup namespace: the pod sees itself at "/", processes
+ * outside the namespace at "/.."
+ */
+static void test_v2()
+{
+  write_proc("proc", 1, "cgroup", "0::/\n");
+  write_proc("host_proc", 200, "cgroup", "0::/\n");
+  write_stat(200, 1000);
+  write_proc("host_proc", 201, "cgroup", "0::/worker\n");
+  write_stat(201, 1000);
+  write_proc("host_proc", 202, "cgroup", "0::/../../kubepods/podb/c1\n");
+  write_stat(202, 1000);
+  write_proc("host_proc", 203, "cgroup", "garbage\n");
+  write_stat(203, 1000);
+  use_trees();
+
+  CHECK(check_in_pod() == 0);
+  CHECK(check_pod_pid(200) == 0);
+  CHECK(check_pod_pid(201) == 0);
+  CHECK(check_pod_pid(202) == 1);
+  CHECK(check_pod_pid(203) == 1);
+}
+
+/**
+ * Without a host proc tree the library is not in a pod, and a pod cgroup
+ * which can't be read matches nothing
+ */
+static void test_no_host_proc()
+{
+  char path[FILENAME_MAX];
+
+  snprintf(path, sizeof(path), "%s/none", g_root);
+  setenv(HOST_PROC_PATH_ENV, path, 1);
+  setenv(PROC_PATH_ENV, path, 1);
+
+  CHECK(check_in_pod() == 1);
+  CHECK(check_pod_pid(100) == 1);
+}
+
+static int run(const char *name, void (*test)())
+{
+  char cmd[FILENAME_MAX + 16];
+  int status;
+  pid_t pid;
+
+  snprintf(g_root, sizeof(g_root), "/tmp/cgroup_test.XXXXXX");
+  if (mkdtemp(g_root) == NULL)
+  {
+    LOGGER(FATAL, "can't create a temp dir");
+  }
+
+  pid = fork();
+  if (pid == 0)
+  {
+    test();
+    exit(g_failed);
+  }
+  waitpid(pid, &status, 0);
+
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", g_root);
+  if (system(cmd) != 0)
+  {
+    LOGGER(WARNING, "can't remove %s", g_root);
+  }
+  status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+  fprintf(stderr, "%s %s\n", name, status ? "FAILED" : "ok");
+
+  return status;
+}
+
+int main()
+{
+  int failed = 0;
+
+  failed |= run("v1", test_v1);
+  failed |= run("v2", test_v2);
+  failed |= run("no_host_proc", test_no_host_proc);
+
+  return failed;
+}
@@ -0,0 +1,156 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Print the usage segment of a pod: device usage, what the pod paid for
+// allocations over its limit, the processes attached and the memory they
+// share through IPC
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "include/hijack.h"
+
+static const char *g_policy_names[OVER_LIMIT_POLICIES] = {
+    [OVER_LIMIT_OOM] = "oom",
+    [OVER_LIMIT_MANAGED] = "managed",
+    [OVER_LIMIT_HOSTMAPPED] = "hostmapped",
+    [OVER_LIMIT_WAIT] = "wait",
+    [OVER_LIMIT_PEER] = "peer",
+};
+
+int main(int argc, char **argv)
+{
+  char shm_name[FILENAME_MAX];
+  pod_shm_t *shm = MAP_FAILED;
+  pod_policy_stat_t *stat;
+  pod_proc_slot_t *slot;
+  pod_ipc_entry_t *entry;
+  int ret = 1;
+  int fd, i, j, importers;
+
+  if (argc != 2)
+  {
+    fprintf(stderr, "usage: %s pod_name\n", argv[0]);
+    return 1;
+  }
+
+  snprintf(shm_name, sizeof(shm_name), "%s%s", POD_SHM_PREFIX, argv[1]);
+  fd = shm_open(shm_name, O_RDONLY, 0);
+  if (fd == -1)
+  {
+    LOGGER(ERROR, "can't open %s, error %s", shm_name, strerror(errno));
+    goto DONE;
+  }
+  shm = mmap(NULL, sizeof(pod_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm == MAP_FAILED)
+  {
+    LOGGER(ERROR, "can't map %s, error %s", shm_name, strerror(errno));
+    goto DONE;
+  }
+  if (shm->magic != POD_SHM_MAGIC || shm->version != POD_SHM_VERSION)
+  {
+    LOGGER(ERROR, "%s has unknown layout %x/%u", shm_name, shm->magic,
+           shm->version);
+    goto DONE;
+  }
+
+  printf("%-8s %16s %16s\n", "device", "used", "reserved");
+  for (i = 0; i < MAX_DEVICES; i++)
+  {
+    if (shm->devices[i].used == 0 && shm->devices[i].reserved == 0)
+    {
+      continue;
+    }
+    printf("%-8d %16zu %16zu\n", i, shm->devices[i].used,
+           shm->devices[i].reserved);
+  }
+  printf("%-8s %16zu\n", "pinned", shm->pinned);
+
+  printf("\n%-12s %12s %16s %12s %12s\n", "policy", "count", "bytes",
+         "failed", "wait_ms");
+  for (i = 0; i < OVER_LIMIT_POLICIES; i++)
+  {
+    stat = &shm->policies[i];
+    printf("%-12s %12" PRIu64 " %16" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+           g_policy_names[i], stat->count, stat->bytes, stat->failed,
+           stat->wait_ms);
+  }
+
+  printf("\n%-8s %-8s %16s\n", "pid", "device", "used");
+  for (i = 0; i < POD_SHM_MAX_PROCS; i++)
+  {
+    slot = &shm->procs[i];
+    if (slot->pid <= 0)
+    {
+      continue;
+    }
+    for (j = 0; j < MAX_DEVICES; j++)
+    {
+      if (slot->used[j] || slot->reserved[j])
+      {
+        printf("%-8d %-8d %16zu\n", slot->pid, j, slot->used[j]);
+      }
+    }
+    if (slot->pinned)
+    {
+      printf("%-8d %-8s %16zu\n", slot->pid, "pinned", slot->pinned);
+    }
+  }
+
+  printf("\n%-8s %-8s %16s %10s\n", "exporter", "device", "size",
+         "importers");
+  for (i = 0; i < POD_SHM_MAX_IPC; i++)
+  {
+    entry = &shm->ipc[i];
+    if (entry->exporter == 0)
+    {
+      continue;
+    }
+    importers = 0;
+    for (j = 0; j < POD_SHM_MAX_PROCS / 64; j++)
+    {
+      importers += __builtin_popcountll(entry->importers[j]);
+    }
+    // an exporter which let go shows as gone, the pod still pays
+    if (entry->exporter > 0)
+    {
+      printf("%-8d %-8d %16zu %10d\n", shm->procs[entry->exporter - 1].pid,
+             entry->device, entry->size, importers);
+    }
+    else
+    {
+      printf("%-8s %-8d %16zu %10d\n", "gone", entry->device, entry->size,
+             importers);
+    }
+  }
+
+  ret = 0;
+DONE:
+  if (shm != MAP_FAILED)
+  {
+    munmap(shm, sizeof(pod_shm_t));
+  }
+
+  return ret;
+}
@@ -0,0 +1,348 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Scheduling decisions of the node arbiter. Nothing here reads a clock or
+// touches a socket: time comes from the caller and decisions leave through
+// arbiter_ops_t, so the scheduler runs the same against a mock driver
+//
+
+#include <string.h>
+
+#include "include/arbiter.h"
+
+void arbiter_init(arbiter_t *arb, const arbiter_ops_t *ops, uint32_t slice_ms)
+{
+  int i;
+
+  memset(arb, 0, sizeof(*arb));
+  arb->ops = *ops;
+  arb->slice_ms = slice_ms ? slice_ms : ARBITER_SLICE_MS;
+  for (i = 0; i < ARBITER_MAX_CLIENTS; i++)
+  {
+    arb->clients[i].pod = -1;
+  }
+  for (i = 0; i < ARBITER_MAX_DEVICES; i++)
+  {
+    arb->devices[i].holder = -1;
+  }
+}
+
+static int valid_client(arbiter_t *arb, int client)
+{
+  return client >= 0 && client < ARBITER_MAX_CLIENTS &&
+         arb->clients[client].pod >= 0;
+}
+
+/**
+ * Slot of device uuid, taken when create is set and it's new
+ *
+ * @return slot, or -1
+ */
+static int device_find(arbiter_t *arb, const char *uuid, int create)
+{
+  int i, free = -1;
+
+  for (i = 0; i < ARBITER_MAX_DEVICES; i++)
+  {
+    if (arb->devices[i].uuid[0] == '\0')
+    {
+      free = free < 0 ? i : free;
+      continue;
+    }
+    if (strncmp(arb->devices[i].uuid, uuid, ARBITER_NAME_LEN) == 0)
+    {
+      return i;
+    }
+  }
+  if (!create || free < 0)
+  {
+    return -1;
+  }
+  strncpy(arb->devices[free].uuid, uuid, ARBITER_NAME_LEN - 1);
+
+  return free;
+}
+
+/**
+ * Whether a client of pod other than skip holds or waits for device d
+ */
+static int pod_active(arbiter_t *arb, int pod, int d, int skip)
+{
+  int i;
+
+  for (i = 0; i < ARBITER_MAX_CLIENTS; i++)
+  {
+    if (i == skip || arb->clients[i].pod != pod)
+    {
+      continue;
+    }
+    if (arb->clients[i].waiting[d] || arb->devices[d].holder == i)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * Waiting client of device d whose pod has the least virtual time, the one
+ * which asked first among a pod
+ *
+ * @return client, or -1 when nobody waits
+ */
+static int next_waiter(arbiter_t *arb, int d)
+{
+  arbiter_client_t *c;
+  uint64_t vtime, best_vtime = 0;
+  int i, best = -1;
+
+  for (i = 0; i < ARBITER_MAX_CLIENTS; i++)
+  {
+    c = &arb->clients[i];
+    if (c->pod < 0 || c->waiting[d] == 0)
+    {
+      continue;
+    }
+    vtime = arb->pods[c->pod].vtime[d];
+    if (best < 0 || vtime < best_vtime ||
+        (vtime == best_vtime &&
+         c->waiting[d] < arb->clients[best].waiting[d]))
+    {
+      best = i;
+      best_vtime = vtime;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * Charge the pod of the holder of d for the time it held it since the last
+ * charge, only while somebody waited for d: using an idle device costs
+ * nothing
+ */
+static void charge(arbiter_t *arb, int d, uint64_t now)
+{
+  arbiter_device_t *dev = &arb->devices[d];
+  arbiter_pod_t *pod = &arb->pods[arb->clients[dev->holder].pod];
+  uint64_t held = now > dev->granted_at ? now - dev->granted_at : 0;
+
+  if (next_waiter(arb, d) >= 0)
+  {
+    pod->vtime[d] += held * ARBITER_WEIGHT_SCALE / pod->weight;
+  }
+  dev->granted_at = now;
+}
+
+/**
+ * Grant free device d to the next waiter
+ */
+static void dispatch(arbiter_t *arb, int d, uint64_t now)
+{
+  arbiter_device_t *dev = &arb->devices[d];
+  int next;
+
+  if (dev->holder >= 0 || (next = next_waiter(arb, d)) < 0)
+  {
+    return;
+  }
+
+  arb->clients[next].waiting[d] = 0;
+  dev->holder = next;
+  dev->revoking = 0;
+  dev->granted_at = now;
+  dev->vclock = arb->pods[arb->clients[next].pod].vtime[d];
+  arb->ops.grant(arb->ops.opaque, next, dev->uuid, arb->slice_ms);
+}
+
+/**
+ * Revoke the slice of d when it's over and a waiter of the same pod, or one
+ * served less than the holder for its weight, waits. Otherwise the holder
+ * gets another slice
+ *
+ * @return milliseconds until it's over, -1 when it doesn't have to end
+ */
+static int64_t check_slice(arbiter_t *arb, int d, uint64_t now)
+{
+  arbiter_device_t *dev = &arb->devices[d];
+  uint64_t end = dev->granted_at + arb->slice_ms;
+  int next;
+
+  if (dev->holder < 0 || dev->revoking || (next = next_waiter(arb, d)) < 0)
+  {
+    return -1;
+  }
+  if (now < end)
+  {
+    return (int64_t)(end - now);
+  }
+
+  // the holder is charged slice by slice, so a release only charges the
+  // last one
+  charge(arb, d, now);
+  // processes of one pod share its virtual time, they take turns
+  if (arb->clients[dev->holder].pod != arb->clients[next].pod &&
+      arb->pods[arb->clients[dev->holder].pod].vtime[d] <=
+          arb->pods[arb->clients[next].pod].vtime[d])
+  {
+    return arb->slice_ms;
+  }
+  dev->revoking = 1;
+  arb->ops.revoke(arb->ops.opaque, dev->holder, dev->uuid);
+
+  return -1;
+}
+
+int arbiter_hello(arbiter_t *arb, int client, const char *pod,
+                  uint32_t weight)
+{
+  int i, free = -1, found = -1;
+
+  if (client < 0 || client >= ARBITER_MAX_CLIENTS ||
+      arb->clients[client].pod >= 0)
+  {
+    return 1;
+  }
+  for (i = 0; i < ARBITER_MAX_PODS; i++)
+  {
+    if (arb->pods[i].clients == 0)
+    {
+      free = free < 0 ? i : free;
+      continue;
+    }
+    if (strncmp(arb->pods[i].name, pod, ARBITER_NAME_LEN) == 0)
+    {
+      found = i;
+      break;
+    }
+  }
+  if (found < 0)
+  {
+    if (free < 0)
+    {
+      return 1;
+    }
+    found = free;
+    memset(&arb->pods[found], 0, sizeof(arbiter_pod_t));
+    strncpy(arb->pods[found].name, pod, ARBITER_NAME_LEN - 1);
+  }
+  // the last process to say hello sets the weight of its pod
+  arb->pods[found].weight = weight ? weight : 1;
+  arb->pods[found].clients++;
+  memset(&arb->clients[client], 0, sizeof(arbiter_client_t));
+  arb->clients[client].pod = found;
+
+  return 0;
+}
+
+int arbiter_acquire(arbiter_t *arb, int client, const char *uuid,
+                    uint64_t now)
+{
+  arbiter_client_t *c;
+  arbiter_pod_t *pod;
+  int d;
+
+  if (!valid_client(arb, client) || (d = device_find(arb, uuid, 1)) < 0)
+  {
+    return 1;
+  }
+  c = &arb->clients[client];
+  if (arb->devices[d].holder == client || c->waiting[d])
+  {
+    return 0;
+  }
+
+  // a pod coming back from idle starts at the clock of the device, time it
+  // didn't use is not saved up to starve the others later
+  pod = &arb->pods[c->pod];
+  if (!pod_active(arb, c->pod, d, client) &&
+      pod->vtime[d] < arb->devices[d].vclock)
+  {
+    pod->vtime[d] = arb->devices[d].vclock;
+  }
+  // the time the holder had the device to itself is settled for free, its
+  // slice starts with the contention
+  if (arb->devices[d].holder >= 0 && next_waiter(arb, d) < 0)
+  {
+    charge(arb, d, now);
+  }
+  c->waiting[d] = ++arb->seq;
+  dispatch(arb, d, now);
+  check_slice(arb, d, now);
+
+  return 0;
+}
+
+void arbiter_release(arbiter_t *arb, int client, const char *uuid,
+                     uint64_t now)
+{
+  int d;
+
+  if (!valid_client(arb, client) || (d = device_find(arb, uuid, 0)) < 0)
+  {
+    return;
+  }
+  arb->clients[client].waiting[d] = 0;
+  if (arb->devices[d].holder != client)
+  {
+    return;
+  }
+  charge(arb, d, now);
+  arb->devices[d].holder = -1;
+  arb->devices[d].revoking = 0;
+  dispatch(arb, d, now);
+}
+
+void arbiter_disconnect(arbiter_t *arb, int client, uint64_t now)
+{
+  int d;
+
+  if (!valid_client(arb, client))
+  {
+    return;
+  }
+  for (d = 0; d < ARBITER_MAX_DEVICES; d++)
+  {
+    if (arb->devices[d].uuid[0] != '\0')
+    {
+      arbiter_release(arb, client, arb->devices[d].uuid, now);
+    }
+  }
+  arb->pods[arb->clients[client].pod].clients--;
+  arb->clients[client].pod = -1;
+}
+
+int64_t arbiter_tick(arbiter_t *arb, uint64_t now)
+{
+  int64_t next = -1, left;
+  int d;
+
+  for (d = 0; d < ARBITER_MAX_DEVICES; d++)
+  {
+    left = check_slice(arb, d, now);
+    if (left >= 0 && (next < 0 || left < next))
+    {
+      next = left;
+    }
+  }
+
+  return next;
+}
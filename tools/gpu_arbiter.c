@@ -0,0 +1,240 @@
+/*
+ * Tencent is pleased to support the open source community by making TKEStack
+ * available.
+ *
+ * Copyright (C) 2012-2019 Tencent. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License. You may obtain a copy of
+ * the License at
+ *
+ * https://opensource.org/licenses/Apache-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OF ANY KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations under the License.
+ */
+
+//
+// Node arbiter: hands out time slices of the GPUs to the processes of every
+// pod on the node over a Unix socket, pods sharing a device get it in turn
+// as their weights say
+//
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "include/arbiter.h"
+#include "include/hijack.h"
+
+/** connection of each client, the listening socket is the last */
+static struct pollfd g_fds[ARBITER_MAX_CLIENTS + 1];
+
+static void send_msg(int client, uint32_t type, const char *uuid,
+                     uint32_t slice_ms)
+{
+  arbiter_msg_t msg = {.type = type, .slice_ms = slice_ms};
+
+  strncpy(msg.name, uuid, ARBITER_NAME_LEN - 1);
+  if (send(g_fds[client].fd, &msg, sizeof(msg), MSG_NOSIGNAL) !=
+      sizeof(msg))
+  {
+    LOGGER(WARNING, "can't send to client %d, error %s", client,
+           strerror(errno));
+  }
+}
+
+static void send_grant(void *opaque UNUSED, int client, const char *uuid,
+                       uint32_t slice_ms)
+{
+  LOGGER(VERBOSE, "grant %s to client %d", uuid, client);
+  send_msg(client, ARBITER_GRANT, uuid, slice_ms);
+}
+
+static void send_revoke(void *opaque UNUSED, int client, const char *uuid)
+{
+  LOGGER(VERBOSE, "revoke %s from client %d", uuid, client);
+  send_msg(client, ARBITER_REVOKE, uuid, 0);
+}
+
+static int listen_on(const char *path)
+{
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    LOGGER(ERROR, "socket path %s is too long", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    LOGGER(ERROR, "can't create socket, error %s", strerror(errno));
+    return -1;
+  }
+  unlink(path);
+  // processes of every pod connect, whatever user they run as
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      chmod(path, 0666) == -1 || listen(fd, ARBITER_MAX_CLIENTS) == -1)
+  {
+    LOGGER(ERROR, "can't listen on %s, error %s", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static void accept_client(int listen_fd)
+{
+  int fd, i;
+
+  fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  if (fd == -1)
+  {
+    return;
+  }
+  for (i = 0; i < ARBITER_MAX_CLIENTS; i++)
+  {
+    if (g_fds[i].fd < 0)
+    {
+      g_fds[i].fd = fd;
+      g_fds[i].events = POLLIN;
+      return;
+    }
+  }
+  LOGGER(WARNING, "too many clients, %d max", ARBITER_MAX_CLIENTS);
+  close(fd);
+}
+
+static void drop_client(arbiter_t *arb, int client)
+{
+  arbiter_disconnect(arb, client, monotonic_ms());
+  close(g_fds[client].fd);
+  g_fds[client].fd = -1;
+}
+
+static void serve_client(arbiter_t *arb, int client)
+{
+  arbiter_msg_t msg;
+  ssize_t n;
+
+  n = recv(g_fds[client].fd, &msg, sizeof(msg), 0);
+  if (n != sizeof(msg))
+  {
+    drop_client(arb, client);
+    return;
+  }
+  msg.name[ARBITER_NAME_LEN - 1] = '\0';
+
+  switch (msg.type)
+  {
+  case ARBITER_HELLO:
+    if (arbiter_hello(arb, client, msg.name, msg.weight))
+    {
+      LOGGER(WARNING, "can't register client %d of %s", client, msg.name);
+      drop_client(arb, client);
+      return;
+    }
+    LOGGER(INFO, "client %d of %s, weight %u", client, msg.name, msg.weight);
+    break;
+  case ARBITER_ACQUIRE:
+    if (arbiter_acquire(arb, client, msg.name, monotonic_ms()))
+    {
+      LOGGER(WARNING, "client %d can't queue for %s", client, msg.name);
+    }
+    break;
+  case ARBITER_RELEASE:
+    arbiter_release(arb, client, msg.name, monotonic_ms());
+    break;
+  default:
+    LOGGER(WARNING, "client %d sent unknown message %u", client, msg.type);
+    drop_client(arb, client);
+    break;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const char *path = getenv(ARBITER_SOCKET_PATH_ENV);
+  arbiter_ops_t ops = {.grant = send_grant, .revoke = send_revoke};
+  static arbiter_t arb;
+  uint32_t slice_ms = ARBITER_SLICE_MS;
+  int64_t timeout;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "s:t:")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      path = optarg;
+      break;
+    case 't':
+      slice_ms = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-s socket] [-t slice_ms]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  path = path ? path : ARBITER_SOCKET_PATH;
+
+  arbiter_init(&arb, &ops, slice_ms);
+  for (i = 0; i < ARBITER_MAX_CLIENTS; i++)
+  {
+    g_fds[i].fd = -1;
+  }
+  g_fds[ARBITER_MAX_CLIENTS].fd = listen_on(path);
+  g_fds[ARBITER_MAX_CLIENTS].events = POLLIN;
+  if (g_fds[ARBITER_MAX_CLIENTS].fd == -1)
+  {
+    return 1;
+  }
+  LOGGER(INFO, "slices of %u ms on %s", arb.slice_ms, path);
+
+  while (1)
+  {
+    timeout = arbiter_tick(&arb, monotonic_ms());
+    if (poll(g_fds, ARBITER_MAX_CLIENTS + 1, (int)timeout) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      LOGGER(FATAL, "poll error %s", strerror(errno));
+    }
+
+    for (i = 0; i < ARBITER_MAX_CLIENTS; i++)
+    {
+      if (g_fds[i].fd < 0 || g_fds[i].revents == 0)
+      {
+        continue;
+      }
+      if (g_fds[i].revents & POLLIN)
+      {
+        serve_client(&arb, i);
+      }
+      else
+      {
+        drop_client(&arb, i);
+      }
+    }
+    if (g_fds[ARBITER_MAX_CLIENTS].revents & POLLIN)
+    {
+      accept_client(g_fds[ARBITER_MAX_CLIENTS].fd);
+    }
+  }
+
+  return 0;
+}